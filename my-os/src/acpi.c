@@ -0,0 +1,131 @@
+/**
+ * @file acpi.c
+ * @brief ACPI table discovery and MADT parsing
+ */
+
+#include "acpi.h"
+#include "vmm.h"
+
+#define ACPI_EBDA_SEGMENT_PTR  0x40E      /* BIOS data area: EBDA segment */
+#define ACPI_BIOS_ROM_START    0xE0000
+#define ACPI_BIOS_ROM_END      0x100000
+
+static acpi_rsdp_t *rsdp = 0;
+
+static int bytes_equal(const char *a, const char *b, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        if (a[i] != b[i]) return 0;
+    }
+    return 1;
+}
+
+static int checksum_ok(const void *data, uint32_t length) {
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) sum += ((const uint8_t *)data)[i];
+    return sum == 0;
+}
+
+/* True if [phys, phys + length) can be read through the direct map */
+static int acpi_mapped(uint64_t phys, uint32_t length) {
+    if (phys + length > VMM_DIRECT_MAP_END) return 0;
+    return vmm_translate((uintptr_t)phys) != 0 &&
+           vmm_translate((uintptr_t)(phys + length - 1)) != 0;
+}
+
+/* Look for the RSDP on 16-byte boundaries in [start, end) */
+static acpi_rsdp_t *rsdp_scan(uintptr_t start, uintptr_t end) {
+    for (uintptr_t addr = start; addr + 20 <= end; addr += 16) {
+        acpi_rsdp_t *candidate = (acpi_rsdp_t *)addr;
+        if (bytes_equal(candidate->signature, "RSD PTR ", 8) && checksum_ok(candidate, 20)) {
+            return candidate;
+        }
+    }
+    return 0;
+}
+
+/* The RSDP is in the first KB of the EBDA or in the BIOS ROM area */
+static acpi_rsdp_t *rsdp_find() {
+    volatile uint16_t *bda = (volatile uint16_t *)ACPI_EBDA_SEGMENT_PTR;
+    __asm__("" : "+r"(bda));   /* GCC takes pointers into page 0 for bugs */
+    uintptr_t ebda = (uintptr_t)*bda << 4;
+    acpi_rsdp_t *found = 0;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        found = rsdp_scan(ebda, ebda + 1024);
+    }
+    if (!found) {
+        found = rsdp_scan(ACPI_BIOS_ROM_START, ACPI_BIOS_ROM_END);
+    }
+    return found;
+}
+
+/* Validate the table at 'phys' and return it if its signature matches */
+static acpi_sdt_header_t *table_at(uint64_t phys, const char *signature) {
+    if (!acpi_mapped(phys, sizeof(acpi_sdt_header_t))) return 0;
+    acpi_sdt_header_t *table = (acpi_sdt_header_t *)(uintptr_t)phys;
+    if (signature && !bytes_equal(table->signature, signature, 4)) return 0;
+    if (!acpi_mapped(phys, table->length) || !checksum_ok(table, table->length)) return 0;
+    return table;
+}
+
+/* Find a system description table by signature, e.g. "APIC"; 0 if absent */
+acpi_sdt_header_t *acpi_find_table(const char *signature) {
+    if (!rsdp) rsdp = rsdp_find();
+    if (!rsdp) return 0;
+
+    /* Prefer the XSDT (64-bit pointers) when there is one we can reach */
+    acpi_sdt_header_t *root = 0;
+    uint32_t entry_size = 4;
+    if (rsdp->revision >= 2 && rsdp->xsdt_address) {
+        root = table_at(rsdp->xsdt_address, "XSDT");
+        entry_size = 8;
+    }
+    if (!root) {
+        root = table_at(rsdp->rsdt_address, "RSDT");
+        entry_size = 4;
+    }
+    if (!root) return 0;
+
+    uint32_t count = (root->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    uint8_t *entries = (uint8_t *)(root + 1);
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t phys = (entry_size == 8) ? *(uint64_t *)(entries + i * 8)
+                                          : *(uint32_t *)(entries + i * 4);
+        acpi_sdt_header_t *table = table_at(phys, signature);
+        if (table) return table;
+    }
+    return 0;
+}
+
+/*
+ * Collect the local APIC base and the APIC IDs of the processors the
+ * firmware marks usable. Returns -1 if there is no MADT.
+ */
+int acpi_get_cpu_info(acpi_cpu_info_t *info) {
+    acpi_madt_t *madt = (acpi_madt_t *)acpi_find_table("APIC");
+    if (!madt) return -1;
+
+    info->lapic_base = madt->lapic_address;
+    info->cpu_count = 0;
+
+    uint8_t *entry = (uint8_t *)(madt + 1);
+    uint8_t *end = (uint8_t *)madt + madt->header.length;
+    while (entry + sizeof(acpi_madt_entry_t) <= end) {
+        acpi_madt_entry_t *header = (acpi_madt_entry_t *)entry;
+        if (header->length < sizeof(acpi_madt_entry_t) || entry + header->length > end) break;
+
+        if (header->type == ACPI_MADT_LAPIC) {
+            acpi_madt_lapic_t *lapic = (acpi_madt_lapic_t *)entry;
+            if ((lapic->flags & (ACPI_LAPIC_ENABLED | ACPI_LAPIC_ONLINE_CAPABLE)) &&
+                info->cpu_count < SMP_MAX_CPUS) {
+                info->apic_ids[info->cpu_count++] = lapic->apic_id;
+            }
+        } else if (header->type == ACPI_MADT_LAPIC_OVERRIDE) {
+            acpi_madt_lapic_override_t *override = (acpi_madt_lapic_override_t *)entry;
+            if (override->lapic_address < 0x100000000ULL) {
+                info->lapic_base = (uintptr_t)override->lapic_address;
+            }
+        }
+        entry += header->length;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file acpi.h
+ * @brief Minimal ACPI table parsing: RSDP, RSDT/XSDT and the MADT
+ *
+ * Only what SMP bring-up needs: the local APIC address and the APIC IDs
+ * of the usable processors. Tables are read through the direct map, so
+ * they must lie below VMM_DIRECT_MAP_END (firmware puts them at the top
+ * of low RAM).
+ */
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include "smp.h"
+
+/* Root System Description Pointer (ACPI 2.0 layout) */
+typedef struct {
+    char signature[8];        /* "RSD PTR " */
+    uint8_t checksum;         /* Covers the first 20 bytes */
+    char oem_id[6];
+    uint8_t revision;         /* 0: ACPI 1.0, 2: has the XSDT fields */
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+/* Header every system description table starts with */
+typedef struct {
+    char signature[4];
+    uint32_t length;          /* Whole table, header included */
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+/* Multiple APIC Description Table ("APIC") */
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+    /* Variable length entries follow */
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+#define ACPI_MADT_LAPIC           0
+#define ACPI_MADT_LAPIC_OVERRIDE  5
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_lapic_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint16_t reserved;
+    uint64_t lapic_address;
+} __attribute__((packed)) acpi_madt_lapic_override_t;
+
+#define ACPI_LAPIC_ENABLED         0x1
+#define ACPI_LAPIC_ONLINE_CAPABLE  0x2
+
+/* What smp_init() needs from the MADT */
+typedef struct {
+    uintptr_t lapic_base;
+    uint32_t cpu_count;
+    uint8_t apic_ids[SMP_MAX_CPUS];
+} acpi_cpu_info_t;
+
+/* Function prototypes */
+acpi_sdt_header_t *acpi_find_table(const char *signature);
+int acpi_get_cpu_info(acpi_cpu_info_t *info);
+
+#endif
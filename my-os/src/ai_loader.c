@@ -6,6 +6,9 @@
 #include "ai_loader.h"
 #include "kernel.h"
 #include "memory.h"
+#include "slab.h"
+#include "vmm.h"
+#include "mmap.h"
 #include "fat32.h"
 
 /* Forward declarations */
@@ -17,6 +20,9 @@ uint32_t rand(void);
 /* Global AI Model Instance */
 static ai_loaded_model_t *current_loaded_model = 0;
 
+/* Object cache for loaded model descriptors */
+static kmem_cache_t *loaded_model_cache = 0;
+
 /* Initialize AI Loader */
 int ai_loader_init(void) {
     current_loaded_model = 0;
@@ -38,30 +44,17 @@ int ai_loader_load_model(const char *filename, ai_loaded_model_t *model) {
         return -1;
     }
 
-    /* Get file size */
-    uint32_t file_size = ai_file_size(filename);
-    if (file_size == 0) {
-        vga_print("ERROR: Empty AI model file", 0, 47, VGA_COLOR_RED);
-        return -1;
-    }
-
-    /* Allocate buffer for file data */
-    uint8_t *file_data = (uint8_t *)kmalloc(file_size);
+    /*
+     * Map the file instead of reading it: pages come in from disk on first
+     * touch, so only the layers that actually run are ever loaded.
+     */
+    uint32_t file_size = 0;
+    uint8_t *file_data = (uint8_t *)kmmap_file(filename, &file_size);
     if (!file_data) {
-        vga_print("ERROR: Insufficient memory for AI model", 0, 47, VGA_COLOR_RED);
+        vga_print("ERROR: Cannot map AI model file", 0, 47, VGA_COLOR_RED);
         return -1;
     }
 
-    /* Load file from FAT32 TODO: Implement proper file reading */
-    /* For now, we'll create a simple demo model */
-    /*
-    fat32_file_t file;
-    if (fat32_open_file(filename, &file) == 0 &&
-        fat32_read_file(&file, file_data, 0, file_size) == (int)file_size) {
-        fat32_close_file(&file);
-    }
-    */
-
     /* Temporary: Create a demo model */
     int result = ai_create_demo_model_from_file(file_data, file_size, model, filename);
 
@@ -75,7 +68,8 @@ int ai_loader_load_model(const char *filename, ai_loaded_model_t *model) {
         vga_print("AI Model loaded successfully: ", 0, 47, VGA_COLOR_GREEN);
         vga_print(filename, 28, 47, VGA_COLOR_GREEN);
     } else {
-        kfree(file_data);
+        arena_release(&model->arena);
+        kmunmap(file_data);
     }
 
     return result;
@@ -87,16 +81,12 @@ int ai_loader_unload_model(ai_loaded_model_t *model) {
 
     /* Free model data */
     if (model->model_data) {
-        kfree(model->model_data);
+        kmunmap(model->model_data);
         model->model_data = 0;
     }
 
-    /* Free runtime model weights */
-    for (uint32_t i = 0; i < model->runtime_model.num_layers; i++) {
-        nn_layer_t *layer = &model->runtime_model.layers[i];
-        if (layer->weights) ai_free_weights((void*)layer->weights);
-        if (layer->biases) ai_free_weights((void*)layer->biases);
-    }
+    /* Free runtime weights and buffers in one step */
+    arena_release(&model->arena);
 
     /* Clear model */
     memset(model, 0, sizeof(ai_loaded_model_t));
@@ -106,6 +96,27 @@ int ai_loader_unload_model(ai_loaded_model_t *model) {
     return 0;
 }
 
+/* Allocate a loaded model descriptor (cache is created on first use) */
+ai_loaded_model_t *ai_loader_alloc_model(void) {
+    if (!loaded_model_cache) {
+        loaded_model_cache = kmem_cache_create("ai_loaded_model", sizeof(ai_loaded_model_t), 0, 0);
+    }
+    return kmem_cache_alloc(loaded_model_cache);
+}
+
+/* Unload (if needed) and release a loaded model descriptor */
+void ai_loader_free_model(ai_loaded_model_t *model) {
+    if (!model) return;
+
+    ai_loader_unload_model(model);
+    kmem_cache_free(loaded_model_cache, model);
+}
+
+/* Bytes a tensor of 'count' floats takes in the model arena */
+static uint32_t ai_tensor_bytes(uint32_t count) {
+    return (count * sizeof(float) + AI_TENSOR_ALIGN - 1) & ~(uint32_t)(AI_TENSOR_ALIGN - 1);
+}
+
 /* Simplified model creation for demo */
 int ai_create_demo_model_from_file(uint8_t *data, uint32_t size, ai_loaded_model_t *model, const char *filename) {
     /* Detect file format - enhanced detection for enterprise formats */
@@ -163,7 +174,7 @@ int ai_create_demo_model_from_file(uint8_t *data, uint32_t size, ai_loaded_model
     runtime->input_size = 4;  /* Same as our sensor inputs */
     runtime->output_size = 4; /* idle, working, gaming, sleeping */
 
-    /* Allocate layers */
+    /* Configure layers */
     for (uint32_t i = 0; i < runtime->num_layers; i++) {
         nn_layer_t *layer = &runtime->layers[i];
 
@@ -180,10 +191,26 @@ int ai_create_demo_model_from_file(uint8_t *data, uint32_t size, ai_loaded_model
             layer->output_size = 4;
             layer->activation = ACTIVATION_SIGMOID;
         }
+    }
 
-        /* Allocate weights and biases */
-        layer->weights = (float*)ai_allocate_weights(layer->output_size * layer->input_size * sizeof(float));
-        layer->biases = (float*)ai_allocate_weights(layer->output_size * sizeof(float));
+    /* Size the arena for the whole model so it fits in a single chunk */
+    uint32_t arena_size = ai_tensor_bytes(runtime->input_size) + ai_tensor_bytes(runtime->output_size) +
+                          ai_tensor_bytes(MAX_TENSOR_SIZE);
+    for (uint32_t i = 0; i < runtime->num_layers; i++) {
+        nn_layer_t *layer = &runtime->layers[i];
+        arena_size += ai_tensor_bytes(layer->output_size * layer->input_size) + ai_tensor_bytes(layer->output_size);
+    }
+
+    if (arena_init(&model->arena, arena_size) != 0) {
+        return -1;
+    }
+
+    /* Lay the tensors out in the order inference walks them */
+    for (uint32_t i = 0; i < runtime->num_layers; i++) {
+        nn_layer_t *layer = &runtime->layers[i];
+
+        layer->weights = (float*)arena_alloc(&model->arena, layer->output_size * layer->input_size * sizeof(float), AI_TENSOR_ALIGN);
+        layer->biases = (float*)arena_alloc(&model->arena, layer->output_size * sizeof(float), AI_TENSOR_ALIGN);
 
         if (!layer->weights || !layer->biases) {
             return -1;
@@ -191,9 +218,9 @@ int ai_create_demo_model_from_file(uint8_t *data, uint32_t size, ai_loaded_model
     }
 
     /* Allocate runtime buffers */
-    runtime->input_buffer = (float*)kmalloc(runtime->input_size * sizeof(float));
-    runtime->output_buffer = (float*)kmalloc(runtime->output_size * sizeof(float));
-    runtime->temp_buffer = (float*)kmalloc(MAX_TENSOR_SIZE * sizeof(float));
+    runtime->input_buffer = (float*)arena_alloc(&model->arena, runtime->input_size * sizeof(float), AI_TENSOR_ALIGN);
+    runtime->output_buffer = (float*)arena_alloc(&model->arena, runtime->output_size * sizeof(float), AI_TENSOR_ALIGN);
+    runtime->temp_buffer = (float*)arena_alloc(&model->arena, MAX_TENSOR_SIZE * sizeof(float), AI_TENSOR_ALIGN);
 
     if (!runtime->input_buffer || !runtime->output_buffer || !runtime->temp_buffer) {
         return -1;
@@ -252,17 +279,47 @@ int ai_file_exists(const char *filename) {
 }
 
 uint32_t ai_file_size(const char *filename) {
-    /* Get file size - TODO: implement properly */
-    return 1024; /* Temporary fixed size for demo */
+    fat32_file_t file;
+    if (fat32_open_file(filename, &file) != 0) return 0;
+
+    uint32_t size = file.size;
+    fat32_close_file(&file);
+    return size;
 }
 
-/* Memory allocation helpers */
+/*
+ * Memory allocation helpers: tensors start on a cache line, and weights
+ * of a large page or more get their own large-page mapping to spare the TLB.
+ */
 void *ai_allocate_weights(uint32_t size) {
-    return kmalloc(size);
+    void *ptr = 0;
+    if (size >= VMM_LARGE_PAGE_SIZE) {
+        ptr = vmm_alloc_tensor(size);
+    }
+    return ptr ? ptr : kmalloc_aligned(size, AI_TENSOR_ALIGN);
+}
+
+/*
+ * Activation/scratch space sized for the worst case: large
+ * buffers are mapped lazily, so only the pages inference writes get a
+ * frame (see the region's resident count). Free with ai_free_weights().
+ */
+void *ai_allocate_scratch(uint32_t size) {
+    void *ptr = 0;
+    if (size >= VMM_LARGE_PAGE_SIZE) {
+        ptr = vm_alloc_lazy(size);
+    }
+    return ptr ? ptr : ai_allocate_weights(size);
 }
 
 void ai_free_weights(void *ptr) {
-    kfree(ptr);
+    if (vm_is_lazy(ptr)) {
+        vm_free_lazy(ptr);
+    } else if (vmm_in_window(ptr)) {
+        vmm_free_tensor(ptr);
+    } else {
+        kfree_aligned(ptr);
+    }
 }
 
 /* Utility functions */
@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include "ai_runtime.h"
 #include "fat32.h"
+#include "arena.h"
 
 /* AI Model Format Support */
 #define AI_FORMAT_ONNX       1
@@ -42,6 +43,7 @@ typedef struct {
 typedef struct {
     ai_model_info_t info;
     nn_model_t runtime_model;
+    arena_t arena;           /* Holds every tensor and scratch buffer */
     uint8_t *model_data;
     uint32_t data_size;
     uint8_t loaded;
@@ -72,6 +74,8 @@ typedef struct __attribute__((packed)) {
 int ai_loader_init(void);
 int ai_loader_load_model(const char *filename, ai_loaded_model_t *model);
 int ai_loader_unload_model(ai_loaded_model_t *model);
+ai_loaded_model_t *ai_loader_alloc_model(void);
+void ai_loader_free_model(ai_loaded_model_t *model);
 
 /* Parser implementations */
 int ai_parse_onnx(const uint8_t *data, uint32_t size, nn_model_t *model, ai_model_info_t *info);
@@ -87,6 +91,7 @@ uint32_t ai_file_size(const char *filename);
 
 /* Memory allocation helpers */
 void *ai_allocate_weights(uint32_t size);
+void *ai_allocate_scratch(uint32_t size);
 void ai_free_weights(void *ptr);
 
 /* Utility functions */
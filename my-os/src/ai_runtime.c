@@ -6,8 +6,10 @@
 #include "ai_runtime.h"
 #include "kernel.h"
 #include "memory.h"
+#include "slab.h"
+#include "threadpool.h"
+#include "clock.h"
 
-uint32_t get_tick_count();
 static float exp(float x);
 static float sqrt(float x);
 static void memcpy(void *dest, const void *src, uint32_t n);
@@ -15,6 +17,9 @@ static void memcpy(void *dest, const void *src, uint32_t n);
 /* Global AI model (demo version) */
 static nn_model_t *active_model = 0;
 
+/* Object cache for model descriptors */
+static kmem_cache_t *model_cache = 0;
+
 /* Sample weights for demo "context awareness" model */
 /* This is a very simple 3-layer neural network trained to recognize user context */
 /* Input: [accelerometer_magnitude, time_of_day_hour, cpu_usage, touch_pressure] */
@@ -55,7 +60,8 @@ static float layer3_biases[] = {0.1, 0.3, 0.2, 0.4};
 
 /* Initialize AI runtime */
 void init_ai_runtime() {
-    active_model = kmalloc(sizeof(nn_model_t));
+    model_cache = kmem_cache_create("nn_model", sizeof(nn_model_t), 0, 0);
+    active_model = kmem_cache_alloc(model_cache);
     if (!active_model) {
         vga_print("ERRORE: Allocazione AI model fallita!", 0, 34, VGA_COLOR_RED);
         return;
@@ -75,9 +81,9 @@ int load_context_awareness_model(nn_model_t *model) {
     model->output_size = 4; /* idle, working, gaming, sleeping */
 
     /* Allocate buffers */
-    model->input_buffer = kmalloc(model->input_size * sizeof(float));
-    model->output_buffer = kmalloc(model->output_size * sizeof(float));
-    model->temp_buffer = kmalloc(MAX_TENSOR_SIZE * sizeof(float));
+    model->input_buffer = kmalloc_aligned(model->input_size * sizeof(float), AI_TENSOR_ALIGN);
+    model->output_buffer = kmalloc_aligned(model->output_size * sizeof(float), AI_TENSOR_ALIGN);
+    model->temp_buffer = kmalloc_aligned(MAX_TENSOR_SIZE * sizeof(float), AI_TENSOR_ALIGN);
 
     if (!model->input_buffer || !model->output_buffer || !model->temp_buffer) {
         vga_print("ERRORE: Allocazione buffer AI fallita!", 0, 35, VGA_COLOR_RED);
@@ -109,7 +115,8 @@ int load_context_awareness_model(nn_model_t *model) {
     model->layers[2].biases = layer3_biases;
 
     model->loaded = 1;
-    model->last_inference_time = get_tick_count();
+    model->last_inference_ns = clock_ns();
+    model->inference_ns = 0;
 
     return 0;
 }
@@ -125,20 +132,68 @@ float relu(float x) {
     return x > 0 ? x : 0;
 }
 
-/* Simple matrix multiplication (for fixed point arithmetic) */
-int matrix_multiply(const float *a, const float *b, float *c,
-                   uint32_t rows_a, uint32_t cols_a, uint32_t cols_b) {
-    for (uint32_t i = 0; i < rows_a; i++) {
-        for (uint32_t j = 0; j < cols_b; j++) {
-            c[i * cols_b + j] = 0;
-            for (uint32_t k = 0; k < cols_a; k++) {
-                c[i * cols_b + j] += a[i * cols_a + k] * b[k * cols_b + j];
+/* Rows per parallel_for piece so that each one is worth handing out */
+static uint32_t parallel_grain(uint32_t ops_per_row) {
+    if (ops_per_row == 0 || ops_per_row >= AI_PARALLEL_GRAIN_OPS) return 1;
+    return AI_PARALLEL_GRAIN_OPS / ops_per_row;
+}
+
+typedef struct {
+    const float *a;
+    const float *b;
+    float *c;
+    uint32_t cols_a;
+    uint32_t cols_b;
+} matmul_job_t;
+
+static void matmul_rows(uint32_t begin, uint32_t end, void *arg) {
+    matmul_job_t *job = arg;
+    for (uint32_t i = begin; i < end; i++) {
+        for (uint32_t j = 0; j < job->cols_b; j++) {
+            float sum = 0;
+            for (uint32_t k = 0; k < job->cols_a; k++) {
+                sum += job->a[i * job->cols_a + k] * job->b[k * job->cols_b + j];
             }
+            job->c[i * job->cols_b + j] = sum;
         }
     }
+}
+
+/* Simple matrix multiplication; rows of the result are split over the thread pool */
+int matrix_multiply(const float *a, const float *b, float *c,
+                   uint32_t rows_a, uint32_t cols_a, uint32_t cols_b) {
+    matmul_job_t job = { a, b, c, cols_a, cols_b };
+    parallel_for(0, rows_a, parallel_grain(cols_a * cols_b), matmul_rows, &job);
     return 0;
 }
 
+typedef struct {
+    const nn_layer_t *layer;
+    const float *input;
+    float *output;
+} dense_job_t;
+
+/* Neurons [begin, end) of a dense layer: dot product, bias, activation */
+static void dense_rows(uint32_t begin, uint32_t end, void *arg) {
+    dense_job_t *job = arg;
+    const nn_layer_t *layer = job->layer;
+    for (uint32_t i = begin; i < end; i++) {
+        const float *w = layer->weights + i * layer->input_size;
+        float sum = 0;
+        for (uint32_t k = 0; k < layer->input_size; k++) {
+            sum += w[k] * job->input[k];
+        }
+        job->output[i] = sum + layer->biases[i];
+    }
+    apply_activation(job->output + begin, end - begin, layer->activation);
+}
+
+/* Forward pass of one dense layer, neurons split over the thread pool */
+static void dense_forward(const nn_layer_t *layer, const float *input, float *output) {
+    dense_job_t job = { layer, input, output };
+    parallel_for(0, layer->output_size, parallel_grain(layer->input_size), dense_rows, &job);
+}
+
 /* Apply activation to tensor */
 void apply_activation(float *tensor, uint32_t size, activation_func_t activation) {
     for (uint32_t i = 0; i < size; i++) {
@@ -194,6 +249,7 @@ ai_decision_t run_ai_inference(nn_model_t *model, ai_context_t *context) {
     if (!model || !model->loaded) {
         return AI_DECISION_NONE;
     }
+    uint64_t start = clock_ns();
 
     /* Preprocess sensor data */
     uint32_t input_size;
@@ -206,19 +262,8 @@ ai_decision_t run_ai_inference(nn_model_t *model, ai_context_t *context) {
         const nn_layer_t *layer = &model->layers[layer_idx];
 
         if (layer->type == LAYER_TYPE_DENSE) {
-            /* Dense layer: matrix multiplication + bias + activation */
-
-            /* Matrix multiply: weights(current_input) + bias -> temp_buffer */
-            matrix_multiply(layer->weights, current_input, model->temp_buffer,
-                          layer->output_size, layer->input_size, 1);
-
-            /* Add bias */
-            for (uint32_t i = 0; i < layer->output_size; i++) {
-                model->temp_buffer[i] += layer->biases[i];
-            }
-
-            /* Apply activation */
-            apply_activation(model->temp_buffer, layer->output_size, layer->activation);
+            /* Dense layer: weights(current_input) + bias, activated -> temp_buffer */
+            dense_forward(layer, current_input, model->temp_buffer);
 
             /* Swap buffers */
             current_input = model->temp_buffer;
@@ -249,7 +294,8 @@ ai_decision_t run_ai_inference(nn_model_t *model, ai_context_t *context) {
         case 3: decision = AI_DECISION_SLEEPING; break;
     }
 
-    model->last_inference_time = get_tick_count();
+    model->last_inference_ns = clock_ns();
+    model->inference_ns = model->last_inference_ns - start;
     return decision;
 }
 
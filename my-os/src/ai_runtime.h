@@ -14,6 +14,12 @@
 #define MAX_LAYERS 16
 #define MAX_WEIGHTS 4096
 
+/* Tensor alignment: one cache line, enough for SSE/AVX aligned loads */
+#define AI_TENSOR_ALIGN 64
+
+/* Multiply-adds per parallel_for piece below which splitting costs more than it saves */
+#define AI_PARALLEL_GRAIN_OPS 4096
+
 /* Types of neural network layers */
 typedef enum {
     LAYER_TYPE_NONE = 0,
@@ -64,7 +70,8 @@ typedef struct {
     float *output_buffer;
     float *temp_buffer;
     uint8_t loaded;      /* Whether model is loaded */
-    uint32_t last_inference_time;
+    uint64_t last_inference_ns;  /* clock_ns() when the last inference ended */
+    uint64_t inference_ns;       /* How long it took */
 } nn_model_t;
 
 /* Ai context structure containing sensor state */
@@ -0,0 +1,272 @@
+/**
+ * @file apic.c
+ * @brief Local APIC driver
+ */
+
+#include "apic.h"
+#include "acpi.h"
+#include "clock.h"
+#include "idt.h"
+#include "smp.h"
+#include "timer.h"
+#include "vmm.h"
+
+#define LAPIC_TIMER_PERIODIC_STATE  0
+#define LAPIC_TIMER_ONESHOT_STATE   1
+#define LAPIC_TIMER_STOPPED_STATE   2
+
+/* Register window; the same address on every CPU */
+static volatile uint32_t *lapic = 0;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+/* Timer: how each CPU's is programmed, and one tick in TSC cycles / bus counts */
+static uint8_t timer_state[SMP_MAX_CPUS];
+static uint64_t timer_deadline[SMP_MAX_CPUS];   /* TSC the armed deadline fires at */
+static int timer_tsc_deadline = 0;
+static uint32_t timer_cycles = 0;
+static uint32_t timer_count = 0;
+static uint32_t timer_max = 0;
+static uint64_t timer_tick_tsc = 0;             /* TSC of the last tick counted */
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ __volatile__("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+/* a / b, saturated at 0xFFFFFFFF; one divl, no __udivdi3 */
+static inline uint32_t div_u64_u32(uint64_t a, uint32_t b) {
+    if ((uint32_t)(a >> 32) >= b) return 0xFFFFFFFF;
+#ifdef __x86_64__
+    return (uint32_t)(a / b);
+#else
+    uint32_t quotient, rest;
+    __asm__("divl %4" : "=a"(quotient), "=d"(rest)
+            : "a"((uint32_t)a), "d"((uint32_t)(a >> 32)), "rm"(b));
+    return quotient;
+#endif
+}
+
+/*
+ * Map the local APIC registers at 'base' (uncached) and enable the
+ * bootstrap processor's APIC. Returns -1 if the CPU has none.
+ */
+int lapic_init(uintptr_t base) {
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (!(edx & CPUID_EDX_APIC)) return -1;
+
+    if (!base) base = LAPIC_DEFAULT_BASE;
+    if (vmm_enabled() &&
+        vmm_map_page(base, base, PTE_WRITABLE | PTE_PCD | PTE_PWT | vmm_nx_flag()) != 0) {
+        return -1;
+    }
+    lapic = (volatile uint32_t *)base;
+
+    lapic_enable();
+    return 0;
+}
+
+int lapic_present() {
+    return lapic != 0;
+}
+
+/* Software-enable the calling CPU's local APIC and accept all priorities */
+void lapic_enable() {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdmsr" : "=a"(lo), "=d"(hi) : "c"(MSR_APIC_BASE));
+    if (!(lo & APIC_BASE_ENABLE)) {
+        __asm__ __volatile__("wrmsr" : : "a"(lo | APIC_BASE_ENABLE), "d"(hi), "c"(MSR_APIC_BASE));
+    }
+
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+uint32_t lapic_id() {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+/* Acknowledge an interrupt delivered by the local APIC */
+void lapic_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_wait_idle() {
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+/* Send an IPI ('command': delivery mode | vector) to one CPU */
+void lapic_send_ipi(uint32_t apic_id, uint32_t command) {
+    lapic_wait_idle();
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+}
+
+/* Send an IPI to every CPU but the caller */
+void lapic_broadcast_ipi(uint32_t command) {
+    lapic_wait_idle();
+    lapic_write(LAPIC_ICR_LOW, command | LAPIC_ICR_ALL_BUT_SELF);
+}
+
+static void deadline_arm(uint32_t self, uint64_t deadline) {
+    timer_deadline[self] = deadline;
+    wrmsr(MSR_TSC_DEADLINE, deadline);
+}
+
+/*
+ * Prepare the local APIC timers for 'frequency' ticks a second, mapping
+ * the local APIC if needed. Uses TSC-deadline mode where the CPU has it,
+ * otherwise measures the bus clock against the TSC. Needs clock_init();
+ * returns -1 without a calibrated TSC or a local APIC.
+ */
+int lapic_timer_init(uint32_t frequency) {
+    uint32_t khz = clock_tsc_khz();
+    if (!khz || !frequency) return -1;
+
+    if (!lapic_present()) {
+        acpi_cpu_info_t info;
+        uintptr_t base = (acpi_get_cpu_info(&info) == 0) ? info.lapic_base : 0;
+        if (lapic_init(base) != 0) return -1;
+    }
+
+    timer_cycles = div_u64_u32((uint64_t)khz * 1000, frequency);
+    if (!timer_cycles) return -1;
+
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    timer_tsc_deadline = (ecx & CPUID_ECX_TSC_DEADLINE) != 0;
+    timer_max = LAPIC_TIMER_MAX_SLEEP;
+    if (timer_tsc_deadline) return 0;
+
+    /* Bus clocks per tick: let the masked timer count down for one tick of TSC */
+    uintptr_t flags = irq_save();
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < timer_cycles) {
+        __asm__ __volatile__("pause");
+    }
+    timer_count = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    irq_restore(flags);
+
+    if (!timer_count) return -1;
+    if (timer_max > 0xFFFFFFFF / timer_count) timer_max = 0xFFFFFFFF / timer_count;
+    return 0;
+}
+
+/* Start the calling CPU's periodic tick. Interrupts must be disabled */
+void lapic_timer_start() {
+    uint32_t self = smp_cpu_id();
+    timer_state[self] = LAPIC_TIMER_PERIODIC_STATE;
+
+    if (timer_tsc_deadline) {
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_DEADLINE | LAPIC_TIMER_VECTOR);
+        /* The LVT write must land before the MSR write arms the timer */
+        __asm__ __volatile__("mfence" : : : "memory");
+        uint64_t now = rdtsc();
+        if (self == 0) timer_tick_tsc = now;
+        deadline_arm(self, now + timer_cycles);
+    } else {
+        if (self == 0) timer_tick_tsc = rdtsc();
+        lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_TIMER_INITIAL, timer_count);
+    }
+}
+
+/* Longest one-shot, in ticks */
+uint32_t lapic_timer_max_ticks() {
+    return timer_max;
+}
+
+/*
+ * Replace the calling CPU's periodic tick with one interrupt 'ticks'
+ * ticks away, clamped to lapic_timer_max_ticks(). Interrupts must be
+ * disabled; lapic_timer_resume() or the interrupt restore the tick.
+ */
+void lapic_timer_oneshot(uint32_t ticks) {
+    uint32_t self = smp_cpu_id();
+    if (ticks > timer_max) ticks = timer_max;
+    if (!ticks) ticks = 1;
+    timer_state[self] = LAPIC_TIMER_ONESHOT_STATE;
+
+    if (timer_tsc_deadline) {
+        /* In step with the periodic deadline it replaces */
+        deadline_arm(self, timer_deadline[self] + (uint64_t)(ticks - 1) * timer_cycles);
+    } else {
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_TIMER_INITIAL, ticks * timer_count);
+    }
+}
+
+/* No interrupts at all from the calling CPU's timer until lapic_timer_resume() */
+void lapic_timer_stop() {
+    timer_state[smp_cpu_id()] = LAPIC_TIMER_STOPPED_STATE;
+    if (timer_tsc_deadline) {
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    } else {
+        lapic_write(LAPIC_TIMER_INITIAL, 0);
+    }
+}
+
+/* Back to the periodic tick after a one-shot or a stop. Interrupts disabled */
+void lapic_timer_resume() {
+    uint32_t self = smp_cpu_id();
+    if (timer_state[self] == LAPIC_TIMER_PERIODIC_STATE) return;
+    timer_state[self] = LAPIC_TIMER_PERIODIC_STATE;
+
+    if (timer_tsc_deadline) {
+        deadline_arm(self, rdtsc() + timer_cycles);
+    } else {
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_TIMER_INITIAL, timer_count);
+    }
+}
+
+/*
+ * Acknowledge a timer interrupt and arm the next tick: a deadline mode
+ * timer fires once per MSR write, and a one-shot goes back to periodic.
+ */
+void lapic_timer_interrupt() {
+    uint32_t self = smp_cpu_id();
+    lapic_eoi();
+
+    /* Raised just before lapic_timer_stop() */
+    if (timer_state[self] == LAPIC_TIMER_STOPPED_STATE) return;
+
+    if (timer_tsc_deadline) {
+        timer_state[self] = LAPIC_TIMER_PERIODIC_STATE;
+        uint64_t now = rdtsc();
+        uint64_t next = timer_deadline[self] + timer_cycles;
+        /* Fell behind (ticks are counted on the TSC), or a tick from before a one-shot */
+        if (next <= now || timer_deadline[self] > now) next = now + timer_cycles;
+        deadline_arm(self, next);
+    } else if (timer_state[self] == LAPIC_TIMER_ONESHOT_STATE) {
+        lapic_timer_resume();
+    }
+}
+
+/*
+ * Whole ticks since the previous call, measured on the TSC so that
+ * one-shots, early wakeups and late interrupts all count right. An
+ * interrupt a little early by the bus clock still counts its tick.
+ * BSP only, with interrupts disabled.
+ */
+uint32_t lapic_timer_ticks() {
+    uint64_t elapsed = rdtsc() - timer_tick_tsc + timer_cycles / 4;
+    if ((int64_t)elapsed < 0) return 0;
+
+    uint32_t ticks = div_u64_u32(elapsed, timer_cycles);
+    timer_tick_tsc += (uint64_t)ticks * timer_cycles;
+    return ticks;
+}
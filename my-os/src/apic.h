@@ -0,0 +1,84 @@
+/**
+ * @file apic.h
+ * @brief Local APIC: per-CPU interrupt controller and inter-processor interrupts
+ *
+ * The registers are memory mapped at the base the MADT reports
+ * (normally 0xFEE00000); every CPU sees its own local APIC there.
+ * The legacy PIC keeps delivering device IRQs to the bootstrap
+ * processor; the local APIC is used for IPIs and for the tick.
+ *
+ * Each CPU's local APIC timer interrupts it at LAPIC_TIMER_VECTOR.
+ * Where CPUID reports TSC-deadline mode the timer fires when the TSC
+ * reaches a value written to an MSR, so a period or a one-shot is
+ * simply a TSC value and needs no calibration of its own. Otherwise
+ * the timer counts down at the bus clock divided by 16, which is
+ * measured once against the (PIT-calibrated) TSC and then used in
+ * periodic or one-shot mode. The EOI is a single register write.
+ */
+
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+
+#define LAPIC_DEFAULT_BASE     0xFEE00000
+
+/* Register offsets */
+#define LAPIC_ID               0x020
+#define LAPIC_VERSION          0x030
+#define LAPIC_TPR              0x080   /* Task priority */
+#define LAPIC_EOI              0x0B0
+#define LAPIC_SVR              0x0F0   /* Spurious interrupt vector */
+#define LAPIC_ICR_LOW          0x300   /* Interrupt command, writing it sends */
+#define LAPIC_ICR_HIGH         0x310   /* Destination APIC ID in bits 24-31 */
+#define LAPIC_LVT_TIMER        0x320
+#define LAPIC_TIMER_INITIAL    0x380   /* Initial count, writing it starts the count down */
+#define LAPIC_TIMER_CURRENT    0x390
+#define LAPIC_TIMER_DIVIDE     0x3E0
+
+#define LAPIC_SVR_ENABLE       0x100
+#define LAPIC_SPURIOUS_VECTOR  0xFF
+
+/* Interrupt command register bits */
+#define LAPIC_ICR_FIXED        0x00000
+#define LAPIC_ICR_INIT         0x00500
+#define LAPIC_ICR_STARTUP      0x00600
+#define LAPIC_ICR_PENDING      0x01000   /* Delivery status */
+#define LAPIC_ICR_ASSERT       0x04000
+#define LAPIC_ICR_LEVEL        0x08000
+#define LAPIC_ICR_ALL_BUT_SELF 0xC0000
+
+/* Timer LVT entry and divide configuration */
+#define LAPIC_LVT_MASKED       0x10000
+#define LAPIC_TIMER_ONESHOT    0x00000
+#define LAPIC_TIMER_PERIODIC   0x20000
+#define LAPIC_TIMER_DEADLINE   0x40000   /* TSC-deadline mode */
+#define LAPIC_TIMER_DIV16      0x3
+#define LAPIC_TIMER_VECTOR     50
+#define LAPIC_TIMER_MAX_SLEEP  0x10000   /* Longest one-shot, in ticks */
+
+/* IA32_APIC_BASE MSR */
+#define MSR_APIC_BASE          0x1B
+#define APIC_BASE_ENABLE       0x800
+#define CPUID_EDX_APIC         (1 << 9)
+#define MSR_TSC_DEADLINE       0x6E0
+#define CPUID_ECX_TSC_DEADLINE (1 << 24)
+
+/* Function prototypes */
+int lapic_init(uintptr_t base);
+int lapic_present();
+void lapic_enable();
+uint32_t lapic_id();
+void lapic_eoi();
+void lapic_send_ipi(uint32_t apic_id, uint32_t command);
+void lapic_broadcast_ipi(uint32_t command);
+int lapic_timer_init(uint32_t frequency);
+void lapic_timer_start();
+void lapic_timer_oneshot(uint32_t ticks);
+void lapic_timer_stop();
+void lapic_timer_resume();
+void lapic_timer_interrupt();
+uint32_t lapic_timer_max_ticks();
+uint32_t lapic_timer_ticks();
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * @file arena.c
+ * @brief Implementation of bump-pointer arenas
+ *
+ * Allocations are carved sequentially out of large chunks and are never
+ * freed one by one: arena_release() drops every chunk at once. Sizing the
+ * first chunk for the whole working set keeps it to a single chunk, so
+ * teardown is one kfree and the objects sit next to each other. Chunks of
+ * a large page or more are mapped through vmm_alloc_tensor().
+ */
+
+#include "arena.h"
+#include "memory.h"
+#include "vmm.h"
+
+/* Add a chunk able to hold at least 'size' bytes in front of the list */
+static arena_chunk_t *arena_add_chunk(arena_t *arena, uint32_t size) {
+    if (size < arena->chunk_size) {
+        size = arena->chunk_size;
+    }
+
+    arena_chunk_t *chunk = 0;
+    if (ARENA_CHUNK_HEADER_SIZE + size >= VMM_LARGE_PAGE_SIZE) {
+        chunk = vmm_alloc_tensor(ARENA_CHUNK_HEADER_SIZE + size);
+    }
+    if (!chunk) {
+        chunk = kmalloc_aligned(ARENA_CHUNK_HEADER_SIZE + size, ARENA_CHUNK_ALIGN);
+    }
+    if (!chunk) return 0;
+
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    return chunk;
+}
+
+/* Initialize an arena and reserve its first chunk */
+int arena_init(arena_t *arena, uint32_t initial_size) {
+    arena->chunks = 0;
+    arena->allocated = 0;
+    arena->chunk_size = ARENA_CHUNK_SIZE;
+
+    if (initial_size == 0) return 0;
+    return arena_add_chunk(arena, initial_size) ? 0 : -1;
+}
+
+/* Carve an aligned allocation out of a chunk; 0 if it does not fit */
+static void *chunk_bump(arena_chunk_t *chunk, uint32_t size, uint32_t align) {
+    uintptr_t base = (uintptr_t)chunk + ARENA_CHUNK_HEADER_SIZE;
+    uintptr_t addr = (base + chunk->used + align - 1) & ~(uintptr_t)(align - 1);
+
+    if (addr + size < addr || addr + size > base + chunk->size) {
+        return 0;
+    }
+
+    chunk->used = (uint32_t)(addr + size - base);
+    return (void *)addr;
+}
+
+/* Bump-allocate 'size' bytes aligned to 'align' (a power of two) */
+void *arena_alloc(arena_t *arena, uint32_t size, uint32_t align) {
+    if (!arena || size == 0) return 0;
+    if (align == 0) align = sizeof(void *);
+    if (align & (align - 1)) return 0;
+
+    void *ptr = arena->chunks ? chunk_bump(arena->chunks, size, align) : 0;
+    if (!ptr) {
+        /* Start a new chunk, padded in case align exceeds the chunk alignment */
+        arena_chunk_t *chunk = arena_add_chunk(arena, size + align);
+        if (!chunk) return 0;
+        ptr = chunk_bump(chunk, size, align);
+    }
+
+    arena->allocated += size;
+    return ptr;
+}
+
+/* Release every allocation of the arena at once */
+void arena_release(arena_t *arena) {
+    if (!arena) return;
+
+    arena_chunk_t *chunk = arena->chunks;
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        if (vmm_in_window(chunk)) {
+            vmm_free_tensor(chunk);
+        } else {
+            kfree_aligned(chunk);
+        }
+        chunk = next;
+    }
+
+    arena->chunks = 0;
+    arena->allocated = 0;
+}
@@ -0,0 +1,36 @@
+/**
+ * @file arena.h
+ * @brief Bump-pointer arenas for objects that share one lifetime
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+
+#define ARENA_CHUNK_SIZE   0x4000  /* Default chunk: 16KB */
+#define ARENA_CHUNK_ALIGN  64      /* Chunks start on a cache line */
+
+/* Chunk header; the bump area follows it */
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    uint32_t size;    /* Usable bytes after the header */
+    uint32_t used;    /* Bytes handed out so far */
+} arena_chunk_t;
+
+#define ARENA_CHUNK_HEADER_SIZE \
+    ((sizeof(arena_chunk_t) + ARENA_CHUNK_ALIGN - 1) & ~(ARENA_CHUNK_ALIGN - 1))
+
+/* Arena: the head chunk is the one being bumped */
+typedef struct {
+    arena_chunk_t *chunks;
+    uint32_t chunk_size;    /* Minimum size of a new chunk */
+    uint32_t allocated;     /* Bytes handed out over all chunks */
+} arena_t;
+
+/* Function prototypes */
+int arena_init(arena_t *arena, uint32_t initial_size);
+void *arena_alloc(arena_t *arena, uint32_t size, uint32_t align);
+void arena_release(arena_t *arena);
+
+#endif
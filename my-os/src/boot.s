@@ -20,6 +20,11 @@ start:
     # I'm setting up the stack pointer to point to the top of my stack.
     movl $stack_top, %esp
     
+    # GRUB leaves the Multiboot magic in EAX and the info pointer in EBX.
+    # I'm passing both to kernel_main(magic, mbi).
+    pushl %ebx
+    pushl %eax
+
     # Now I'll call my C kernel's main function.
     call kernel_main
     
@@ -28,12 +33,16 @@ start:
     hlt
 .size start, . - start
 
-# Interrupt Service Routines (ISRs)
+# The stubs bump this CPU's irq_nesting (%gs:8, see cpu_t in smp.h)
+# around their handler so C code can tell it is running in interrupt
+# context (see in_interrupt()).
 .global isr0
 .type isr0, @function
 isr0:
     pushal
+    incl %gs:8
     call isr0_handler
+    decl %gs:8
     popal
     iret
 .size isr0, . - isr0
@@ -42,20 +51,206 @@ isr0:
 .type isr1, @function
 isr1:
     pushal
+    incl %gs:8
     call isr1_handler
+    decl %gs:8
     popal
     iret
 .size isr1, . - isr1
 
-# Timer interrupt (IRQ 0 -> interrupt 32)
-.global isr32
-.type isr32, @function
-isr32:
+# IRQ 14 (interrupt 46): primary ATA channel, see coroutine.c
+.global isr46
+.type isr46, @function
+isr46:
+    pushal
+    incl %gs:8
+    call irq14_handler
+    decl %gs:8
+    popal
+    iret
+.size isr46, . - isr46
+
+# TLB shootdown IPI (interrupt 51), see smp_tlb_shootdown(). Never
+# switches tasks, so it needs no FPU state.
+.global isr_tlb_shootdown
+.type isr_tlb_shootdown, @function
+isr_tlb_shootdown:
+    pushal
+    incl %gs:8
+    call smp_tlb_handler
+    decl %gs:8
+    popal
+    iret
+.size isr_tlb_shootdown, . - isr_tlb_shootdown
+
+# Page fault (exception 14). The CPU pushes an error code, which I hand
+# to the C handler and drop before returning. Faults are synchronous, so
+# irq_nesting is left alone: the handler runs on behalf of the faulting code.
+.global isr14
+.type isr14, @function
+isr14:
     pushal
-    call timer_handler
+    pushl 32(%esp)
+    call page_fault_handler
+    addl $4, %esp
     popal
+    addl $4, %esp
     iret
-.size isr32, . - isr32
+.size isr14, . - isr14
+
+# Task switch stubs. Below the registers I save the FPU/SSE state in a
+# 16-byte aligned area followed by a pointer back to the registers, and
+# pass the area (the task's frame) to the handler. It returns the frame
+# to resume, which may belong to another task and live on another stack;
+# once on it, sched_finish_switch() lets other CPUs pick up the old task.
+.macro SWITCH_STUB name, handler
+.global \name
+.type \name, @function
+\name:
+    pushal
+    incl %gs:8
+    movl %esp, %ebx
+    subl $528, %esp
+    andl $~15, %esp
+    movl %ebx, 512(%esp)
+    cmpl $0, fpu_fxsr_enabled
+    je 1f
+    fxsave (%esp)
+1:
+    pushl %esp
+    call \handler
+    movl %eax, %esp
+    call sched_finish_switch
+    cmpl $0, fpu_fxsr_enabled
+    je 2f
+    fxrstor (%esp)
+2:
+    movl 512(%esp), %esp
+    decl %gs:8
+    popal
+    iret
+.size \name, . - \name
+.endm
+
+# Timer interrupt (IRQ 0 -> interrupt 32): preemption
+SWITCH_STUB isr32, timer_handler
+
+# Yield (int $48): a task giving up the CPU
+SWITCH_STUB isr_yield, sched_yield_handler
+
+# Timer tick the BSP forwards to the other CPUs (int $49)
+SWITCH_STUB isr_smp_tick, smp_tick_handler
+
+# Reschedule request from smp_kick() (int $52)
+SWITCH_STUB isr_smp_kick, smp_kick_handler
+
+# Local APIC timer (int $50): every CPU's own tick
+SWITCH_STUB isr_lapic_timer, lapic_timer_handler
+
+# co_switch(save_sp, new_sp): coroutine switch. Only the callee-saved
+# registers need saving at a call; the stack pointer goes to *save_sp
+# and the 'ret' resumes whatever new_sp saved (see co_create()).
+.global co_switch
+.type co_switch, @function
+co_switch:
+    movl 4(%esp), %eax
+    movl 8(%esp), %edx
+    pushl %ebp
+    pushl %edi
+    pushl %esi
+    pushl %ebx
+    movl %esp, (%eax)
+    movl %edx, %esp
+    popl %ebx
+    popl %esi
+    popl %edi
+    popl %ebp
+    ret
+.size co_switch, . - co_switch
+
+# Spurious local APIC interrupt: no EOI
+.global isr_spurious
+.type isr_spurious, @function
+isr_spurious:
+    iret
+.size isr_spurious, . - isr_spurious
+
+# Application processor trampoline. smp_init() copies it to
+# TRAMPOLINE_BASE and fills in the parameters at its end; a SIPI starts
+# the AP here in real mode. It switches to protected mode with a
+# temporary flat GDT, turns on paging with the kernel tables and calls
+# ap_main(cpu) on the stack it was given. Addresses are computed for the
+# copy, not for this location.
+.set TRAMPOLINE_BASE, 0x8000
+.set CR0_AP, 0x80010033         # PG | WP | NE | ET | MP | PE, caches on
+
+.align 16
+.global ap_trampoline_start
+ap_trampoline_start:
+.code16
+    cli
+    cld
+    xorw %ax, %ax
+    movw %ax, %ds
+    lgdtl ap_gdt_ptr - ap_trampoline_start + TRAMPOLINE_BASE
+    movl %cr0, %eax
+    orl $1, %eax
+    movl %eax, %cr0
+    ljmpl $0x08, $(ap_protected - ap_trampoline_start + TRAMPOLINE_BASE)
+
+.code32
+ap_protected:
+    movw $0x10, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %fs
+    movw %ax, %gs
+    movw %ax, %ss
+
+    # Same paging mode as the BSP: CR4 (PSE/PAE/PGE/OSFXSR), then NX
+    movl ap_param_cr4 - ap_trampoline_start + TRAMPOLINE_BASE, %eax
+    movl %eax, %cr4
+    cmpl $0, ap_param_efer_nxe - ap_trampoline_start + TRAMPOLINE_BASE
+    je 1f
+    movl $0xC0000080, %ecx
+    rdmsr
+    orl $0x800, %eax
+    wrmsr
+1:
+    movl ap_param_cr3 - ap_trampoline_start + TRAMPOLINE_BASE, %eax
+    movl %eax, %cr3
+    movl $CR0_AP, %eax
+    movl %eax, %cr0
+
+    movl ap_param_stack - ap_trampoline_start + TRAMPOLINE_BASE, %esp
+    pushl ap_param_cpu - ap_trampoline_start + TRAMPOLINE_BASE
+    call *(ap_param_entry - ap_trampoline_start + TRAMPOLINE_BASE)
+2:
+    cli
+    hlt
+    jmp 2b
+
+.align 8
+ap_gdt:
+    .quad 0
+    .quad 0x00CF9A000000FFFF    # Flat code, 0x08
+    .quad 0x00CF92000000FFFF    # Flat data, 0x10
+ap_gdt_ptr:
+    .word 23
+    .long ap_gdt - ap_trampoline_start + TRAMPOLINE_BASE
+
+# smp_trampoline_params_t
+.align 4
+.global ap_trampoline_params
+ap_trampoline_params:
+ap_param_cr3:      .long 0
+ap_param_cr4:      .long 0
+ap_param_efer_nxe: .long 0
+ap_param_stack:    .long 0
+ap_param_entry:    .long 0
+ap_param_cpu:      .long 0
+.global ap_trampoline_end
+ap_trampoline_end:
 
 # I'm defining the BSS section for my stack.
 .section .bss
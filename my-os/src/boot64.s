@@ -0,0 +1,307 @@
+# Boot code for the x86_64 kernel. GRUB enters 'start' in 32-bit protected
+# mode; I build temporary page tables, switch to long mode and jump to
+# kernel_main in the higher half. vmm_init() replaces these tables later.
+
+# I'm defining the Multiboot header constants here.
+.set ALIGN,    1<<0             # I need to align modules on page boundaries.
+.set MEMINFO,  1<<1             # I need to pass memory map to the kernel.
+.set FLAGS,    ALIGN | MEMINFO  # This is the combination of my flags.
+.set MAGIC,    0x1BADB002       # This is the magic number for Multiboot.
+.set CHECKSUM, -(MAGIC + FLAGS) # This is the checksum to validate the header.
+
+.set KERNEL_VMA, 0xFFFFFFFF80000000   # Must match linker64.ld and vmm.h
+.set CR0_MP,     1<<1
+.set CR0_EM,     1<<2
+.set CR0_PG,     1<<31
+.set CR4_PAE,    1<<5
+.set CR4_OSFXSR, 1<<9           # SSE enabled, fxsave/fxrstor allowed
+.set CR4_OSXMMEXCPT, 1<<10
+.set MSR_EFER,   0xC0000080
+.set EFER_LME,   1<<8
+.set PAGE_LARGE, 0x83           # Present | writable | 2MB page
+
+# I'm creating the Multiboot header section.
+.section .multiboot, "a"
+.align 4
+.long MAGIC
+.long FLAGS
+.long CHECKSUM
+
+# Low, identity mapped code: runs before paging is on.
+.section .boot, "ax"
+.code32
+.global start
+.type start, @function
+start:
+    cli
+
+    # I keep the Multiboot magic and info pointer in the registers that
+    # carry the first two arguments of kernel_main(magic, mbi).
+    movl %eax, %edi
+    movl %ebx, %esi
+
+    # Long mode is CPUID 0x80000001 EDX bit 29.
+    movl $0x80000000, %eax
+    cpuid
+    cmpl $0x80000001, %eax
+    jb no_long_mode
+    movl $0x80000001, %eax
+    cpuid
+    testl $(1 << 29), %edx
+    jz no_long_mode
+
+    # PML4[0] maps the low 4GB, PML4[511] the kernel image at -2GB.
+    movl $(boot_pdpt_low + 3), boot_pml4
+    movl $(boot_pdpt_high + 3), boot_pml4 + 511 * 8
+
+    # Four page directories of 2MB pages cover the low 4GB...
+    movl $(boot_pd + 3), %eax
+    xorl %ecx, %ecx
+1:  movl %eax, boot_pdpt_low(, %ecx, 8)
+    addl $4096, %eax
+    incl %ecx
+    cmpl $4, %ecx
+    jne 1b
+
+    # ...and the first two of them are shared by the -2GB mapping.
+    movl $(boot_pd + 3), boot_pdpt_high + 510 * 8
+    movl $(boot_pd + 4096 + 3), boot_pdpt_high + 511 * 8
+
+    xorl %ecx, %ecx
+2:  movl %ecx, %eax
+    shll $21, %eax
+    orl $PAGE_LARGE, %eax
+    movl %eax, boot_pd(, %ecx, 8)
+    movl %ecx, %eax
+    shrl $11, %eax              # Bits 32+ of the frame address
+    movl %eax, boot_pd + 4(, %ecx, 8)
+    incl %ecx
+    cmpl $2048, %ecx
+    jne 2b
+
+    movl $boot_pml4, %eax
+    movl %eax, %cr3
+
+    movl %cr4, %eax
+    orl $(CR4_PAE | CR4_OSFXSR | CR4_OSXMMEXCPT), %eax
+    movl %eax, %cr4
+
+    movl $MSR_EFER, %ecx
+    rdmsr
+    orl $EFER_LME, %eax
+    wrmsr
+
+    # Paging on activates long mode; the FPU is native (no EM) for SSE.
+    movl %cr0, %eax
+    andl $~CR0_EM, %eax
+    orl $(CR0_PG | CR0_MP), %eax
+    movl %eax, %cr0
+
+    lgdt boot_gdt_ptr
+    ljmp $0x08, $long_mode_entry
+
+no_long_mode:
+    movl $0x4F4C4F4E, 0xB8000   # "NL" in red: CPU without long mode
+3:  hlt
+    jmp 3b
+.size start, . - start
+
+.code64
+long_mode_entry:
+    movw $0x10, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %fs
+    movw %ax, %gs
+    movw %ax, %ss
+
+    movabsq $higher_half, %rax
+    jmp *%rax
+
+# Minimal GDT for the switch; gdt64.c loads the kernel's own.
+.align 8
+boot_gdt:
+.quad 0
+.quad 0x00AF9A000000FFFF        # 64-bit code
+.quad 0x00CF92000000FFFF        # Data
+boot_gdt_ptr:
+.word . - boot_gdt - 1
+.long boot_gdt
+
+# Boot page tables, zeroed by the loader.
+.section .boot.bss, "aw", @nobits
+.align 4096
+boot_pml4:
+.skip 4096
+boot_pdpt_low:
+.skip 4096
+boot_pdpt_high:
+.skip 4096
+boot_pd:
+.skip 4096 * 4
+
+# This is the main code section, linked at KERNEL_VMA.
+.section .text
+.code64
+higher_half:
+    movabsq $stack_top, %rsp
+
+    # Upper halves of the registers are undefined after the mode switch.
+    movl %edi, %edi
+    movl %esi, %esi
+
+    # Now I'll call my C kernel's main function.
+    call kernel_main
+
+    # If the kernel ever returns, I'll halt the CPU.
+    cli
+4:  hlt
+    jmp 4b
+
+# Interrupt stubs. C code is compiled with SSE, so besides the
+# caller-saved registers each stub saves the FPU/SSE state with fxsave.
+# The stack is 16-byte aligned at the call: 40 bytes of CPU frame, the
+# error code, 9 registers and the 520-byte save area.
+# 'irq' stubs bump irq_nesting around their handler (see in_interrupt());
+# exceptions with 'errcode' already have the CPU's error code on the stack.
+.macro ISR_STUB name, handler, irq, errcode
+.global \name
+.type \name, @function
+\name:
+.if \errcode == 0
+    pushq $0
+.endif
+    pushq %rax
+    pushq %rcx
+    pushq %rdx
+    pushq %rsi
+    pushq %rdi
+    pushq %r8
+    pushq %r9
+    pushq %r10
+    pushq %r11
+    subq $520, %rsp
+    fxsave (%rsp)
+.if \irq
+    incl irq_nesting(%rip)
+.endif
+    movq 592(%rsp), %rdi        # Error code as first argument
+    call \handler
+.if \irq
+    decl irq_nesting(%rip)
+.endif
+    fxrstor (%rsp)
+    addq $520, %rsp
+    popq %r11
+    popq %r10
+    popq %r9
+    popq %r8
+    popq %rdi
+    popq %rsi
+    popq %rdx
+    popq %rcx
+    popq %rax
+    addq $8, %rsp
+    iretq
+.size \name, . - \name
+.endm
+
+ISR_STUB isr0, isr0_handler, 1, 0
+ISR_STUB isr1, isr1_handler, 1, 0
+
+# Page fault (exception 14): synchronous, so irq_nesting is left alone.
+ISR_STUB isr14, page_fault_handler, 0, 1
+
+# IRQ 14 (interrupt 46): primary ATA channel, see coroutine.c
+ISR_STUB isr46, irq14_handler, 1, 0
+
+# Task switch stubs. They save every register, not just the caller-saved
+# ones. The FPU/SSE area below them, followed by a pointer back to the
+# registers, is the task's frame; the handler returns the frame to
+# resume, possibly on another task's stack (see scheduler.c).
+.macro SWITCH_STUB name, handler
+.global \name
+.type \name, @function
+\name:
+    pushq %rax
+    pushq %rbx
+    pushq %rcx
+    pushq %rdx
+    pushq %rsi
+    pushq %rdi
+    pushq %rbp
+    pushq %r8
+    pushq %r9
+    pushq %r10
+    pushq %r11
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    incl irq_nesting(%rip)
+    movq %rsp, %rbx
+    subq $528, %rsp
+    andq $~15, %rsp
+    movq %rbx, 512(%rsp)
+    fxsave (%rsp)
+    movq %rsp, %rdi
+    call \handler
+    movq %rax, %rsp
+    call sched_finish_switch
+    fxrstor (%rsp)
+    movq 512(%rsp), %rsp
+    decl irq_nesting(%rip)
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %r11
+    popq %r10
+    popq %r9
+    popq %r8
+    popq %rbp
+    popq %rdi
+    popq %rsi
+    popq %rdx
+    popq %rcx
+    popq %rbx
+    popq %rax
+    iretq
+.size \name, . - \name
+.endm
+
+# Timer interrupt (IRQ 0 -> interrupt 32): preemption
+SWITCH_STUB isr32, timer_handler
+
+# Yield (int $48): a task giving up the CPU
+SWITCH_STUB isr_yield, sched_yield_handler
+
+# co_switch(save_sp, new_sp): coroutine switch. Only the callee-saved
+# registers need saving at a call; the stack pointer goes to *save_sp
+# and the 'ret' resumes whatever new_sp saved (see co_create()).
+.global co_switch
+.type co_switch, @function
+co_switch:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+.size co_switch, . - co_switch
+
+# I'm defining the BSS section for my stack.
+.section .bss
+.align 16
+stack_bottom:
+.skip 65536 # I'm allocating 64 KiB for the stack.
+stack_top:
@@ -0,0 +1,145 @@
+/**
+ * @file clock.c
+ * @brief TSC clock calibration and conversion
+ */
+
+#include "clock.h"
+#include "timer.h"
+#include "idt.h"
+
+#define PIT_CHANNEL2        0x42
+#define PIT_GATE_PORT       0x61      /* Bit 0: channel 2 gate, bit 1: speaker, bit 5: OUT2 */
+#define PIT_GATE2           0x01
+#define PIT_SPEAKER         0x02
+#define PIT_OUT2            0x20
+
+#define CLOCK_CALIBRATE_COUNT  (PIT_FREQUENCY / 1000 * CLOCK_CALIBRATE_MS)   /* Must fit 16 bits */
+#define CLOCK_CALIBRATE_LIMIT  (1ULL << 38)   /* TSC cycles before giving up on the PIT */
+#define CLOCK_TICK_NS          10000000       /* Without a TSC rate: the 100Hz tick */
+#define CPUID_EDX_INVARIANT_TSC (1 << 8)
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+/* ns = cycles * mult >> shift; mult 0 until calibrated */
+static uint32_t clock_mult = 0;
+static uint32_t clock_shift = 0;
+static uint64_t clock_base = 0;     /* TSC at clock_init() */
+static uint32_t tsc_khz = 0;
+static int tsc_invariant = 0;
+
+/* a / b by shift and subtract: no __udivdi3 on i686. Boot time only */
+static uint64_t div_u64(uint64_t a, uint64_t b) {
+    uint64_t quotient = 0;
+    uint64_t rest = 0;
+    for (int bit = 63; bit >= 0; bit--) {
+        rest = (rest << 1) | ((a >> bit) & 1);
+        if (rest >= b) {
+            rest -= b;
+            quotient |= 1ULL << bit;
+        }
+    }
+    return quotient;
+}
+
+/* (a * mul) >> shift for shift <= 32, without a 96-bit intermediate */
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint32_t low = (uint32_t)a;
+    uint32_t high = (uint32_t)(a >> 32);
+    uint64_t result = ((uint64_t)low * mul) >> shift;
+    if (high) result += ((uint64_t)high * mul) << (32 - shift);
+    return result;
+}
+
+static int cpu_has_invariant_tsc() {
+    uint32_t eax = 0x80000000, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (eax < 0x80000007) return 0;
+
+    eax = 0x80000007;
+    __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx & CPUID_EDX_INVARIANT_TSC) != 0;
+}
+
+/*
+ * TSC cycles while PIT channel 2 counts down CLOCK_CALIBRATE_COUNT in
+ * mode 0, or 0 if its OUT pin never rises. Interrupts must be disabled.
+ */
+static uint64_t calibrate_cycles() {
+    uint8_t gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, (gate & ~PIT_SPEAKER) | PIT_GATE2);
+
+    outb(PIT_CMD_REG, PIT_CMD_CHANNEL2 | PIT_MODE_ONESHOT);
+    outb(PIT_CHANNEL2, CLOCK_CALIBRATE_COUNT & 0xFF);
+    outb(PIT_CHANNEL2, (CLOCK_CALIBRATE_COUNT >> 8) & 0xFF);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & PIT_OUT2)) {
+        if (rdtsc() - start > CLOCK_CALIBRATE_LIMIT) {
+            outb(PIT_GATE_PORT, gate);
+            return 0;
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    outb(PIT_GATE_PORT, gate);
+    return cycles;
+}
+
+/*
+ * Measure the TSC rate and start the clock at 0. If the PIT cannot be
+ * used, clock_ns() counts whole ticks instead.
+ */
+void clock_init() {
+    tsc_invariant = cpu_has_invariant_tsc();
+
+    uintptr_t flags = irq_save();
+    uint64_t cycles = calibrate_cycles();
+    clock_base = rdtsc();
+    irq_restore(flags);
+    if (!cycles) return;
+
+    uint64_t hz = div_u64(cycles * PIT_FREQUENCY, CLOCK_CALIBRATE_COUNT);
+    tsc_khz = (uint32_t)div_u64(hz, 1000);
+
+    /* Largest shift whose multiplier still fits in 32 bits: best precision */
+    uint32_t shift = 32;
+    uint64_t mult = div_u64(1000000000ULL << shift, hz);
+    while (mult > 0xFFFFFFFF) {
+        shift--;
+        mult = div_u64(1000000000ULL << shift, hz);
+    }
+    clock_shift = shift;
+    clock_mult = (uint32_t)mult;
+}
+
+/* Nanoseconds spanned by 'cycles' TSC cycles; 0 before calibration */
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return mul_u64_u32_shr(cycles, clock_mult, clock_shift);
+}
+
+/* Nanoseconds since clock_init(); lock free, callable from anywhere */
+uint64_t clock_ns() {
+    if (!clock_mult) return (uint64_t)get_tick_count() * CLOCK_TICK_NS;
+
+    /* TSCs of different CPUs may disagree a little: never go below 0 */
+    uint64_t now = rdtsc();
+    if (now < clock_base) return 0;
+    return mul_u64_u32_shr(now - clock_base, clock_mult, clock_shift);
+}
+
+/* Measured TSC rate in kHz, 0 if calibration failed */
+uint32_t clock_tsc_khz() {
+    return tsc_khz;
+}
+
+int clock_tsc_invariant() {
+    return tsc_invariant;
+}
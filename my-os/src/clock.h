@@ -0,0 +1,30 @@
+/**
+ * @file clock.h
+ * @brief Monotonic nanosecond clock from the TSC
+ *
+ * clock_ns() counts nanoseconds since clock_init(). It reads the TSC and
+ * scales it by a multiply and a shift that clock_init() works out by
+ * timing the TSC against PIT channel 2, so a read is a few instructions
+ * and takes no lock. The 64x32-bit product is done in two halves and
+ * cannot overflow in any realistic uptime.
+ *
+ * An invariant TSC (CPUID 0x80000007) runs at the same rate in every
+ * P- and C-state. Without one the clock still counts, but its rate
+ * follows the CPU frequency; clock_tsc_invariant() tells which.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+#define CLOCK_CALIBRATE_MS  50    /* Length of the PIT measurement at boot */
+
+/* Function prototypes */
+void clock_init();
+uint64_t clock_ns();
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+uint32_t clock_tsc_khz();
+int clock_tsc_invariant();
+
+#endif
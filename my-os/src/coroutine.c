@@ -0,0 +1,285 @@
+/**
+ * @file coroutine.c
+ * @brief Kernel coroutine implementation
+ */
+
+#include "coroutine.h"
+#include "idt.h"
+#include "memory.h"
+#include "pic.h"
+#include "slab.h"
+#include "spinlock.h"
+
+/* Guards the ready queues, the wait lists and the latches; taken before sched_lock */
+static spinlock_t co_lock = SPINLOCK_INIT;
+static kmem_cache_t *co_cache = 0;
+
+/* Per IRQ line: who waits, and whether it fired with nobody waiting */
+static co_waiter_t *irq_waiters[CO_IRQ_LINES];
+static uint8_t irq_latched[CO_IRQ_LINES];
+static uint32_t irq_unmasked = 0;
+
+/* Caller holds co_lock */
+static void ready_push(co_sched_t *cs, coroutine_t *co) {
+    co->state = CO_READY;
+    co->next = 0;
+    if (cs->ready_tail) {
+        cs->ready_tail->next = co;
+    } else {
+        cs->ready_head = co;
+    }
+    cs->ready_tail = co;
+}
+
+static coroutine_t *ready_pop(co_sched_t *cs) {
+    coroutine_t *co = cs->ready_head;
+    if (co) {
+        cs->ready_head = co->next;
+        if (!cs->ready_head) cs->ready_tail = 0;
+        co->next = 0;
+    }
+    return co;
+}
+
+/* Coroutine running on this CPU, or 0 in plain task context */
+coroutine_t *co_current() {
+    task_t *task = task_current();
+    return (task && task->co_sched) ? task->co_sched->current : 0;
+}
+
+/* Back to co_run() on the host stack */
+static void co_switch_to_host(coroutine_t *co) {
+    co_switch(&co->sp, co->sched->host_sp);
+}
+
+/* First code a coroutine runs, entered from co_switch's 'ret' */
+static void co_start() {
+    coroutine_t *co = co_current();
+    co->entry(co->arg);
+    co->state = CO_DEAD;
+    co_switch_to_host(co);
+}
+
+/*
+ * Create a coroutine running entry(arg) in the calling task; it starts
+ * at the caller's next co_run(). Returns 0 if memory is short.
+ */
+coroutine_t *co_create(void (*entry)(void *arg), void *arg) {
+    task_t *task = task_current();
+    if (!entry || !task) return 0;
+
+    if (!task->co_sched) {
+        co_sched_t *cs = kmalloc(sizeof(co_sched_t));
+        if (!cs) return 0;
+        cs->current = 0;
+        cs->ready_head = cs->ready_tail = 0;
+        cs->host_sp = 0;
+        cs->live = 0;
+        cs->task = task;
+        task->co_sched = cs;
+    }
+
+    uintptr_t flags = spin_lock_irqsave(&co_lock);
+    if (!co_cache) {
+        co_cache = kmem_cache_create("coroutine", sizeof(coroutine_t), 0, 0);
+    }
+    spin_unlock_irqrestore(&co_lock, flags);
+    coroutine_t *co = co_cache ? kmem_cache_alloc(co_cache) : 0;
+    if (!co) return 0;
+
+    co->stack = kmalloc_aligned(CO_STACK_SIZE, 16);
+    if (!co->stack) {
+        kmem_cache_free(co_cache, co);
+        return 0;
+    }
+
+    /* What co_switch pops: callee-saved registers, then co_start */
+    uintptr_t *sp = (uintptr_t *)(co->stack + CO_STACK_SIZE);
+    *--sp = 0;                                  /* Return address of co_start */
+    *--sp = (uintptr_t)co_start;
+#ifdef __x86_64__
+    for (int i = 0; i < 6; i++) *--sp = 0;      /* rbx, rbp, r12-r15 */
+#else
+    for (int i = 0; i < 4; i++) *--sp = 0;      /* ebx, esi, edi, ebp */
+#endif
+    co->sp = (uintptr_t)sp;
+    co->entry = entry;
+    co->arg = arg;
+    co->sched = task->co_sched;
+
+    flags = spin_lock_irqsave(&co_lock);
+    co->sched->live++;
+    ready_push(co->sched, co);
+    spin_unlock_irqrestore(&co_lock, flags);
+    return co;
+}
+
+/*
+ * Run the calling task's coroutines until every one has returned. The
+ * task blocks while they all wait for interrupts. Returns how many ran.
+ */
+int co_run() {
+    task_t *task = task_current();
+    co_sched_t *cs = task ? task->co_sched : 0;
+    if (!cs || cs->current) return 0;
+
+    int finished = 0;
+    while (cs->live) {
+        uintptr_t flags = spin_lock_irqsave(&co_lock);
+        coroutine_t *co = ready_pop(cs);
+        if (co) co->state = CO_RUNNING;
+        spin_unlock_irqrestore(&co_lock, flags);
+
+        if (!co) {
+            /* All waiting: the interrupt that readies one wakes us */
+            task_block();
+            continue;
+        }
+
+        cs->current = co;
+        co_switch(&cs->host_sp, co->sp);
+        cs->current = 0;
+
+        if (co->state == CO_DEAD) {
+            cs->live--;
+            finished++;
+            kfree_aligned(co->stack);
+            kmem_cache_free(co_cache, co);
+        }
+    }
+
+    task->co_sched = 0;
+    kfree(cs);
+    return finished;
+}
+
+/* Let the other coroutines (or, outside one, the other tasks) run */
+void co_yield() {
+    coroutine_t *co = co_current();
+    if (!co) {
+        task_yield();
+        return;
+    }
+
+    uintptr_t flags = spin_lock_irqsave(&co_lock);
+    ready_push(co->sched, co);
+    spin_unlock_irqrestore(&co_lock, flags);
+    co_switch_to_host(co);
+}
+
+/* Make a waiter's coroutine ready or wake its task; caller holds co_lock */
+static void waiter_fire(co_waiter_t *waiter) {
+    task_t *task = waiter->task;
+    if (waiter->co) {
+        ready_push(waiter->co->sched, waiter->co);
+        task = waiter->co->sched->task;
+    }
+    waiter->fired = 1;   /* A plain task may return and reuse this stack now */
+    task_wake(task);
+}
+
+/* Timer callback of co_await_irq_timeout(): the interrupt did not come */
+static void co_irq_timeout(void *arg) {
+    co_waiter_t *waiter = arg;
+
+    spin_lock(&co_lock);
+    if (!waiter->fired) {
+        co_waiter_t **link = &irq_waiters[waiter->irq];
+        while (*link != waiter) link = &(*link)->next;
+        *link = waiter->next;
+        waiter->timed_out = 1;
+        waiter_fire(waiter);
+    }
+    spin_unlock(&co_lock);
+}
+
+/* Wait for 'irq', giving up after 'ticks' ticks unless 'ticks' is 0 */
+static int await_irq(uint8_t irq, uint32_t ticks) {
+    if (irq >= CO_IRQ_LINES || !(CO_IRQ_ROUTED & (1U << irq))) return -1;
+    if (in_interrupt()) return -1;
+
+    uintptr_t flags;
+    __asm__ __volatile__("pushf; pop %0" : "=r"(flags));
+    if (!(flags & EFLAGS_IF)) return -1;
+
+    task_t *task = task_current();
+    if (!task) return -1;
+    coroutine_t *co = co_current();
+
+    flags = spin_lock_irqsave(&co_lock);
+    if (!(irq_unmasked & (1U << irq))) {
+        irq_unmasked |= 1U << irq;
+        if (irq >= 8) pic_clear_mask(2);    /* Cascade from the slave PIC */
+        pic_clear_mask(irq);
+    }
+    if (irq_latched[irq]) {
+        irq_latched[irq] = 0;
+        spin_unlock_irqrestore(&co_lock, flags);
+        return 0;
+    }
+
+    co_waiter_t waiter;
+    waiter.task = co ? 0 : task;
+    waiter.co = co;
+    waiter.fired = 0;
+    waiter.timed_out = 0;
+    waiter.irq = irq;
+    waiter.next = irq_waiters[irq];
+    irq_waiters[irq] = &waiter;
+    ktimer_init(&waiter.timeout, co_irq_timeout, &waiter);
+    if (ticks) ktimer_arm(&waiter.timeout, ticks);
+
+    if (co) {
+        co->state = CO_WAITING;
+        spin_unlock_irqrestore(&co_lock, flags);
+        co_switch_to_host(co);
+    } else {
+        spin_unlock_irqrestore(&co_lock, flags);
+        /* An interrupt before task_block() leaves a pending wakeup */
+        while (!waiter.fired) task_block();
+    }
+
+    /* The waiter is on our stack: the timeout must be over before we return */
+    if (ticks) ktimer_cancel(&waiter.timeout);
+    return waiter.timed_out ? -1 : 0;
+}
+
+/*
+ * Wait for the next interrupt on 'irq', or return at once if one came
+ * since the last wait. Returns -1 if the caller cannot sleep (interrupt
+ * context, interrupts off, no scheduler, no stub for the line); it must
+ * poll its device instead.
+ */
+int co_await_irq(uint8_t irq) {
+    return await_irq(irq, 0);
+}
+
+/*
+ * co_await_irq() for at most 'ticks' ticks (at least one); also returns
+ * -1 when they run out first.
+ */
+int co_await_irq_timeout(uint8_t irq, uint32_t ticks) {
+    return await_irq(irq, ticks ? ticks : 1);
+}
+
+/* Wake everyone waiting on 'irq', or latch it if nobody is */
+static void co_irq_handler(uint8_t irq) {
+    spin_lock(&co_lock);
+    co_waiter_t *waiter = irq_waiters[irq];
+    irq_waiters[irq] = 0;
+    if (!waiter) irq_latched[irq] = 1;
+
+    while (waiter) {
+        co_waiter_t *next = waiter->next;
+        waiter_fire(waiter);
+        waiter = next;
+    }
+    spin_unlock(&co_lock);
+
+    pic_send_eoi(irq);
+}
+
+/* IRQ 14 (interrupt 46): primary ATA channel */
+void irq14_handler() {
+    co_irq_handler(CO_IRQ_ATA);
+}
@@ -0,0 +1,86 @@
+/**
+ * @file coroutine.h
+ * @brief Cooperative kernel coroutines and waiting on device interrupts
+ *
+ * A coroutine is a fiber with its own small stack that runs inside the
+ * task that created it. co_run() switches between the task's coroutines
+ * until all of them have returned; a switch only saves the callee-saved
+ * registers (co_switch in boot.s), so it costs a few instructions, not
+ * an interrupt frame.
+ *
+ * co_await_irq() lets a driver wait for its device: a coroutine gives
+ * the CPU to its siblings, a plain task blocks, and the interrupt makes
+ * the waiter ready again. When every coroutine waits, the host task
+ * blocks and the scheduler runs other tasks. An interrupt that arrives
+ * before anyone waits is latched, so issuing a command and then waiting
+ * cannot miss the completion.
+ *
+ * co_await_irq_timeout() also gives up after a number of ticks, for
+ * devices that may never answer. Only IRQ lines with a stub
+ * (CO_IRQ_ROUTED) can be waited on.
+ */
+
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <stdint.h>
+#include "scheduler.h"
+#include "ktimer.h"
+
+#define CO_STACK_SIZE   0x2000   /* 8KB: room for an interrupt frame and fxsave */
+#define CO_IRQ_LINES    16
+#define CO_IRQ_ATA      14       /* Primary ATA channel */
+#define CO_IRQ_ROUTED   (1U << CO_IRQ_ATA)
+
+/* Coroutine states */
+#define CO_READY     0
+#define CO_RUNNING   1
+#define CO_WAITING   2   /* In co_await_irq() */
+#define CO_DEAD      3
+
+typedef struct co_sched co_sched_t;
+
+typedef struct coroutine {
+    uintptr_t sp;               /* Saved stack pointer while switched out */
+    uint8_t *stack;
+    int state;
+    void (*entry)(void *arg);
+    void *arg;
+    co_sched_t *sched;
+    struct coroutine *next;     /* Ready queue link */
+} coroutine_t;
+
+/* A task's coroutines; allocated by its first co_create() */
+struct co_sched {
+    coroutine_t *current;       /* 0 while the host task itself runs */
+    coroutine_t *ready_head;
+    coroutine_t *ready_tail;
+    uintptr_t host_sp;          /* Host stack pointer while a coroutine runs */
+    uint32_t live;              /* Created and not yet returned */
+    task_t *task;               /* Host task, woken by interrupts */
+};
+
+/* Someone in co_await_irq(), on the waiter's stack */
+typedef struct co_waiter {
+    task_t *task;               /* Plain task to wake... */
+    coroutine_t *co;            /* ...or coroutine to make ready */
+    volatile int fired;         /* Woken, by the interrupt or the timeout */
+    int timed_out;
+    uint8_t irq;
+    ktimer_t timeout;           /* Armed for co_await_irq_timeout() */
+    struct co_waiter *next;
+} co_waiter_t;
+
+/* Function prototypes */
+coroutine_t *co_create(void (*entry)(void *arg), void *arg);
+int co_run();
+void co_yield();
+int co_await_irq(uint8_t irq);
+int co_await_irq_timeout(uint8_t irq, uint32_t ticks);
+coroutine_t *co_current();
+void irq14_handler();
+
+/* Stack switch in boot.s: saves into *save_sp, resumes new_sp */
+void co_switch(uintptr_t *save_sp, uintptr_t new_sp);
+
+#endif
@@ -0,0 +1,89 @@
+/**
+ * @file deferred.c
+ * @brief Per-CPU deferred work implementation
+ */
+
+#include "deferred.h"
+#include "idt.h"
+#include "scheduler.h"
+#include "smp.h"
+
+/*
+ * FIFO of one CPU. Only that CPU touches it, always with interrupts
+ * disabled, so it needs no lock.
+ */
+typedef struct {
+    deferred_work_t *head;
+    deferred_work_t *tail;
+    task_t *worker;
+} deferred_queue_t;
+
+static deferred_queue_t queues[SMP_MAX_CPUS];
+
+static void deferred_worker() {
+    uintptr_t flags = irq_save();
+    deferred_queue_t *queue = &queues[smp_cpu_id()];   /* Pinned: stays valid */
+    queue->worker = task_current();
+    irq_restore(flags);
+
+    while (1) {
+        flags = irq_save();
+        deferred_work_t *work = queue->head;
+        if (work) {
+            queue->head = work->next;
+            if (!queue->head) queue->tail = 0;
+        }
+        irq_restore(flags);
+
+        if (!work) {
+            /* A defer_work() before we block leaves a pending wakeup */
+            task_block();
+            continue;
+        }
+
+        deferred_fn_t fn = work->fn;
+        void *arg = work->arg;
+        __sync_lock_release(&work->pending);   /* It may be queued again now */
+        fn(arg);
+    }
+}
+
+/* Start a worker on every online CPU; after smp_init() */
+void deferred_init() {
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        if (smp_cpu_online(cpu)) {
+            create_task_on(deferred_worker, DEFERRED_PRIORITY, cpu);
+        }
+    }
+}
+
+void deferred_work_init(deferred_work_t *work, deferred_fn_t fn, void *arg) {
+    work->fn = fn;
+    work->arg = arg;
+    work->pending = 0;
+    work->next = 0;
+}
+
+/*
+ * Queue 'work' on the calling CPU; safe from interrupt handlers.
+ * Returns -1 if it is already queued (it will still run once).
+ */
+int defer_work(deferred_work_t *work) {
+    if (__sync_lock_test_and_set(&work->pending, 1)) return -1;
+
+    uintptr_t flags = irq_save();
+    deferred_queue_t *queue = &queues[smp_cpu_id()];
+    work->next = 0;
+    if (queue->tail) {
+        queue->tail->next = work;
+    } else {
+        queue->head = work;
+    }
+    queue->tail = work;
+    task_t *worker = queue->worker;
+    irq_restore(flags);
+
+    /* Before its worker starts, the queue waits for it */
+    if (worker) task_wake(worker);
+    return 0;
+}
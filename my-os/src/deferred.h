@@ -0,0 +1,40 @@
+/**
+ * @file deferred.h
+ * @brief Per-CPU deferred work ("bottom halves") for interrupt handlers
+ *
+ * An interrupt handler should only acknowledge its device and note what
+ * happened. Anything slower, such as printing or parsing, goes in a
+ * deferred_work_t that the handler queues with defer_work(). Each CPU
+ * has a worker task at DEFERRED_PRIORITY that runs its queue in order
+ * with interrupts enabled. A timer interrupt switches to the worker on
+ * its way out; other interrupts leave it for the next switch.
+ *
+ * Work runs in a task, so it may take locks and wake tasks. It should
+ * not block for long: the items queued behind it wait.
+ */
+
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <stdint.h>
+
+#define DEFERRED_PRIORITY  0   /* Above every other fixed priority */
+
+typedef void (*deferred_fn_t)(void *arg);
+
+/* One piece of deferred work, usually static in the code queueing it */
+typedef struct deferred_work {
+    deferred_fn_t fn;
+    void *arg;
+    volatile uint32_t pending;   /* Queued and not started yet */
+    struct deferred_work *next;
+} deferred_work_t;
+
+#define DEFERRED_WORK_INIT(fn, arg)  { (fn), (arg), 0, 0 }
+
+/* Function prototypes */
+void deferred_init();
+void deferred_work_init(deferred_work_t *work, deferred_fn_t fn, void *arg);
+int defer_work(deferred_work_t *work);
+
+#endif
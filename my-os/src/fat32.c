@@ -6,12 +6,38 @@
 #include "fat32.h"
 #include "kernel.h"
 #include "memory.h"
+#include "coroutine.h"
+#include "timer.h"
+#include "clock.h"
+#include "idt.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "waitqueue.h"
 
-/* Forward declarations to avoid conflicts */
-void outb(uint16_t port, uint8_t val);
-uint8_t inb(uint16_t port);
-uint16_t inw(uint16_t port);
-void memcpy(void *dest, const void *src, uint32_t n);
+/* In/out functions for kernel */
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline uint16_t inw(uint16_t port) {
+    uint16_t ret;
+    __asm__ volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void memcpy(void *dest, const void *src, uint32_t n) {
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    while (n--) {
+        *d++ = *s++;
+    }
+}
 
 /* Global file system instance */
 static fat32_fs_t *fs = 0;
@@ -26,6 +52,7 @@ static fat32_fs_t *fs = 0;
 #define ATA_DEVICE     0x1F6
 #define ATA_COMMAND    0x1F7
 #define ATA_STATUS     0x1F7
+#define ATA_CONTROL    0x3F6      /* Device control; bit 1 (nIEN) masks INTRQ */
 
 #define ATA_CMD_READ   0x20
 #define ATA_CMD_WRITE  0x30
@@ -34,6 +61,21 @@ static fat32_fs_t *fs = 0;
 #define ATA_MASTER     0xE0
 #define ATA_SLAVE      0xF0
 
+#define ATA_TIMEOUT_TICKS 100     /* 1s at 100Hz before a command is given up */
+#define ATA_TIMEOUT_MS    1000    /* The same bound for a busy-wait, by the TSC */
+#define ATA_POLL_LIMIT    1000000 /* Status reads (about 1us each) if the TSC is uncalibrated */
+
+/*
+ * Owner of the primary channel, from the first BSY wait of a command to
+ * its last data word: the task registers are shared, so two commands
+ * must never overlap. A task that may sleep waits on ata_queue; anything
+ * else (the page-fault path runs with interrupts off) spins.
+ */
+static spinlock_t ata_lock = SPINLOCK_INIT;
+static int ata_busy = 0;
+static task_t *ata_owner = 0;         /* Owning task if it may sleep, else 0 */
+static wait_queue_t ata_queue = WAIT_QUEUE_INIT;
+
 /* Allocate static FS structure */
 static uint8_t fs_data[sizeof(fat32_fs_t)];
 static fat32_fs_t *global_fs;
@@ -123,10 +165,88 @@ int fat32_get_next_cluster(fat32_fs_t *fs, uint32_t current_cluster) {
     return next_cluster;
 }
 
-/* Read a sector from disk */
-int fat32_read_sector(uint32_t sector, uint8_t *buffer) {
+/*
+ * Wait until the drive is not busy. A task or coroutine sleeps until
+ * IRQ 14; co_await_irq_timeout() fails at once where sleeping is not
+ * allowed, which leaves a busy-wait. The tick count stands still there
+ * when it is CPU 0 that has interrupts off, so the busy-wait is bounded
+ * by the TSC, or by a count of status reads before calibration. Returns
+ * -1 if the drive is still busy after about ATA_TIMEOUT_TICKS.
+ */
+static int ata_wait_not_busy() {
+    uint32_t deadline = get_tick_count() + ATA_TIMEOUT_TICKS;
+    uint32_t tsc_khz = clock_tsc_khz();
+    uint64_t tsc_deadline = rdtsc() + (uint64_t)tsc_khz * ATA_TIMEOUT_MS;
+    uint32_t polls = 0;
+
+    while ((inb(ATA_STATUS) & 0x80) == 0x80) {
+        int32_t left = (int32_t)(deadline - get_tick_count());
+        if (left <= 0) return -1;
+        if (co_await_irq_timeout(CO_IRQ_ATA, (uint32_t)left) == 0) continue;
+
+        if (tsc_khz ? rdtsc() >= tsc_deadline : ++polls >= ATA_POLL_LIMIT) return -1;
+        __asm__ __volatile__("pause");
+    }
+    return 0;
+}
+
+/* True if this context may sleep, as co_await_irq_timeout() decides it */
+static int ata_can_sleep() {
+    uintptr_t flags;
+    __asm__ __volatile__("pushf; pop %0" : "=r"(flags));
+    return (flags & EFLAGS_IF) && !in_interrupt() && task_current();
+}
+
+/* Take the channel if it is free, for 'owner' (0 if it cannot sleep) */
+static int ata_try_claim(void *owner) {
+    uintptr_t flags = spin_lock_irqsave(&ata_lock);
+    int claimed = !ata_busy;
+    if (claimed) {
+        ata_busy = 1;
+        ata_owner = owner;
+    }
+    spin_unlock_irqrestore(&ata_lock, flags);
+    return claimed;
+}
+
+/*
+ * Claim the channel. A context that cannot sleep spins, but gives up with
+ * -1 if the owner is a task of this CPU: it cannot run again until we
+ * return. Any other owner releases the channel within its own timeouts.
+ */
+static int ata_claim() {
+    if (ata_can_sleep()) {
+        wait_event(&ata_queue, ata_try_claim, task_current());
+        return 0;
+    }
+
+    while (!ata_try_claim(0)) {
+        uintptr_t flags = spin_lock_irqsave(&ata_lock);
+        task_t *owner = ata_busy ? ata_owner : 0;
+        int stuck = owner && owner->cpu == smp_cpu_id();
+        spin_unlock_irqrestore(&ata_lock, flags);
+        if (stuck) return -1;
+
+        smp_tlb_poll();
+        __asm__ __volatile__("pause");
+    }
+    return 0;
+}
+
+static void ata_release() {
+    uintptr_t flags = spin_lock_irqsave(&ata_lock);
+    ata_busy = 0;
+    ata_owner = 0;
+    spin_unlock_irqrestore(&ata_lock, flags);
+    wait_queue_wake(&ata_queue);
+}
+
+/* Read a sector from disk, holding the channel for the whole command */
+static int ata_read_sector(uint32_t sector, uint8_t *buffer) {
     /* Wait for drive to be ready */
-    while ((inb(ATA_STATUS) & 0x80) == 0x80) {}
+    if (ata_wait_not_busy() != 0) {
+        return -1;
+    }
 
     /* Prepare to read */
     outb(ATA_SECTOR_CT, 1);
@@ -134,10 +254,13 @@ int fat32_read_sector(uint32_t sector, uint8_t *buffer) {
     outb(ATA_LBA_MI, (sector >> 8) & 0xFF);
     outb(ATA_LBA_HI, (sector >> 16) & 0xFF);
     outb(ATA_DEVICE, ATA_MASTER | ((sector >> 24) & 0x0F));
+    outb(ATA_CONTROL, 0);   /* Completion raises IRQ 14 */
     outb(ATA_COMMAND, ATA_CMD_READ);
 
     /* Wait for read completion */
-    while ((inb(ATA_STATUS) & 0x80) == 0x80) {}
+    if (ata_wait_not_busy() != 0) {
+        return -1;
+    }
 
     /* Check for errors */
     if (inb(ATA_STATUS) & 0x01) {
@@ -154,6 +277,16 @@ int fat32_read_sector(uint32_t sector, uint8_t *buffer) {
     return 0;
 }
 
+/* Read a sector from disk */
+int fat32_read_sector(uint32_t sector, uint8_t *buffer) {
+    if (ata_claim() != 0) {
+        return -1;
+    }
+    int result = ata_read_sector(sector, buffer);
+    ata_release();
+    return result;
+}
+
 /* Normalize filename from 8.3 format */
 char *fat32_normalize_name(const fat32_dir_entry_t *entry, char *buffer, uint32_t size) {
     uint32_t i = 0;
@@ -194,23 +327,81 @@ char *fat32_normalize_name(const fat32_dir_entry_t *entry, char *buffer, uint32_
     return buffer;
 }
 
-/* Open file for reading */
+/* Bytes in one cluster */
+static inline uint32_t cluster_bytes(fat32_fs_t *fs) {
+    return (uint32_t)fs->bs->sectors_per_cluster * FAT32_SECTOR_SIZE;
+}
+
+/* First sector of a data cluster */
+static inline uint32_t cluster_to_sector(fat32_fs_t *fs, uint32_t cluster) {
+    return fs->data_start_sector + (cluster - 2) * fs->bs->sectors_per_cluster;
+}
+
+/* Follow the FAT chain; 0 at the end of the chain or on error */
+static uint32_t next_data_cluster(fat32_fs_t *fs, uint32_t cluster) {
+    int next = fat32_get_next_cluster(fs, cluster);
+    if (next < 2 || (uint32_t)next >= FAT32_CLUSTER_EOC) {
+        return 0;
+    }
+    return (uint32_t)next;
+}
+
+/* Compare a path against a normalized 8.3 name, ignoring case */
+static int name_matches(const char *path, const char *name) {
+    while (*path == '/') path++;
+
+    while (*path && *name) {
+        char a = *path++, b = *name++;
+        if (a >= 'a' && a <= 'z') a -= 'a' - 'A';
+        if (b >= 'a' && b <= 'z') b -= 'a' - 'A';
+        if (a != b) return 0;
+    }
+    return *path == '\0' && *name == '\0';
+}
+
+/* Open file for reading (root directory, 8.3 names) */
 int fat32_open_file(const char *filename, fat32_file_t *file) {
-    if (!fs || !fs->mounted) {
+    if (!fs || !fs->mounted || !filename || !file) {
         return -1;
     }
 
-    /* For now, implement simple linear search in root directory */
-    uint32_t root_cluster = fs->bs->root_cluster;
+    uint8_t sector_data[FAT32_SECTOR_SIZE];
+    char name[16];
+    uint32_t cluster = fs->bs->root_cluster;
+
+    while (cluster) {
+        uint32_t sector = cluster_to_sector(fs, cluster);
+
+        for (uint32_t s = 0; s < fs->bs->sectors_per_cluster; s++) {
+            if (fat32_read_sector(sector + s, sector_data) != 0) {
+                return -1;
+            }
 
-    /* Read root directory cluster */
-    uint32_t current_cluster = root_cluster;
-    uint8_t cluster_data[fs->bs->sectors_per_cluster * FAT32_SECTOR_SIZE];
+            fat32_dir_entry_t *entries = (fat32_dir_entry_t *)sector_data;
+            for (uint32_t e = 0; e < FAT32_SECTOR_SIZE / sizeof(fat32_dir_entry_t); e++) {
+                fat32_dir_entry_t *entry = &entries[e];
+
+                if (entry->name[0] == 0x00) return -1;  /* End of directory */
+                if (entry->name[0] == 0xE5) continue;   /* Deleted */
+                if ((entry->attr & FAT32_ATTR_LFN) == FAT32_ATTR_LFN) continue;
+                if (entry->attr & (FAT32_ATTR_VOLUME_ID | FAT32_ATTR_DIRECTORY)) continue;
+
+                if (name_matches(filename, fat32_normalize_name(entry, name, sizeof(name)))) {
+                    file->fs = fs;
+                    file->dir_entry = *entry;
+                    file->current_cluster = ((uint32_t)entry->first_cluster_hi << 16) | entry->first_cluster_lo;
+                    file->position = 0;
+                    file->size = entry->size;
+                    file->valid = 1;
+                    return 0;
+                }
+            }
+        }
 
-    /* Simple file search in root (for demo) */
-    /* This is a simplified implementation - real FAT32 would handle subdirs */
+        cluster = next_data_cluster(fs, cluster);
+    }
 
-    return -1; /* File not found or error */
+    return -1; /* File not found */
 }
 
 /* Basic implementations for now */
@@ -223,8 +414,58 @@ int fat32_close_file(fat32_file_t *file) {
     return 0;
 }
 
+/*
+ * Read up to 'size' bytes at 'offset' into 'buffer'; returns the bytes
+ * read or -1. The handle remembers the last cluster it reached, so
+ * reading a file front to back walks the FAT chain only once.
+ */
 int fat32_read_file(fat32_file_t *file, uint8_t *buffer, uint32_t offset, uint32_t size) {
-    return -1; /* Not implemented yet */
+    if (!file || !file->valid || !file->fs || !buffer) {
+        return -1;
+    }
+    if (offset >= file->size) return 0;
+    if (size > file->size - offset) size = file->size - offset;
+
+    fat32_fs_t *fs = file->fs;
+    uint32_t bytes_per_cluster = cluster_bytes(fs);
+
+    /* Resume from the cursor when reading forward, else from the start */
+    uint32_t cluster = file->current_cluster;
+    uint32_t cluster_start = file->position;
+    if (offset < cluster_start) {
+        cluster = ((uint32_t)file->dir_entry.first_cluster_hi << 16) | file->dir_entry.first_cluster_lo;
+        cluster_start = 0;
+    }
+
+    uint8_t sector_data[FAT32_SECTOR_SIZE];
+    uint32_t done = 0;
+
+    while (done < size) {
+        uint32_t in_cluster = offset + done - cluster_start;
+        if (in_cluster >= bytes_per_cluster) {
+            cluster = next_data_cluster(fs, cluster);
+            if (!cluster) return -1; /* Chain shorter than the file */
+            cluster_start += bytes_per_cluster;
+            continue;
+        }
+
+        uint32_t sector = cluster_to_sector(fs, cluster) + in_cluster / FAT32_SECTOR_SIZE;
+        uint32_t in_sector = in_cluster % FAT32_SECTOR_SIZE;
+        uint32_t chunk = FAT32_SECTOR_SIZE - in_sector;
+        if (chunk > size - done) chunk = size - done;
+
+        if (chunk == FAT32_SECTOR_SIZE) {
+            if (fat32_read_sector(sector, buffer + done) != 0) return -1;
+        } else {
+            if (fat32_read_sector(sector, sector_data) != 0) return -1;
+            memcpy(buffer + done, sector_data + in_sector, chunk);
+        }
+        done += chunk;
+    }
+
+    file->current_cluster = cluster;
+    file->position = cluster_start;
+    return (int)done;
 }
 
 int fat32_opendir(const char *path, fat32_dir_t *dir) {
@@ -238,35 +479,3 @@ int fat32_readdir(fat32_dir_t *dir, fat32_dir_entry_t *entry, char *name, uint32
 int fat32_closedir(fat32_dir_t *dir) {
     return 0;
 }
-
-/* In/out functions for kernel */
-static inline void outb(uint16_t port, uint8_t val) {
-    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
-}
-
-static inline uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
-}
-
-static inline uint16_t inw(uint16_t port) {
-    uint16_t ret;
-    __asm__ volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
-}
-
-static inline void memcpy(void *dest, const void *src, uint32_t n) {
-    unsigned char *d = dest;
-    const unsigned char *s = src;
-    while (n--) {
-        *d++ = *s++;
-    }
-}
-
-static inline void memset(void *dest, int val, uint32_t n) {
-    unsigned char *ptr = dest;
-    while (n--) {
-        *ptr++ = val;
-    }
-}
@@ -11,6 +11,7 @@
 /* FAT32 Data Structures */
 #define FAT32_SECTOR_SIZE 512
 #define FAT32_MAX_FILENAME 255
+#define FAT32_CLUSTER_EOC  0x0FFFFFF8  /* Cluster values from here on end a chain */
 
 /* FAT32 Boot Sector */
 typedef struct __attribute__((packed)) {
@@ -108,8 +109,8 @@ typedef struct {
 typedef struct {
     fat32_fs_t *fs;
     fat32_dir_entry_t dir_entry;
-    uint32_t current_cluster;
-    uint32_t position;
+    uint32_t current_cluster;   /* Read cursor: a cluster of the chain... */
+    uint32_t position;          /* ...and the file offset where it starts */
     uint32_t size;
     uint8_t valid;
 } fat32_file_t;
@@ -1,53 +1,74 @@
 /**
  * @file gdt.c
  * @brief Implementation of Global Descriptor Table
+ *
+ * Every CPU has its own table (inside its cpu_t, see smp.h): flat kernel
+ * code and data, a data segment based at the cpu_t that %gs keeps
+ * pointing to, and the CPU's TSS.
  */
 
 #include "gdt.h"
-
-/* GDT entries array */
-gdt_entry_t gdt_entries[3];
-gdt_ptr_t gdt_ptr;
+#include "smp.h"
 
 /* Set up a GDT entry */
-void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
-    gdt_entries[num].base_low = (base & 0xFFFF);
-    gdt_entries[num].base_middle = (base >> 16) & 0xFF;
-    gdt_entries[num].base_high = (base >> 24) & 0xFF;
-
-    gdt_entries[num].limit_low = (limit & 0xFFFF);
-    gdt_entries[num].granularity = ((limit >> 16) & 0x0F);
-    gdt_entries[num].granularity |= (gran & 0xF0);
-    gdt_entries[num].access = access;
+static void gdt_set_gate(gdt_entry_t *table, int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    table[num].base_low = (base & 0xFFFF);
+    table[num].base_middle = (base >> 16) & 0xFF;
+    table[num].base_high = (base >> 24) & 0xFF;
+
+    table[num].limit_low = (limit & 0xFFFF);
+    table[num].granularity = ((limit >> 16) & 0x0F);
+    table[num].granularity |= (gran & 0xF0);
+    table[num].access = access;
 }
 
-/* Initialize the GDT */
-void init_gdt() {
+/* Build and load the GDT and TSS of 'cpu'; runs on that CPU */
+void gdt_init_cpu(cpu_t *cpu) {
+    gdt_entry_t *gdt = cpu->gdt;
+
     /* Set up the GDT pointer */
-    gdt_ptr.limit = (sizeof(gdt_entry_t) * 3) - 1;
-    gdt_ptr.base = (uint32_t)&gdt_entries;
+    cpu->gdt_ptr.limit = (sizeof(gdt_entry_t) * GDT_ENTRIES) - 1;
+    cpu->gdt_ptr.base = (uintptr_t)gdt;
 
     /* Null descriptor */
-    gdt_set_gate(0, 0, 0, 0, 0);
+    gdt_set_gate(gdt, 0, 0, 0, 0, 0);
 
     /* Code segment */
-    gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xCF);
+    gdt_set_gate(gdt, 1, 0, 0xFFFFFFFF, 0x9A, 0xCF);
 
     /* Data segment */
-    gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF);
+    gdt_set_gate(gdt, 2, 0, 0xFFFFFFFF, 0x92, 0xCF);
+
+    /* Per-CPU data segment, byte granular */
+    gdt_set_gate(gdt, 3, (uint32_t)cpu, sizeof(cpu_t) - 1, 0x92, 0x40);
+
+    /* TSS: nothing runs in ring 3, but each CPU still needs one loaded */
+    uint8_t *tss = (uint8_t *)&cpu->tss;
+    for (uint32_t i = 0; i < sizeof(tss_t); i++) tss[i] = 0;
+    cpu->tss.ss0 = GDT_KERNEL_DATA_SEL;
+    cpu->tss.esp0 = cpu->stack ? (uint32_t)(cpu->stack + SMP_AP_STACK_SIZE) : 0;
+    cpu->tss.iomap_base = sizeof(tss_t);
+    gdt_set_gate(gdt, 4, (uint32_t)&cpu->tss, sizeof(tss_t) - 1, 0x89, 0x00);
 
     /* Load the GDT */
-    __asm__ __volatile__("lgdt %0" : : "m"(gdt_ptr));
+    __asm__ __volatile__("lgdt %0" : : "m"(cpu->gdt_ptr));
 
     /* Reload the segment registers */
     __asm__ __volatile__ (
         "movl %0, %%ds\n"
         "movl %0, %%es\n"
         "movl %0, %%fs\n"
-        "movl %0, %%gs\n"
+        "movl %1, %%gs\n"
         "movl %0, %%ss\n"
-        "ljmp $0x08, $reload_cs\n"
-        "reload_cs:"
-        : : "r"(0x10)
+        "ljmp $0x08, $1f\n"
+        "1:"
+        : : "r"(GDT_KERNEL_DATA_SEL), "r"(GDT_PERCPU_SEL) : "memory"
     );
+
+    __asm__ __volatile__("ltr %w0" : : "r"(GDT_TSS_SEL));
+}
+
+/* Initialize the GDT of the bootstrap processor */
+void init_gdt() {
+    gdt_init_cpu(smp_cpu(0));
 }
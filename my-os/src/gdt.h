@@ -21,10 +21,34 @@ typedef struct {
 /* GDT pointer structure */
 typedef struct {
     uint16_t limit;
-    uint32_t base;
+    uintptr_t base;
 } __attribute__((packed)) gdt_ptr_t;
 
+/* Selectors; 0x18 and 0x20 only exist in the 32-bit per-CPU tables */
+#define GDT_KERNEL_CODE_SEL  0x08
+#define GDT_KERNEL_DATA_SEL  0x10
+#define GDT_PERCPU_SEL       0x18   /* Loaded in %gs, based at the CPU's cpu_t */
+#define GDT_TSS_SEL          0x20
+#define GDT_ENTRIES          5
+
+/* 32-bit task state segment; only ss0/esp0 and the I/O map base are used */
+typedef struct {
+    uint32_t prev_tss;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+struct cpu;
+
 /* Function prototypes */
 void init_gdt();
+void gdt_init_cpu(struct cpu *cpu);
 
 #endif
@@ -0,0 +1,60 @@
+/**
+ * @file gdt64.c
+ * @brief Global Descriptor Table for the x86_64 (long mode) kernel
+ *
+ * Same layout as gdt.c: null, kernel code at 0x08 and kernel data at
+ * 0x10. In long mode base and limit are ignored; the code descriptor
+ * only differs by its L bit.
+ */
+
+#include "gdt.h"
+
+/* GDT entries array */
+gdt_entry_t gdt_entries[3];
+gdt_ptr_t gdt_ptr;
+
+/* Set up a GDT entry */
+void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    gdt_entries[num].base_low = (base & 0xFFFF);
+    gdt_entries[num].base_middle = (base >> 16) & 0xFF;
+    gdt_entries[num].base_high = (base >> 24) & 0xFF;
+
+    gdt_entries[num].limit_low = (limit & 0xFFFF);
+    gdt_entries[num].granularity = ((limit >> 16) & 0x0F);
+    gdt_entries[num].granularity |= (gran & 0xF0);
+    gdt_entries[num].access = access;
+}
+
+/* Initialize the GDT */
+void init_gdt() {
+    /* Set up the GDT pointer */
+    gdt_ptr.limit = (sizeof(gdt_entry_t) * 3) - 1;
+    gdt_ptr.base = (uintptr_t)&gdt_entries;
+
+    /* Null descriptor */
+    gdt_set_gate(0, 0, 0, 0, 0);
+
+    /* Code segment: G=1, L=1 (64-bit), D=0 */
+    gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xAF);
+
+    /* Data segment */
+    gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF);
+
+    /* Load the GDT */
+    __asm__ __volatile__("lgdt %0" : : "m"(gdt_ptr));
+
+    /* Reload the data segments, then CS through a far return */
+    __asm__ __volatile__ (
+        "movl %0, %%ds\n"
+        "movl %0, %%es\n"
+        "movl %0, %%fs\n"
+        "movl %0, %%gs\n"
+        "movl %0, %%ss\n"
+        "pushq $0x08\n"
+        "leaq 1f(%%rip), %%rax\n"
+        "pushq %%rax\n"
+        "lretq\n"
+        "1:"
+        : : "r"(0x10) : "rax", "memory"
+    );
+}
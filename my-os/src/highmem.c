@@ -0,0 +1,232 @@
+/**
+ * @file highmem.c
+ * @brief Implementation of the highmem page-frame pool and file cache
+ *
+ * Free frames are tracked in a bitmap (bit set: frame free) that lives in
+ * the VMM window, since its frames cannot hold their own free-list links.
+ * When the pool runs dry, the least recently used file that is no longer
+ * mapped loses all of its cached pages. The bitmap and the cache table
+ * change under mm_lock.
+ */
+
+#include "highmem.h"
+#include "kernel.h"
+#include "memory.h"
+
+static uint32_t *frame_bitmap = 0;
+static uint32_t base_pfn = 0;       /* Frame number of bit 0 */
+static uint32_t bitmap_words = 0;
+static uint32_t search_hint = 0;    /* Word to start the next search from */
+static uint32_t free_frames = 0;
+
+static highmem_cache_t caches[HIGHMEM_CACHE_FILES];
+static uint32_t cache_clock = 0;
+
+/* Clip a memory map entry to highmem, page aligned; 0 if nothing is left */
+static int clip_range(multiboot_mmap_entry_t *entry, uint64_t *start, uint64_t *end) {
+    if (entry->type != MULTIBOOT_MEMORY_AVAILABLE) return 0;
+
+    *start = (entry->addr + PMM_PAGE_SIZE - 1) & ~(uint64_t)(PMM_PAGE_SIZE - 1);
+    *end = (entry->addr + entry->len) & ~(uint64_t)(PMM_PAGE_SIZE - 1);
+    if (*start < HIGHMEM_START) *start = HIGHMEM_START;
+    if (*end > HIGHMEM_END) *end = HIGHMEM_END;
+    return *end > *start;
+}
+
+/* Collect usable frames above the direct map from the Multiboot map */
+void highmem_init(multiboot_info_t *mbi) {
+    uint64_t lowest = HIGHMEM_END, highest = 0, start, end;
+
+    if (!vmm_enabled() || !(mbi->flags & MULTIBOOT_INFO_MEM_MAP)) return;
+
+    for (uint32_t offset = 0; offset < mbi->mmap_length;) {
+        multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)(uintptr_t)(mbi->mmap_addr + offset);
+        if (clip_range(entry, &start, &end)) {
+            if (start < lowest) lowest = start;
+            if (end > highest) highest = end;
+        }
+        offset += entry->size + sizeof(entry->size);
+    }
+    if (highest <= lowest) return; /* No RAM above the direct map */
+
+    base_pfn = (uint32_t)(lowest >> PMM_PAGE_SHIFT);
+    uint32_t frames = (uint32_t)((highest - lowest) >> PMM_PAGE_SHIFT);
+    bitmap_words = (frames + 31) / 32;
+
+    /* Comes back zeroed: every frame starts out unavailable */
+    frame_bitmap = vmm_alloc_tensor(bitmap_words * sizeof(uint32_t));
+    if (!frame_bitmap) {
+        bitmap_words = 0;
+        return;
+    }
+
+    for (uint32_t offset = 0; offset < mbi->mmap_length;) {
+        multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)(uintptr_t)(mbi->mmap_addr + offset);
+        if (clip_range(entry, &start, &end)) {
+            uint32_t first = (uint32_t)(start >> PMM_PAGE_SHIFT) - base_pfn;
+            uint32_t last = (uint32_t)(end >> PMM_PAGE_SHIFT) - base_pfn;
+            for (uint32_t bit = first; bit < last; bit++) {
+                if (!(frame_bitmap[bit / 32] & (1u << (bit % 32)))) {
+                    frame_bitmap[bit / 32] |= 1u << (bit % 32);
+                    free_frames++;
+                }
+            }
+        }
+        offset += entry->size + sizeof(entry->size);
+    }
+
+    char buffer[16];
+    itoa((int)(free_frames / (1024 * 1024 / PMM_PAGE_SIZE)), buffer, 10);
+    vga_print("Highmem - cache modelli (MB): ", 0, 18, VGA_COLOR_WHITE);
+    vga_print(buffer, 30, 18, VGA_COLOR_CYAN);
+}
+
+uint32_t highmem_free_page_count() {
+    return free_frames;
+}
+
+int highmem_owns(vmm_phys_t frame) {
+    uint32_t pfn = (uint32_t)(frame >> PMM_PAGE_SHIFT);
+    return frame_bitmap && pfn >= base_pfn && pfn - base_pfn < bitmap_words * 32;
+}
+
+void highmem_free_frame(vmm_phys_t frame) {
+    if (!highmem_owns(frame)) return;
+
+    uint32_t bit = (uint32_t)(frame >> PMM_PAGE_SHIFT) - base_pfn;
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    if (!(frame_bitmap[bit / 32] & (1u << (bit % 32)))) { /* Else a double free */
+        frame_bitmap[bit / 32] |= 1u << (bit % 32);
+        free_frames++;
+    }
+    rspin_unlock_irqrestore(&mm_lock, flags);
+}
+
+/* Drop every resident page of an unmapped file */
+static void cache_evict(highmem_cache_t *cache) {
+    for (uint32_t i = 0; i < cache->pages; i++) {
+        if (cache->frames[i]) {
+            highmem_free_frame((vmm_phys_t)cache->frames[i] << PMM_PAGE_SHIFT);
+        }
+    }
+    kfree(cache->frames);
+    cache->frames = 0;
+    cache->key = 0;
+}
+
+/* Evict the least recently used file nobody maps; 0 if there is none */
+static int cache_evict_lru() {
+    highmem_cache_t *victim = 0;
+    for (int i = 0; i < HIGHMEM_CACHE_FILES; i++) {
+        if (caches[i].key && !caches[i].users &&
+            (!victim || caches[i].last_use < victim->last_use)) {
+            victim = &caches[i];
+        }
+    }
+    if (!victim) return 0;
+
+    cache_evict(victim);
+    return 1;
+}
+
+/* Take a free highmem frame, evicting cached files if needed; 0 if none */
+vmm_phys_t highmem_alloc_frame() {
+    if (!frame_bitmap) return 0;
+
+    vmm_phys_t frame = 0;
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    while (free_frames == 0) {
+        if (!cache_evict_lru()) {
+            rspin_unlock_irqrestore(&mm_lock, flags);
+            return 0;
+        }
+    }
+
+    for (uint32_t n = 0; n < bitmap_words; n++) {
+        uint32_t word = (search_hint + n) % bitmap_words;
+        if (frame_bitmap[word]) {
+            uint32_t bit = (uint32_t)__builtin_ctz(frame_bitmap[word]);
+            frame_bitmap[word] &= ~(1u << bit);
+            free_frames--;
+            search_hint = word;
+            frame = (vmm_phys_t)(base_pfn + word * 32 + bit) << PMM_PAGE_SHIFT;
+            break;
+        }
+    }
+    rspin_unlock_irqrestore(&mm_lock, flags);
+    return frame;
+}
+
+/* Cache entry of a file, created if needed; caller holds mm_lock */
+static highmem_cache_t *cache_lookup(uint32_t key, uint32_t pages) {
+    highmem_cache_t *slot = 0;
+    for (int i = 0; i < HIGHMEM_CACHE_FILES; i++) {
+        if (caches[i].key == key && caches[i].pages == pages) {
+            slot = &caches[i];
+            break;
+        }
+    }
+
+    if (!slot) {
+        for (int i = 0; i < HIGHMEM_CACHE_FILES && !slot; i++) {
+            if (!caches[i].key) slot = &caches[i];
+        }
+        if (!slot) {
+            if (!cache_evict_lru()) return 0;
+            return cache_lookup(key, pages);
+        }
+
+        slot->frames = kmalloc(pages * sizeof(uint32_t));
+        if (!slot->frames) return 0;
+        for (uint32_t i = 0; i < pages; i++) {
+            slot->frames[i] = 0;
+        }
+        slot->key = key;
+        slot->pages = pages;
+        slot->users = 0;
+    }
+    return slot;
+}
+
+/*
+ * Find or create the cache entry of a file of 'pages' pages and take a
+ * reference on it; 0 without highmem. Pair with highmem_cache_put().
+ */
+highmem_cache_t *highmem_cache_get(uint32_t key, uint32_t pages) {
+    if (!frame_bitmap || key == 0 || pages == 0) return 0;
+
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    highmem_cache_t *slot = cache_lookup(key, pages);
+    if (slot) {
+        slot->users++;
+        slot->last_use = ++cache_clock;
+    }
+    rspin_unlock_irqrestore(&mm_lock, flags);
+    return slot;
+}
+
+/*
+ * Record 'frame' as resident page 'index' of a file. Two mappings of the
+ * file may read the same page at once; returns 0 if the other one got
+ * there first, and the caller then uses its frame instead.
+ */
+int highmem_cache_publish(highmem_cache_t *cache, uint32_t index, vmm_phys_t frame) {
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    int published = cache->frames[index] == 0;
+    if (published) {
+        cache->frames[index] = (uint32_t)(frame >> PMM_PAGE_SHIFT);
+    }
+    rspin_unlock_irqrestore(&mm_lock, flags);
+    return published;
+}
+
+/* Drop a reference; the pages stay resident until evicted */
+void highmem_cache_put(highmem_cache_t *cache) {
+    if (!cache) return;
+
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    if (cache->users) {
+        cache->users--;
+    }
+    rspin_unlock_irqrestore(&mm_lock, flags);
+}
@@ -0,0 +1,47 @@
+/**
+ * @file highmem.h
+ * @brief Page frames beyond the direct map, used as a cache tier for model files
+ *
+ * RAM above the direct map (3GB .. 4GB, or up to 64GB with CONFIG_PAE) is
+ * not reachable through identity addresses, so the buddy allocator cannot
+ * manage it. Instead its frames hold pages of mapped model files: they are
+ * mapped into the VMM window on demand and stay resident after the file is
+ * unmapped, so the next load of the same model needs no disk reads.
+ */
+
+#ifndef HIGHMEM_H
+#define HIGHMEM_H
+
+#include <stdint.h>
+#include "multiboot.h"
+#include "vmm.h"
+
+#define HIGHMEM_START        ((uint64_t)VMM_DIRECT_MAP_END)
+#ifdef CONFIG_PAE
+#define HIGHMEM_END          0x1000000000ULL   /* 64GB: 36-bit physical addresses */
+#else
+#define HIGHMEM_END          0x100000000ULL    /* 32-bit PTEs stop at 4GB */
+#endif
+
+#define HIGHMEM_CACHE_FILES  8
+
+/* Resident pages of one file; frames[i] is the frame number of page i, or 0 */
+typedef struct {
+    uint32_t key;          /* First cluster of the file, 0 if the slot is free */
+    uint32_t pages;
+    uint32_t *frames;
+    uint32_t users;        /* Live mappings of the file */
+    uint32_t last_use;     /* For least-recently-used eviction */
+} highmem_cache_t;
+
+/* Function prototypes */
+void highmem_init(multiboot_info_t *mbi);
+uint32_t highmem_free_page_count();
+vmm_phys_t highmem_alloc_frame();
+void highmem_free_frame(vmm_phys_t frame);
+int highmem_owns(vmm_phys_t frame);
+highmem_cache_t *highmem_cache_get(uint32_t key, uint32_t pages);
+int highmem_cache_publish(highmem_cache_t *cache, uint32_t index, vmm_phys_t frame);
+void highmem_cache_put(highmem_cache_t *cache);
+
+#endif
@@ -4,13 +4,14 @@
  */
 
 #include "idt.h"
+#include "apic.h"
 
 /* Declare an IDT of 256 entries */
 idt_entry_t idt_entries[256];
 idt_ptr_t idt_ptr;
 
 /* Function to set an IDT gate */
-void idt_set_gate(uint8_t num, uint32_t base, uint16_t selector, uint8_t flags) {
+void idt_set_gate(uint8_t num, uintptr_t base, uint16_t selector, uint8_t flags) {
     idt_entries[num].base_low = base & 0xFFFF;
     idt_entries[num].base_high = (base >> 16) & 0xFFFF;
     idt_entries[num].selector = selector;
@@ -23,7 +24,7 @@ void init_idt() {
     uint32_t i;
 
     idt_ptr.limit = sizeof(idt_entry_t) * 256 - 1;
-    idt_ptr.base = (uint32_t)&idt_entries;
+    idt_ptr.base = (uintptr_t)&idt_entries;
 
     /* Clear the IDT - manually instead of memset */
     for (i = 0; i < sizeof(idt_entries); i++) {
@@ -31,10 +32,22 @@ void init_idt() {
     }
 
     /* Set up the IDT gates */
-    idt_set_gate(0, (uint32_t)isr0, KERNEL_CS, 0x8E);   // Divide by zero
-    idt_set_gate(1, (uint32_t)isr1, KERNEL_CS, 0x8E);   // Debug
-    idt_set_gate(32, (uint32_t)isr32, KERNEL_CS, 0x8E); // Timer (IRQ 0)
+    idt_set_gate(0, (uintptr_t)isr0, KERNEL_CS, 0x8E);   // Divide by zero
+    idt_set_gate(1, (uintptr_t)isr1, KERNEL_CS, 0x8E);   // Debug
+    idt_set_gate(14, (uintptr_t)isr14, KERNEL_CS, 0x8E); // Page fault
+    idt_set_gate(32, (uintptr_t)isr32, KERNEL_CS, 0x8E); // Timer (IRQ 0)
+    idt_set_gate(46, (uintptr_t)isr46, KERNEL_CS, 0x8E); // ATA (IRQ 14)
+    idt_set_gate(SCHED_YIELD_VECTOR, (uintptr_t)isr_yield, KERNEL_CS, 0x8E); // Task switch
+    idt_set_gate(SMP_TICK_VECTOR, (uintptr_t)isr_smp_tick, KERNEL_CS, 0x8E);  // Tick IPI (APs)
+    idt_set_gate(SMP_KICK_VECTOR, (uintptr_t)isr_smp_kick, KERNEL_CS, 0x8E);  // Reschedule IPI
+    idt_set_gate(SMP_TLB_VECTOR, (uintptr_t)isr_tlb_shootdown, KERNEL_CS, 0x8E);  // TLB shootdown IPI
+    idt_set_gate(LAPIC_TIMER_VECTOR, (uintptr_t)isr_lapic_timer, KERNEL_CS, 0x8E);  // Local APIC timer
+    idt_set_gate(LAPIC_SPURIOUS_VECTOR, (uintptr_t)isr_spurious, KERNEL_CS, 0x8E);
+
+    idt_load();
+}
 
-    /* Load the IDT */
+/* Load the shared IDT on the calling CPU */
+void idt_load() {
     __asm__ __volatile__("lidt %0" : : "m"(idt_ptr));
 }
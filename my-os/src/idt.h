@@ -7,11 +7,27 @@
 #define IDT_H
 
 #include <stdint.h>
+#include "smp.h"
 
 /* Segment selectors */
 #define KERNEL_CS 0x08
+#define KERNEL_DS 0x10
+
+/* Software interrupt a task raises to give up the CPU (task_yield) */
+#define SCHED_YIELD_VECTOR 48
 
 /* IDT entry structure */
+#ifdef __x86_64__
+typedef struct {
+    uint16_t base_low;
+    uint16_t selector;
+    uint8_t ist;          /* Interrupt stack table slot, 0 = current stack */
+    uint8_t flags;
+    uint16_t base_mid;
+    uint32_t base_high;
+    uint32_t zero;
+} __attribute__((packed)) idt_entry_t;
+#else
 typedef struct {
     uint16_t base_low;
     uint16_t selector;
@@ -19,18 +35,69 @@ typedef struct {
     uint8_t flags;
     uint16_t base_high;
 } __attribute__((packed)) idt_entry_t;
+#endif
 
 /* IDT pointer structure */
 typedef struct {
     uint16_t limit;
-    uint32_t base;
+    uintptr_t base;
 } __attribute__((packed)) idt_ptr_t;
 
+#ifdef __x86_64__
+/* Depth of interrupt handlers currently running, kept by the ISR stubs */
+extern volatile uint32_t irq_nesting;
+
+/* True while executing inside an interrupt handler */
+static inline int in_interrupt(void) {
+    return irq_nesting != 0;
+}
+#else
+/* True while this CPU executes inside an interrupt handler; the ISR stubs
+ * keep the depth in its cpu_t (see smp.h) */
+static inline int in_interrupt(void) {
+    uint32_t nesting;
+    __asm__ __volatile__("movl %%gs:%c1, %0" : "=r"(nesting) : "i"(CPU_IRQ_NESTING_OFFSET));
+    return nesting != 0;
+}
+#endif
+
+/* EFLAGS.IF */
+#define EFLAGS_IF 0x200
+
+/*
+ * Disable interrupts and return the previous flags for irq_restore().
+ * Tasks are preempted from the timer interrupt, so this is what keeps a
+ * critical section to one task of this CPU; data other CPUs touch also
+ * needs a spinlock (spinlock.h). Nests.
+ */
+static inline uintptr_t irq_save(void) {
+    uintptr_t flags;
+    __asm__ __volatile__("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uintptr_t flags) {
+    if (flags & EFLAGS_IF) {
+        __asm__ __volatile__("sti" : : : "memory");
+    }
+}
+
 /* Function prototypes */
 void init_idt();
-void idt_set_gate(uint8_t num, uint32_t base, uint16_t selector, uint8_t flags);
+void idt_load();
+void idt_set_gate(uint8_t num, uintptr_t base, uint16_t selector, uint8_t flags);
 extern void isr0();
 extern void isr1();
+extern void isr14();
 extern void isr32();
+extern void isr46();
+extern void isr_yield();
+#ifndef __x86_64__
+extern void isr_smp_tick();
+extern void isr_smp_kick();
+extern void isr_tlb_shootdown();
+extern void isr_lapic_timer();
+extern void isr_spurious();
+#endif
 
 #endif
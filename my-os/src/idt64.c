@@ -0,0 +1,56 @@
+/**
+ * @file idt64.c
+ * @brief Interrupt Descriptor Table for the x86_64 (long mode) kernel
+ *
+ * Gates are 16 bytes wide and hold the full 64-bit handler address.
+ * The handlers are the same as in the 32-bit kernel; the stubs live in
+ * boot64.s.
+ */
+
+#include "idt.h"
+
+/* Declare an IDT of 256 entries */
+idt_entry_t idt_entries[256];
+idt_ptr_t idt_ptr;
+
+/* Incremented and decremented by the ISR stubs in boot64.s */
+volatile uint32_t irq_nesting = 0;
+
+/* Function to set an IDT gate */
+void idt_set_gate(uint8_t num, uintptr_t base, uint16_t selector, uint8_t flags) {
+    idt_entries[num].base_low = base & 0xFFFF;
+    idt_entries[num].base_mid = (base >> 16) & 0xFFFF;
+    idt_entries[num].base_high = (uint32_t)(base >> 32);
+    idt_entries[num].selector = selector;
+    idt_entries[num].ist = 0;
+    idt_entries[num].flags = flags;
+    idt_entries[num].zero = 0;
+}
+
+/* Function to initialize the IDT */
+void init_idt() {
+    uint32_t i;
+
+    idt_ptr.limit = sizeof(idt_entry_t) * 256 - 1;
+    idt_ptr.base = (uintptr_t)&idt_entries;
+
+    /* Clear the IDT - manually instead of memset */
+    for (i = 0; i < sizeof(idt_entries); i++) {
+        ((uint8_t*)idt_entries)[i] = 0;
+    }
+
+    /* Set up the IDT gates (0x8E: present, ring 0, 64-bit interrupt gate) */
+    idt_set_gate(0, (uintptr_t)isr0, KERNEL_CS, 0x8E);   // Divide by zero
+    idt_set_gate(1, (uintptr_t)isr1, KERNEL_CS, 0x8E);   // Debug
+    idt_set_gate(14, (uintptr_t)isr14, KERNEL_CS, 0x8E); // Page fault
+    idt_set_gate(32, (uintptr_t)isr32, KERNEL_CS, 0x8E); // Timer (IRQ 0)
+    idt_set_gate(46, (uintptr_t)isr46, KERNEL_CS, 0x8E); // ATA (IRQ 14)
+    idt_set_gate(SCHED_YIELD_VECTOR, (uintptr_t)isr_yield, KERNEL_CS, 0x8E); // Task switch
+
+    idt_load();
+}
+
+/* Load the IDT on the calling CPU */
+void idt_load() {
+    __asm__ __volatile__("lidt %0" : : "m"(idt_ptr));
+}
@@ -4,12 +4,21 @@
  *        It's the first C function that gets executed.
  */
 
+#include "kernel.h"
 #include "idt.h"
 #include "gdt.h"
 #include "pic.h"
 #include "timer.h"
+#include "clock.h"
 #include "scheduler.h"
+#include "smp.h"
+#include "threadpool.h"
+#include "deferred.h"
 #include "memory.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "highmem.h"
+#include "multiboot.h"
 #include "framebuffer.h"
 #include "sensors.h"
 #include "menu.h"
@@ -19,79 +28,16 @@
 void isr0_handler();
 void isr1_handler();
 
-void init_basic_paging();
+/* Demo task prototypes (scheduler.c) */
+extern void task_process_1();
+extern void task_process_2();
+extern void task_process_3();
 
 /* Menu callback prototypes */
 extern void callback_insert_ai();
 extern void callback_info();
 extern void callback_exit();
 
-/* VGA text mode constants */
-#define VGA_ADDRESS 0xB8000
-#define VGA_WIDTH 80
-#define VGA_HEIGHT 25
-
-/* VGA color attributes */
-#define VGA_COLOR_BLACK 0
-#define VGA_COLOR_BLUE 1
-#define VGA_COLOR_GREEN 2
-#define VGA_COLOR_CYAN 3
-#define VGA_COLOR_RED 4
-#define VGA_COLOR_MAGENTA 5
-#define VGA_COLOR_BROWN 6
-#define VGA_COLOR_LIGHT_GREY 7
-#define VGA_COLOR_DARK_GREY 8
-#define VGA_COLOR_LIGHT_BLUE 9
-#define VGA_COLOR_LIGHT_GREEN 10
-#define VGA_COLOR_LIGHT_CYAN 11
-#define VGA_COLOR_LIGHT_RED 12
-#define VGA_COLOR_LIGHT_MAGENTA 13
-#define VGA_COLOR_LIGHT_BROWN 14
-#define VGA_COLOR_WHITE 15
-#define VGA_COLOR_YELLOW 14  /* Brown is actually yellow in some schemes */
-#define VGA_COLOR_PURPLE VGA_COLOR_MAGENTA
-
-/**
- * Create a VGA entry with the given character and color.
- */
-unsigned short vga_entry(unsigned char ch, unsigned char color) {
-    return (unsigned short) ch | (unsigned short) color << 8;
-}
-
-/**
- * Clear the VGA screen with the given color.
- */
-void vga_clear(unsigned char color) {
-    unsigned short *vga = (unsigned short *) VGA_ADDRESS;
-    for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        vga[i] = vga_entry(' ', color);
-    }
-}
-
-/**
- * Print a string to the VGA screen at the given position with the given color.
- */
-void vga_print(const char *str, int x, int y, unsigned char color) {
-    unsigned short *vga = (unsigned short *) VGA_ADDRESS;
-    int offset = y * VGA_WIDTH + x;
-    
-    while (*str) {
-        if (offset >= VGA_WIDTH * VGA_HEIGHT) break;
-        vga[offset] = vga_entry(*str, color);
-        offset++;
-        str++;
-    }
-}
-
-/**
- * Calculate the length of a string.
- */
-int strlen(const char *str) {
-    int len = 0;
-    while (*str++) len++;
-    return len;
-}
-
 /**
  * Copy string.
  */
@@ -101,47 +47,6 @@ char *strcpy(char *dest, const char *src) {
     return ret;
 }
 
-/**
- * Set memory block to a value.
- */
-void *memset(void *dest, int val, int n) {
-    unsigned char *ptr = dest;
-    while (n--) {
-        *ptr++ = val;
-    }
-    return dest;
-}
-
-/**
- * Convert integer to string.
- */
-char *itoa(int value, char *str, int base) {
-    char *rc;
-    char *ptr;
-    char *low;
-    if (base < 2 || base > 36) {
-        *str = '\0';
-        return str;
-    }
-    rc = ptr = str;
-    if (value < 0 && base == 10) {
-        *ptr++ = '-';
-        value = -value;
-    }
-    low = ptr;
-    do {
-        *ptr++ = "0123456789abcdefghijklmnopqrstuvwxyz"[value % base];
-        value /= base;
-    } while (value);
-    *ptr-- = '\0';
-    while (low < ptr) {
-        char tmp = *low;
-        *low++ = *ptr;
-        *ptr-- = tmp;
-    }
-    return rc;
-}
-
 /* ISR handler functions */
 void isr0_handler() {
     vga_print("ECCEZIONE: Divisione per zero!", 0, 6, VGA_COLOR_RED);
@@ -172,7 +77,7 @@ void vga_println(const char *str, unsigned char color) {
     }
 }
 
-void kernel_main(void) {
+void kernel_main(uint32_t magic, multiboot_info_t *mbi) {
     /* Initialize Global Descriptor Table */
     init_gdt();
 
@@ -193,29 +98,62 @@ void kernel_main(void) {
     /* Initialize timer for ~100 Hz (every 10ms) */
     pit_init(100);
 
+    /* Nanosecond clock: time the TSC against the PIT */
+    clock_init();
+
     /* Enable interrupts */
     __asm__ __volatile__("sti");
 
-    /* Initialize basic paging after interrupts are enabled */
-    init_basic_paging();
-
     vga_print("PIC e Timer inizializzati - Interruzioni abilitate!", 0, 8, VGA_COLOR_LIGHT_GREEN);
     vga_print("Il sistema sta ora ricevendo interrupt del timer...", 0, 10, VGA_COLOR_LIGHT_GREEN);
 
-    /* Initialize the task scheduler but disable complex multitasking for stability */
+    /* Initialize the task scheduler; kernel_main becomes task 0 */
     init_scheduler();
-    /* NOTE: Complex task switching disabled in timer to prevent interrupt conflicts */
-    /* For demo, focus is on AI functionality without multitasking complexity */
 
-    vga_print("Scheduler inizializzato - multitasking semplificato per stabilita!", 0, 12, VGA_COLOR_LIGHT_GREEN);
+    vga_print("Scheduler inizializzato - multitasking preemptivo attivo!", 0, 12, VGA_COLOR_LIGHT_GREEN);
     vga_print("Focus sulla AI - osservate le decisioni intelligenti!", 0, 14, VGA_COLOR_LIGHT_GREEN);
 
+    /* Initialize physical page allocator from the GRUB memory map */
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        pmm_init(mbi);
+    } else {
+        vga_print("ERRORE: avvio non Multiboot - memoria fisica sconosciuta", 0, 15, VGA_COLOR_RED);
+    }
+
+    /* Build the page tables: PSE identity map of RAM, then paging on */
+    vmm_init();
+
     /* Initialize memory manager */
     init_memory_manager();
 
+    /* RAM beyond the direct map becomes a cache for model files */
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        highmem_init(mbi);
+    }
+
+    /* Tick from the local APIC timers from now on, the APs' too */
+    timer_use_lapic(100);
+
+    /* Start the other processors; tasks created below spread over them */
+    smp_init();
+
+    /* One compute worker per extra CPU for parallel_for */
+    threadpool_init();
+
+    /* Per-CPU workers for work interrupt handlers defer */
+    deferred_init();
+
+    /* Demo tasks, time-sliced against the kernel main loop */
+    create_task(task_process_1, TASK_PRIORITY_DEFAULT);
+    create_task(task_process_2, TASK_PRIORITY_DEFAULT);
+    create_task(task_process_3, TASK_PRIORITY_DEFAULT);
+
     /* Initialize sensor framework for AI */
     init_sensor_framework();
 
+    /* Periodic sensor sampling, guaranteed by the EDF class */
+    create_task(sensor_sampling_task, TASK_PRIORITY_HIGH);
+
     /* Initialize framebuffer for graphics */
     init_framebuffer();
 
@@ -239,31 +177,11 @@ void kernel_main(void) {
 
     /*
      * Main kernel loop - system is now running with interrupts
-     * The timer will eventually trigger a safe shutdown after the demo
+     * The timer will eventually trigger a safe shutdown after the demo.
+     * The boot context has nothing left to do: blocking it lets the idle
+     * task halt the CPU (and stop the tick) whenever the tasks sleep.
      */
     while (1) {
-        /* Main system loop - AI can perform periodic tasks here */
-        /* For demo, we rely on timer interrupts to drive activity */
+        task_block();
     }
 }
-
-/* Basic paging initialization - simplified to work with QEMU */
-void init_basic_paging() {
-    /* For now, we'll skip complex paging setup and let the system
-       run with direct physical address mapping. This prevents paging
-       conflicts in QEMU emulation that cause instability.
-
-       In a production system, we would set up proper page tables here.
-    */
-
-    /* Enable paging bit in CR0, but keep identity mapping */
-    __asm__ __volatile__(
-        "movl %%cr0, %%eax;"        /* Read current CR0 */
-        "or $0x80000000, %%eax;"    /* Set paging bit (PG) */
-        "movl %%eax, %%cr0;"        /* Write back to CR0 */
-        : : : "eax"
-    );
-
-    /* Note: Real paging setup would create page directory and table entries */
-    /* For stability demo, we use bootloader's identity mapping */
-}
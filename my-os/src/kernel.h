@@ -33,7 +33,8 @@
 #define VGA_COLOR_YELLOW 14  /* Brown is actually yellow in some schemes */
 #define VGA_COLOR_PURPLE VGA_COLOR_MAGENTA
 
-/* Function prototypes */
+/* Function prototypes (klib.c) */
+unsigned short vga_entry(unsigned char ch, unsigned char color);
 void vga_print(const char *str, int x, int y, unsigned char color);
 void vga_clear(unsigned char color);
 int strlen(const char *str);
@@ -0,0 +1,87 @@
+/**
+ * @file kernel64.c
+ * @brief Entry point of the x86_64 (long mode) kernel
+ *
+ * boot64.s switches to long mode and jumps to kernel_main in the higher
+ * half. This brings up the same core as kernel.c - interrupts, timer,
+ * memory and the AI runtime - without the menu and demo code, which is
+ * still 32-bit only.
+ */
+
+#include "kernel.h"
+#include "idt.h"
+#include "gdt.h"
+#include "pic.h"
+#include "timer.h"
+#include "clock.h"
+#include "scheduler.h"
+#include "deferred.h"
+#include "memory.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "highmem.h"
+#include "multiboot.h"
+#include "sensors.h"
+#include "ai_runtime.h"
+
+/* ISR handler prototypes */
+void isr0_handler();
+void isr1_handler();
+
+/* ISR handler functions */
+void isr0_handler() {
+    vga_print("ECCEZIONE: Divisione per zero!", 0, 6, VGA_COLOR_RED);
+    while(1); // Halt
+}
+
+void isr1_handler() {
+    vga_print("ECCEZIONE: Debug interrupt!", 0, 7, VGA_COLOR_RED);
+    while(1); // Halt
+}
+
+void kernel_main(uint32_t magic, multiboot_info_t *mbi) {
+    /* Long mode descriptor tables */
+    init_gdt();
+    init_idt();
+
+    vga_clear(VGA_COLOR_BLACK);
+    vga_print("Benvenuto a My OS - kernel x86_64 (long mode)", 0, 0, VGA_COLOR_WHITE);
+    vga_print("Kernel in higher half, SSE2 attivo", 0, 2, VGA_COLOR_LIGHT_BLUE);
+
+    /* Initialize Programmable Interrupt Controller and a ~100 Hz timer */
+    pic_init();
+    pit_init(100);
+    clock_init();
+
+    init_scheduler();
+
+    /* Physical memory, page tables, heap, then the highmem model cache */
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        pmm_init(mbi);
+    } else {
+        vga_print("ERRORE: avvio non Multiboot - memoria fisica sconosciuta", 0, 15, VGA_COLOR_RED);
+    }
+    vmm_init();
+    init_memory_manager();
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        highmem_init(mbi);
+    }
+
+    init_sensor_framework();
+    init_ai_runtime();
+
+    vga_print("Memoria e runtime AI inizializzati", 0, 4, VGA_COLOR_GREEN);
+
+    /* Enable interrupts */
+    __asm__ __volatile__("sti");
+
+    vga_print("Sistema pronto - interruzioni abilitate", 0, 6, VGA_COLOR_LIGHT_GREEN);
+
+    /* Worker for the work interrupt handlers defer */
+    deferred_init();
+
+    /* Leave the CPU to the idle task */
+    while (1) {
+        task_block();
+    }
+}
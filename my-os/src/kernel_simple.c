@@ -5,7 +5,12 @@
 
 #include <stdint.h>
 #include "kernel.h"
+#include "gdt.h"
 #include "memory.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "highmem.h"
+#include "clock.h"
 #include "framebuffer.h"
 #include "ai_runtime.h"
 #include "sensors.h"
@@ -14,14 +19,25 @@
 extern void keyboard_handler(void);
 
 /* Simple kernel main function */
-void kernel_main(void) {
+void kernel_main(uint32_t magic, multiboot_info_t *mbi) {
+    /* The allocators find their CPU through the per-CPU segment in %gs */
+    init_gdt();
+
     /* Initialize essential subsystems */
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        pmm_init(mbi);
+    }
+    vmm_init();
     init_memory_manager();
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        highmem_init(mbi);
+    }
+    clock_init();   /* Only PIT channel 2: works without interrupts */
     init_ai_runtime();
 
     /* Skip some initializations for now */
     /* init_sensor_framework();  // Will use demo sensor data */
-    /* init_gdt(); init_idt();  // Critical for protected mode */
+    /* init_idt();  // Critical for protected mode */
     /* init_pic(); init_timer(); init_scheduler();  // Hardware dependent */
 
     /* Clear screen and show welcome */
@@ -190,39 +206,6 @@ void kfree(void *ptr) {
 }
 
 static char int_buffer[16];
-static void reverse(char *str, int len) {
-    int start = 0, end = len - 1;
-    while (start < end) {
-        char temp = str[start];
-        str[start] = str[end];
-        str[end] = temp;
-        start++;
-        end--;
-    }
-}
-
-char *itoa(int num, char *str, int base) {
-    int i = 0;
-    int is_negative = 0;
-
-    if (num < 0 && base == 10) {
-        is_negative = 1;
-        num = -num;
-    }
-
-    do {
-        int rem = num % base;
-        str[i++] = (rem > 9) ? (rem - 10) + 'a' : rem + '0';
-        num = num / base;
-    } while (num != 0);
-
-    if (is_negative) str[i++] = '-';
-    str[i] = '\0';
-
-    reverse(str, i);
-    return str;
-}
-
 char *strcpy(char *destination, const char *source) {
     char *dest_ptr = destination;
     while ((*dest_ptr++ = *source++));
@@ -0,0 +1,90 @@
+/**
+ * @file klib.c
+ * @brief VGA text output and string helpers declared in kernel.h
+ *
+ * Linked into both the i386 and the x86_64 kernel.
+ */
+
+#include "kernel.h"
+
+/**
+ * Create a VGA entry with the given character and color.
+ */
+unsigned short vga_entry(unsigned char ch, unsigned char color) {
+    return (unsigned short) ch | (unsigned short) color << 8;
+}
+
+/**
+ * Clear the VGA screen with the given color.
+ */
+void vga_clear(unsigned char color) {
+    unsigned short *vga = (unsigned short *) VGA_ADDRESS;
+    for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
+        vga[i] = vga_entry(' ', color);
+    }
+}
+
+/**
+ * Print a string to the VGA screen at the given position with the given color.
+ */
+void vga_print(const char *str, int x, int y, unsigned char color) {
+    unsigned short *vga = (unsigned short *) VGA_ADDRESS;
+    int offset = y * VGA_WIDTH + x;
+    
+    while (*str) {
+        if (offset >= VGA_WIDTH * VGA_HEIGHT) break;
+        vga[offset] = vga_entry(*str, color);
+        offset++;
+        str++;
+    }
+}
+
+/**
+ * Calculate the length of a string.
+ */
+int strlen(const char *str) {
+    int len = 0;
+    while (*str++) len++;
+    return len;
+}
+
+/**
+ * Set memory block to a value.
+ */
+void *memset(void *dest, int val, int n) {
+    unsigned char *ptr = dest;
+    while (n--) {
+        *ptr++ = val;
+    }
+    return dest;
+}
+
+/**
+ * Convert integer to string.
+ */
+char *itoa(int value, char *str, int base) {
+    char *rc;
+    char *ptr;
+    char *low;
+    if (base < 2 || base > 36) {
+        *str = '\0';
+        return str;
+    }
+    rc = ptr = str;
+    if (value < 0 && base == 10) {
+        *ptr++ = '-';
+        value = -value;
+    }
+    low = ptr;
+    do {
+        *ptr++ = "0123456789abcdefghijklmnopqrstuvwxyz"[value % base];
+        value /= base;
+    } while (value);
+    *ptr-- = '\0';
+    while (low < ptr) {
+        char tmp = *low;
+        *low++ = *ptr;
+        *ptr-- = tmp;
+    }
+    return rc;
+}
@@ -0,0 +1,242 @@
+/**
+ * @file ktimer.c
+ * @brief Hierarchical timing wheel and kernel timer implementation
+ */
+
+#include "ktimer.h"
+#include "timer.h"
+#include "smp.h"
+#include "spinlock.h"
+
+/* Callback timers, expired by the timer interrupt on the BSP */
+static timer_wheel_t ktimer_wheel;
+static spinlock_t ktimer_lock = SPINLOCK_INIT;
+static ktimer_t *volatile ktimer_running = 0;   /* Its callback is being called */
+
+/* Lowest set bit of a non-zero bitmap; __builtin_ctzll needs libgcc on i686 */
+static inline uint32_t bitmap_first(uint64_t bits) {
+    uint32_t low = (uint32_t)bits;
+    return low ? (uint32_t)__builtin_ctz(low) : 32 + (uint32_t)__builtin_ctz((uint32_t)(bits >> 32));
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, uint32_t now) {
+    wheel->clock = now;
+    wheel->count = 0;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        wheel->occupied[level] = 0;
+    }
+    for (int i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; i++) {
+        wheel->slots[i] = 0;
+    }
+}
+
+/* Link a timer into the slot its expiry falls in, seen from the wheel's clock */
+static void slot_insert(timer_wheel_t *wheel, ktimer_t *timer) {
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - wheel->clock;
+    uint32_t level = 0;
+
+    if ((int32_t)delta < 0) {
+        expires = wheel->clock;             /* Overdue: the slot expired next */
+    } else {
+        if (delta > TIMER_WHEEL_RANGE) {
+            /* Out of range: park it in the farthest slot, it cascades back */
+            delta = TIMER_WHEEL_RANGE;
+            expires = wheel->clock + delta;
+        }
+        while (delta >> ((level + 1) * TIMER_WHEEL_BITS)) level++;
+    }
+
+    uint32_t index = (expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+    uint32_t slot = level * TIMER_WHEEL_SLOTS + index;
+    timer->slot = (uint16_t)slot;
+    timer->prev = 0;
+    timer->next = wheel->slots[slot];
+    if (timer->next) timer->next->prev = timer;
+    wheel->slots[slot] = timer;
+    wheel->occupied[level] |= 1ULL << index;
+}
+
+static void slot_unlink(timer_wheel_t *wheel, ktimer_t *timer) {
+    uint32_t slot = timer->slot;
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel->slots[slot] = timer->next;
+        if (!timer->next) {
+            wheel->occupied[slot / TIMER_WHEEL_SLOTS] &= ~(1ULL << (slot & TIMER_WHEEL_MASK));
+        }
+    }
+    if (timer->next) timer->next->prev = timer->prev;
+    timer->next = timer->prev = 0;
+}
+
+/* Spread the timers of one higher level slot over the levels below */
+static void cascade(timer_wheel_t *wheel, uint32_t level, uint32_t index) {
+    uint32_t slot = level * TIMER_WHEEL_SLOTS + index;
+    ktimer_t *timer = wheel->slots[slot];
+    wheel->slots[slot] = 0;
+    wheel->occupied[level] &= ~(1ULL << index);
+
+    while (timer) {
+        ktimer_t *next = timer->next;
+        slot_insert(wheel, timer);
+        timer = next;
+    }
+}
+
+/* Move the clock on one tick, cascading each level whose boundary it reaches */
+static void advance(timer_wheel_t *wheel) {
+    uint32_t clock = ++wheel->clock;
+    for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        uint32_t shift = level * TIMER_WHEEL_BITS;
+        if (clock & ((1U << shift) - 1)) break;
+        cascade(wheel, level, (clock >> shift) & TIMER_WHEEL_MASK);
+    }
+}
+
+/* Add a timer at timer->expires; it must not be pending already */
+void timer_wheel_add(timer_wheel_t *wheel, ktimer_t *timer, uint32_t now) {
+    /* An empty wheel may have stopped its clock: restart it from now */
+    if (!wheel->count) wheel->clock = now;
+    wheel->count++;
+    timer->pending = 1;
+    slot_insert(wheel, timer);
+}
+
+/* Take a timer out; nothing happens if it is not pending */
+void timer_wheel_remove(timer_wheel_t *wheel, ktimer_t *timer) {
+    if (!timer->pending) return;
+    slot_unlink(wheel, timer);
+    timer->pending = 0;
+    wheel->count--;
+}
+
+/*
+ * Remove and return one timer due by 'now', or 0 once there is none.
+ * The clock stops at the first tick still to come.
+ */
+ktimer_t *timer_wheel_pop(timer_wheel_t *wheel, uint32_t now) {
+    if (!wheel->count) {
+        wheel->clock = now + 1;
+        return 0;
+    }
+
+    while ((int32_t)(now - wheel->clock) >= 0) {
+        ktimer_t *timer = wheel->slots[wheel->clock & TIMER_WHEEL_MASK];
+        if (timer) {
+            timer_wheel_remove(wheel, timer);
+            return timer;
+        }
+        advance(wheel);
+    }
+    return 0;
+}
+
+/*
+ * Ticks from 'now' until the first timer may expire, for the tickless
+ * idle loop; TIMER_WHEEL_NONE if none is pending. Timers above level 0
+ * count as due at the next cascade, so the result can be early, never
+ * late.
+ */
+uint32_t timer_wheel_next(timer_wheel_t *wheel, uint32_t now) {
+    if (!wheel->count) return TIMER_WHEEL_NONE;
+
+    uint32_t clock = wheel->clock;
+    uint32_t next = 0;
+    int found = 0;
+
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if (wheel->occupied[level]) {
+            next = (clock | TIMER_WHEEL_MASK) + 1;
+            found = 1;
+            break;
+        }
+    }
+
+    uint64_t near = wheel->occupied[0];
+    if (near) {
+        /* First occupied level 0 slot at or after the clock's */
+        uint32_t shift = clock & TIMER_WHEEL_MASK;
+        if (shift) near = (near >> shift) | (near << (TIMER_WHEEL_SLOTS - shift));
+        uint32_t due = clock + bitmap_first(near);
+        if (!found || (int32_t)(due - next) < 0) next = due;
+    }
+
+    int32_t ticks = (int32_t)(next - now);
+    return ticks > 0 ? (uint32_t)ticks : 0;
+}
+
+void ktimer_init(ktimer_t *timer, ktimer_fn_t fn, void *arg) {
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->slot = 0;
+    timer->pending = 0;
+    timer->next = timer->prev = 0;
+}
+
+/*
+ * Call the timer's function at tick 'tick', moving it if it is already
+ * pending. A tick that has already come fires at the next timer interrupt.
+ */
+void ktimer_arm_at(ktimer_t *timer, uint32_t tick) {
+    uintptr_t flags = spin_lock_irqsave(&ktimer_lock);
+    uint32_t now = get_tick_count();
+    if ((int32_t)(tick - now) <= 0) tick = now + 1;
+
+    timer_wheel_remove(&ktimer_wheel, timer);
+    timer->expires = tick;
+    timer_wheel_add(&ktimer_wheel, timer, now);
+    spin_unlock_irqrestore(&ktimer_lock, flags);
+}
+
+/* Call the timer's function in at least 'ticks' ticks */
+void ktimer_arm(ktimer_t *timer, uint32_t ticks) {
+    ktimer_arm_at(timer, get_tick_count() + (ticks ? ticks : 1));
+}
+
+/*
+ * Stop a timer. Off the BSP this also waits for a call of its function
+ * already under way, so the timer may be freed afterwards. Returns -1
+ * if it was not pending.
+ */
+int ktimer_cancel(ktimer_t *timer) {
+    uintptr_t flags = spin_lock_irqsave(&ktimer_lock);
+    int result = timer->pending ? 0 : -1;
+    timer_wheel_remove(&ktimer_wheel, timer);
+    spin_unlock_irqrestore(&ktimer_lock, flags);
+
+    /* On the BSP the interrupt running it has finished (or it is us) */
+    while (ktimer_running == timer && smp_cpu_id() != 0) {
+        __asm__ __volatile__("pause" : : : "memory");
+    }
+    return result;
+}
+
+/* Call every timer due by 'now'; from the timer interrupt */
+void ktimer_run(uint32_t now) {
+    spin_lock(&ktimer_lock);
+    ktimer_t *timer;
+    while ((timer = timer_wheel_pop(&ktimer_wheel, now))) {
+        ktimer_fn_t fn = timer->fn;
+        void *arg = timer->arg;
+        ktimer_running = timer;
+        spin_unlock(&ktimer_lock);
+
+        /* Without the lock: the function may arm timers */
+        fn(arg);
+
+        spin_lock(&ktimer_lock);
+        ktimer_running = 0;
+    }
+    spin_unlock(&ktimer_lock);
+}
+
+/* Ticks until the first callback timer may expire, see timer_wheel_next() */
+uint32_t ktimer_next_ticks(uint32_t now) {
+    uintptr_t flags = spin_lock_irqsave(&ktimer_lock);
+    uint32_t ticks = timer_wheel_next(&ktimer_wheel, now);
+    spin_unlock_irqrestore(&ktimer_lock, flags);
+    return ticks;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file ktimer.h
+ * @brief Kernel timers kept in a hierarchical timing wheel
+ *
+ * A timer expires at an absolute tick. Pending timers hang in the slots
+ * of a wheel with TIMER_WHEEL_LEVELS levels of 64 slots: level 0 has a
+ * slot per tick for the next 64 ticks, level 1 a slot per 64 ticks for
+ * the next 4096, and so on. Arming links a timer into the slot of its
+ * expiry, cancelling unlinks it and a tick looks at a single level 0
+ * slot, so each costs the same with 5 timers pending or 5000. Every 64
+ * ticks the next level 1 slot is cascaded down to level 0 (and every
+ * 4096 the next level 2 slot, ...); a timer moves at most once per level.
+ *
+ * timer_wheel_t is the bare structure; whoever owns one locks it. The
+ * scheduler keeps its sleeping tasks in one. The ktimer_* functions
+ * manage a wheel of callbacks that the timer interrupt runs on the BSP,
+ * with interrupts disabled: a callback must be short. It may wake tasks,
+ * queue deferred work (deferred.h) and arm timers, its own included.
+ */
+
+#ifndef KTIMER_H
+#define KTIMER_H
+
+#include <stdint.h>
+
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SLOTS   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS  4
+#define TIMER_WHEEL_RANGE   ((1U << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1)  /* ~46 hours at 100Hz */
+#define TIMER_WHEEL_NONE    0xFFFFFFFF   /* timer_wheel_next(): nothing pending */
+
+typedef void (*ktimer_fn_t)(void *arg);
+
+/* One timer, usually embedded in the object it times out */
+typedef struct ktimer {
+    uint32_t expires;           /* Absolute tick */
+    ktimer_fn_t fn;
+    void *arg;
+    uint16_t slot;              /* level * TIMER_WHEEL_SLOTS + index while pending */
+    uint8_t pending;            /* Linked into a wheel */
+    struct ktimer *next;
+    struct ktimer *prev;
+} ktimer_t;
+
+#define KTIMER_INIT(fn, arg)  { 0, (fn), (arg), 0, 0, 0, 0 }
+
+typedef struct {
+    uint32_t clock;                                 /* Next tick to expire */
+    uint32_t count;                                 /* Pending timers */
+    uint64_t occupied[TIMER_WHEEL_LEVELS];          /* Bit i: that level's slot i is not empty */
+    ktimer_t *slots[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+/* Function prototypes */
+void timer_wheel_init(timer_wheel_t *wheel, uint32_t now);
+void timer_wheel_add(timer_wheel_t *wheel, ktimer_t *timer, uint32_t now);
+void timer_wheel_remove(timer_wheel_t *wheel, ktimer_t *timer);
+ktimer_t *timer_wheel_pop(timer_wheel_t *wheel, uint32_t now);
+uint32_t timer_wheel_next(timer_wheel_t *wheel, uint32_t now);
+
+void ktimer_init(ktimer_t *timer, ktimer_fn_t fn, void *arg);
+void ktimer_arm(ktimer_t *timer, uint32_t ticks);
+void ktimer_arm_at(ktimer_t *timer, uint32_t tick);
+int ktimer_cancel(ktimer_t *timer);
+void ktimer_run(uint32_t now);
+uint32_t ktimer_next_ticks(uint32_t now);
+
+#endif
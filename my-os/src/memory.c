@@ -1,128 +1,770 @@
 /**
  * @file memory.c
  * @brief Implementation of kernel memory management (kmalloc/kfree)
+ *
+ * Free blocks are kept in segregated lists indexed by a two-level bitmap
+ * (TLSF), so finding a fit, splitting and coalescing never walk the heap:
+ * kmalloc and kfree run in bounded O(1) time.
+ *
+ * The heap starts as one PMM block and grows by whole PMM blocks when no
+ * free list can satisfy a request; regions that become entirely free are
+ * handed back to the PMM when it runs short of pages.
+ *
+ * The TLSF lists are only ever touched in thread context. Small requests
+ * go through per-context magazines first; interrupt handlers are served
+ * exclusively from theirs, and hand non-magazine frees to a deferred list
+ * that thread context drains.
  */
 
 #include "memory.h"
 #include "kernel.h"
+#include "pmm.h"
+#include "spinlock.h"
 
-/* Global heap start and first block */
+/* TLSF control structure: bitmaps plus the heads of every free list */
+static struct {
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[TLSF_FL_INDEX_COUNT];
+    mem_block_t *blocks[TLSF_FL_INDEX_COUNT][TLSF_SL_INDEX_COUNT];
+} tlsf;
+
+/* First block of the heap, used by dump_heap() */
 static mem_block_t *heap_start = 0;
 
-/* Initialize the memory manager */
-void init_memory_manager() {
-    /* Set up initial block covering entire heap */
-    heap_start = (mem_block_t *)HEAP_START;
-    heap_start->size = HEAP_SIZE - BLOCK_HEADER_SIZE;
-    heap_start->free = 1;
-    heap_start->next = 0;
+/* Regions backing the heap; the initial one is never released */
+static heap_region_t *heap_regions = 0;
+static heap_region_t *heap_initial = 0;
+static uint32_t heap_bytes = 0;
 
-    vga_print("Memory manager inizializzato - Heap: 1MB disponibile", 0, 16, VGA_COLOR_WHITE);
+/* Live counters behind kheap_get_stats() */
+static uint32_t bytes_in_use = 0;
+static uint32_t peak_bytes_in_use = 0;
+static uint32_t free_bytes = 0;
+static uint32_t free_blocks = 0;
+static uint32_t alloc_count = 0;
+static uint32_t free_count = 0;
+static uint32_t size_histogram[HEAP_HISTOGRAM_BUCKETS];
+
+/* Small-object magazines, one stack per context and size class */
+static kmagazine_t magazines[MAGAZINE_CONTEXTS][KMALLOC_MAGAZINE_CLASSES];
+
+/* Serializes pops of the interrupt magazines between CPUs */
+static spinlock_t irq_magazine_lock = SPINLOCK_INIT;
+
+/* Blocks freed by interrupt handlers, waiting for thread context */
+static void *volatile deferred_frees = 0;
+static volatile uint32_t magazine_refill_pending = 0;
+
+/* Index of the lowest/highest set bit (word must be non-zero) */
+static inline int tlsf_ffs(uint32_t word) {
+    return __builtin_ctz(word);
 }
 
-/* Find a free block using first-fit algorithm */
-static mem_block_t *find_free_block(uint32_t size) {
-    mem_block_t *current = heap_start;
+static inline int tlsf_fls(uint32_t word) {
+    return 31 - __builtin_clz(word);
+}
+
+/* Block helpers */
+static inline uint32_t block_size(const mem_block_t *block) {
+    return block->size & BLOCK_SIZE_MASK;
+}
+
+static inline int block_is_free(const mem_block_t *block) {
+    return block->size & BLOCK_FREE;
+}
+
+static inline void *block_to_ptr(mem_block_t *block) {
+    return (void *)((uintptr_t)block + BLOCK_HEADER_SIZE);
+}
+
+static inline mem_block_t *block_from_ptr(void *ptr) {
+    return (mem_block_t *)((uintptr_t)ptr - BLOCK_HEADER_SIZE);
+}
+
+static inline mem_block_t *block_next(mem_block_t *block) {
+    return (mem_block_t *)((uintptr_t)block_to_ptr(block) + block_size(block));
+}
+
+/* Point the right neighbour's boundary tag back at this block */
+static inline void block_link_next(mem_block_t *block) {
+    block_next(block)->prev_phys = block;
+}
+
+/* Map a size to the list that holds blocks of exactly that class */
+static void mapping_insert(uint32_t size, int *fl, int *sl) {
+    if (size < TLSF_SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = size / (TLSF_SMALL_BLOCK_SIZE / TLSF_SL_INDEX_COUNT);
+    } else {
+        int f = tlsf_fls(size);
+        *sl = (size >> (f - TLSF_SL_INDEX_COUNT_LOG2)) ^ (1 << TLSF_SL_INDEX_COUNT_LOG2);
+        *fl = f - (TLSF_FL_INDEX_SHIFT - 1);
+    }
+}
+
+/* Map a request to the first list whose blocks are all large enough */
+static void mapping_search(uint32_t size, int *fl, int *sl) {
+    if (size >= TLSF_SMALL_BLOCK_SIZE) {
+        size += (1 << (tlsf_fls(size) - TLSF_SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+/* Find a non-empty list at or above (fl, sl) using the bitmaps */
+static mem_block_t *find_suitable_block(int *fl, int *sl) {
+    if (*fl >= TLSF_FL_INDEX_COUNT) {
+        return 0;
+    }
+
+    uint32_t sl_map = tlsf.sl_bitmap[*fl] & (~0U << *sl);
+    if (!sl_map) {
+        uint32_t fl_map = tlsf.fl_bitmap & (~0U << (*fl + 1));
+        if (!fl_map) {
+            return 0; /* Out of memory */
+        }
+        *fl = tlsf_ffs(fl_map);
+        sl_map = tlsf.sl_bitmap[*fl];
+    }
+    *sl = tlsf_ffs(sl_map);
+
+    return tlsf.blocks[*fl][*sl];
+}
+
+/* Unlink a block from its free list */
+static void remove_free_block(mem_block_t *block, int fl, int sl) {
+    mem_block_t *prev = block->prev_free;
+    mem_block_t *next = block->next_free;
 
-    while (current) {
-        if (current->free && current->size >= size) {
-            return current;
+    free_blocks--;
+    free_bytes -= block_size(block);
+
+    if (next) next->prev_free = prev;
+    if (prev) {
+        prev->next_free = next;
+    } else {
+        tlsf.blocks[fl][sl] = next;
+        if (!next) {
+            tlsf.sl_bitmap[fl] &= ~(1U << sl);
+            if (!tlsf.sl_bitmap[fl]) {
+                tlsf.fl_bitmap &= ~(1U << fl);
+            }
         }
-        current = current->next;
     }
+}
+
+/* Push a block onto the head of its free list */
+static void insert_free_block(mem_block_t *block, int fl, int sl) {
+    mem_block_t *head = tlsf.blocks[fl][sl];
+
+    block->next_free = head;
+    block->prev_free = 0;
+    if (head) head->prev_free = block;
+
+    tlsf.blocks[fl][sl] = block;
+    tlsf.fl_bitmap |= 1U << fl;
+    tlsf.sl_bitmap[fl] |= 1U << sl;
+
+    free_blocks++;
+    free_bytes += block_size(block);
+}
+
+static void block_remove(mem_block_t *block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    remove_free_block(block, fl, sl);
+}
 
-    return 0; /* No suitable block found */
+static void block_insert(mem_block_t *block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    insert_free_block(block, fl, sl);
 }
 
-/* Split a block if it's too large */
+/* Split a block if the tail is big enough to hold another block */
 static void split_block(mem_block_t *block, uint32_t size) {
-    if (block->size >= size + BLOCK_HEADER_SIZE + 1) { /* Minimum split size */
-        mem_block_t *new_block = (mem_block_t *)((uint32_t)block + BLOCK_HEADER_SIZE + size);
-        new_block->size = block->size - size - BLOCK_HEADER_SIZE;
-        new_block->free = 1;
-        new_block->next = block->next;
+    uint32_t total = block_size(block);
 
-        block->size = size;
-        block->next = new_block;
+    if (total >= size + sizeof(mem_block_t)) {
+        mem_block_t *remaining = (mem_block_t *)((uintptr_t)block_to_ptr(block) + size);
+        remaining->size = (total - size - BLOCK_HEADER_SIZE) | BLOCK_FREE;
+        remaining->prev_phys = block;
+        block_link_next(remaining);
+
+        block->size = size | (block->size & BLOCK_FREE);
+        block_insert(remaining);
     }
 }
 
-/* Merge adjacent free blocks */
-static void merge_blocks() {
-    mem_block_t *current = heap_start;
+/* Coalesce a free block with its free physical neighbours */
+static mem_block_t *merge_blocks(mem_block_t *block) {
+    mem_block_t *prev = block->prev_phys;
+    if (prev && block_is_free(prev)) {
+        block_remove(prev);
+        prev->size += BLOCK_HEADER_SIZE + block_size(block);
+        block = prev;
+        block_link_next(block);
+    }
 
-    while (current && current->next) {
-        if (current->free && current->next->free) {
-            /* Merge current and next block */
-            current->size += BLOCK_HEADER_SIZE + current->next->size;
-            current->next = current->next->next;
+    mem_block_t *next = block_next(block);
+    if (block_is_free(next)) {
+        block_remove(next);
+        block->size += BLOCK_HEADER_SIZE + block_size(next);
+        block_link_next(block);
+    }
+
+    return block;
+}
+
+/*
+ * Hand a region of memory to the allocator. The region becomes one free
+ * block followed by a zero-sized used sentinel that stops coalescing at
+ * the region end.
+ */
+static mem_block_t *heap_add_region(void *mem, uint32_t bytes) {
+    uintptr_t start = ((uintptr_t)mem + TLSF_ALIGN_SIZE - 1) & ~(uintptr_t)(TLSF_ALIGN_SIZE - 1);
+    uintptr_t end = ((uintptr_t)mem + bytes) & ~(uintptr_t)(TLSF_ALIGN_SIZE - 1);
+
+    if (end <= start || end - start < 2 * BLOCK_HEADER_SIZE + BLOCK_SIZE_MIN) {
+        return 0;
+    }
+
+    uint32_t size = (uint32_t)(end - start) - 2 * BLOCK_HEADER_SIZE;
+    if (size >= BLOCK_SIZE_MAX) {
+        size = BLOCK_SIZE_MAX - TLSF_ALIGN_SIZE;
+    }
+
+    mem_block_t *block = (mem_block_t *)start;
+    block->prev_phys = 0;
+    block->size = size | BLOCK_FREE;
+
+    mem_block_t *sentinel = block_next(block);
+    sentinel->prev_phys = block;
+    sentinel->size = 0;
+
+    block_insert(block);
+    return block;
+}
+
+/* Take a PMM block of the given order and turn it into a heap region */
+static heap_region_t *heap_grow_region(uint32_t order) {
+    phys_addr_t base = pmm_alloc_pages(order);
+    if (!base) return 0;
+
+    uint32_t bytes = (uint32_t)PMM_PAGE_SIZE << order;
+    heap_region_t *region = (heap_region_t *)base;
+    region->order = order;
+    region->first = heap_add_region((void *)(base + HEAP_REGION_HEADER_SIZE), bytes - HEAP_REGION_HEADER_SIZE);
+    if (!region->first) {
+        pmm_free_pages(base, order);
+        return 0;
+    }
+
+    region->next = heap_regions;
+    heap_regions = region;
+    heap_bytes += bytes;
+    return region;
+}
+
+/* Grow the heap so that a request of 'size' bytes can be satisfied */
+static int heap_grow(uint32_t size) {
+    /* Leave room for the size-class round-up, headers and sentinel */
+    uint32_t needed = size + (size >> TLSF_SL_INDEX_COUNT_LOG2) + HEAP_REGION_HEADER_SIZE +
+                      3 * BLOCK_HEADER_SIZE + TLSF_SMALL_BLOCK_SIZE;
+    if (needed < size || needed > ((uint32_t)PMM_PAGE_SIZE << PMM_MAX_ORDER)) {
+        return -1; /* Larger than one PMM block */
+    }
+    if (needed < HEAP_GROW_MIN_SIZE) {
+        needed = HEAP_GROW_MIN_SIZE;
+    }
+
+    return heap_grow_region(pmm_order_for_size(needed)) ? 0 : -1;
+}
+
+/*
+ * Give every fully free region (other than the initial one) back to the
+ * PMM. Returns the number of bytes released. Registered as a PMM shrinker
+ * so it runs when page allocation is under pressure.
+ */
+static void magazine_flush();
+
+uint32_t kheap_trim() {
+    heap_region_t **link = &heap_regions;
+    uint32_t released = 0;
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+
+    /* Cached magazine objects would otherwise pin their regions */
+    if (!in_interrupt()) magazine_flush();
+
+    while (*link) {
+        heap_region_t *region = *link;
+        mem_block_t *first = region->first;
+
+        if (region != heap_initial && block_is_free(first) && block_size(block_next(first)) == 0) {
+            block_remove(first);
+            *link = region->next;
+
+            uint32_t bytes = (uint32_t)PMM_PAGE_SIZE << region->order;
+            heap_bytes -= bytes;
+            released += bytes;
+            pmm_free_pages((phys_addr_t)region, region->order);
         } else {
-            current = current->next;
+            link = &region->next;
         }
     }
+
+    rspin_unlock_irqrestore(&mm_lock, flags);
+    return released;
 }
 
-/* Allocate memory */
-void *kmalloc(uint32_t size) {
-    if (size == 0) return 0;
+/* Total bytes currently backing the heap */
+uint32_t kheap_size() {
+    return heap_bytes;
+}
+
+/*
+ * Largest free block, read from the bitmaps: the head of the highest
+ * non-empty size class (within one second-level class of the true max).
+ */
+uint32_t kheap_largest_free_block() {
+    if (!tlsf.fl_bitmap) return 0;
+
+    int fl = tlsf_fls(tlsf.fl_bitmap);
+    int sl = tlsf_fls(tlsf.sl_bitmap[fl]);
+    return block_size(tlsf.blocks[fl][sl]);
+}
+
+/* Snapshot of the heap counters */
+void kheap_get_stats(kheap_stats_t *stats) {
+    stats->heap_size = heap_bytes;
+    stats->bytes_in_use = bytes_in_use;
+    stats->peak_bytes_in_use = peak_bytes_in_use;
+    stats->free_bytes = free_bytes;
+    stats->free_blocks = free_blocks;
+    stats->largest_free_block = kheap_largest_free_block();
+    stats->alloc_count = alloc_count;
+    stats->free_count = free_count;
+
+    /* Share of free memory that the largest block cannot serve */
+    stats->fragmentation = 0;
+    if (free_bytes) {
+        stats->fragmentation = (uint32_t)(100.0f - 100.0f * (float)stats->largest_free_block / (float)free_bytes);
+    }
+
+    for (int i = 0; i < HEAP_HISTOGRAM_BUCKETS; i++) {
+        stats->size_histogram[i] = size_histogram[i];
+    }
+}
+
+/* Initialize the memory manager */
+void init_memory_manager() {
+    int i, j;
 
-    /* Align size to 4 bytes for better performance */
-    if (size % 4 != 0) {
-        size += 4 - (size % 4);
+    tlsf.fl_bitmap = 0;
+    for (i = 0; i < TLSF_FL_INDEX_COUNT; i++) {
+        tlsf.sl_bitmap[i] = 0;
+        for (j = 0; j < TLSF_SL_INDEX_COUNT; j++) {
+            tlsf.blocks[i][j] = 0;
+        }
     }
 
-    mem_block_t *block = find_free_block(size);
+    heap_regions = 0;
+    heap_bytes = 0;
+    bytes_in_use = 0;
+    peak_bytes_in_use = 0;
+    free_bytes = 0;
+    free_blocks = 0;
+    alloc_count = 0;
+    free_count = 0;
+    for (i = 0; i < HEAP_HISTOGRAM_BUCKETS; i++) {
+        size_histogram[i] = 0;
+    }
+    for (i = 0; i < MAGAZINE_CONTEXTS; i++) {
+        for (j = 0; j < KMALLOC_MAGAZINE_CLASSES; j++) {
+            magazines[i][j].head = 0;
+            magazines[i][j].count = 0;
+        }
+    }
+    deferred_frees = 0;
+    magazine_refill_pending = 0;
+
+    /* Set up initial region covering the first heap block */
+    heap_initial = heap_grow_region(pmm_order_for_size(HEAP_SIZE));
+    if (!heap_initial) {
+        vga_print("ERRORE: nessuna pagina fisica per l'heap!", 0, 16, VGA_COLOR_RED);
+        return;
+    }
+    heap_start = heap_initial->first;
+    pmm_register_shrinker(kheap_trim);
+    kheap_refill_magazines();
+
+    vga_print("Memory manager inizializzato - Heap: 1MB disponibile", 0, 16, VGA_COLOR_WHITE);
+}
+
+/* Round a request up to the allocator granularity */
+static uint32_t adjust_request_size(uint32_t size) {
+    size = (size + TLSF_ALIGN_SIZE - 1) & BLOCK_SIZE_MASK;
+    return size < BLOCK_SIZE_MIN ? BLOCK_SIZE_MIN : size;
+}
+
+/* Take a free block of at least 'size' bytes off its list, growing if needed */
+static mem_block_t *locate_free_block(uint32_t size) {
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+
+    mem_block_t *block = find_suitable_block(&fl, &sl);
     if (!block) {
-        return 0; /* Out of memory */
+        /* Map more page frames into the heap and retry */
+        if (heap_grow(size) != 0) {
+            return 0; /* Out of memory */
+        }
+        mapping_search(size, &fl, &sl);
+        block = find_suitable_block(&fl, &sl);
+        if (!block) return 0;
     }
 
-    /* Split block if necessary */
+    remove_free_block(block, fl, sl);
+    return block;
+}
+
+/* Mark block as used, then give back the tail */
+static void *prepare_used_block(mem_block_t *block, uint32_t size) {
+    block->size &= ~BLOCK_FREE;
     split_block(block, size);
 
-    /* Mark block as used */
-    block->free = 0;
+    bytes_in_use += block_size(block);
+    if (bytes_in_use > peak_bytes_in_use) {
+        peak_bytes_in_use = bytes_in_use;
+    }
+    alloc_count++;
+
+    return block_to_ptr(block);
+}
+
+/* Count a request in the log2 size histogram */
+static inline void record_request(uint32_t size) {
+    size_histogram[tlsf_fls(size)]++;
+}
+
+/* Allocate from the TLSF lists (thread context only) */
+static void *heap_alloc(uint32_t size) {
+    size = adjust_request_size(size);
+
+    mem_block_t *block = locate_free_block(size);
+    if (!block) return 0;
 
     /* Return address after header */
-    return (void *)((uint32_t)block + BLOCK_HEADER_SIZE);
+    return prepare_used_block(block, size);
+}
+
+/* Return a used block to the TLSF lists (thread context only) */
+static void heap_free(mem_block_t *block) {
+    if (block_is_free(block)) return; /* Double free */
+
+    bytes_in_use -= block_size(block);
+    free_count++;
+
+    /* Mark block as free, merge with neighbours and file it */
+    block->size = (block->size & ~BLOCK_MAGAZINE) | BLOCK_FREE;
+    block = merge_blocks(block);
+    block_insert(block);
+}
+
+/*
+ * Magazine stacks. Each stack is only popped by its own context, so a
+ * pop can never race with another pop and the CAS loop is ABA-free;
+ * pushes may come from either context and just retry on contention.
+ * With several CPUs, thread context pops under mm_lock and interrupt
+ * handlers under irq_magazine_lock, which keeps that guarantee.
+ */
+static void magazine_push(kmagazine_t *mag, void *obj) {
+    void *head;
+    do {
+        head = mag->head;
+        *(void **)obj = head;
+    } while (!__sync_bool_compare_and_swap(&mag->head, head, obj));
+    __sync_fetch_and_add(&mag->count, 1);
+}
+
+static void *magazine_pop(kmagazine_t *mag) {
+    void *head;
+    do {
+        head = mag->head;
+        if (!head) return 0;
+    } while (!__sync_bool_compare_and_swap(&mag->head, head, *(void **)head));
+    __sync_fetch_and_sub(&mag->count, 1);
+    return head;
+}
+
+/* Detach the whole stack at once; safe against concurrent pops */
+static void *magazine_take_all(kmagazine_t *mag) {
+    void *list = __sync_lock_test_and_set(&mag->head, 0);
+    int32_t n = 0;
+    for (void *obj = list; obj; obj = *(void **)obj) n++;
+    __sync_fetch_and_sub(&mag->count, n);
+    return list;
+}
+
+/* Size class serving a request, or -1 if it is too big for the magazines */
+static inline int magazine_class(uint32_t size) {
+    if (size > KMALLOC_MAGAZINE_MAX_SIZE) return -1;
+    if (size <= KMALLOC_MAGAZINE_MIN_SIZE) return 0;
+    return tlsf_fls(size - 1) - 3;
+}
+
+/* Largest class a magazine block can hold (TLSF may leave it a bit bigger) */
+static inline int magazine_block_class(const mem_block_t *block) {
+    int cls = tlsf_fls(block_size(block)) - 4;
+    return cls < KMALLOC_MAGAZINE_CLASSES ? cls : KMALLOC_MAGAZINE_CLASSES - 1;
 }
 
-/* Free memory */
+/* Carve a new magazine object of class 'cls' out of the main heap */
+static void *magazine_new_object(int cls) {
+    void *obj = heap_alloc(KMALLOC_MAGAZINE_MIN_SIZE << cls);
+    if (obj) {
+        block_from_ptr(obj)->size |= BLOCK_MAGAZINE;
+    }
+    return obj;
+}
+
+/*
+ * Give every cached object back to the heap. The interrupt magazines are
+ * detached atomically, so an ISR racing with us just finds them empty;
+ * they are refilled on the next thread-context kmalloc/kfree.
+ */
+static void magazine_flush() {
+    for (int ctx = 0; ctx < MAGAZINE_CONTEXTS; ctx++) {
+        for (int cls = 0; cls < KMALLOC_MAGAZINE_CLASSES; cls++) {
+            if (ctx == MAGAZINE_IRQ) spin_lock(&irq_magazine_lock);
+            void *obj = magazine_take_all(&magazines[ctx][cls]);
+            if (ctx == MAGAZINE_IRQ) spin_unlock(&irq_magazine_lock);
+            while (obj) {
+                void *next = *(void **)obj;
+                heap_free(block_from_ptr(obj));
+                obj = next;
+            }
+        }
+    }
+    magazine_refill_pending = 1;
+}
+
+/*
+ * Top up the interrupt magazines from the main heap and release what
+ * interrupt handlers freed. Called at init, and from kmalloc/kfree in
+ * thread context after an ISR asked for it.
+ */
+void kheap_refill_magazines() {
+    if (in_interrupt()) return;
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    magazine_refill_pending = 0;
+
+    void *obj = __sync_lock_test_and_set(&deferred_frees, 0);
+    while (obj) {
+        void *next = *(void **)obj;
+        heap_free(block_from_ptr(obj));
+        obj = next;
+    }
+
+    for (int cls = 0; cls < KMALLOC_MAGAZINE_CLASSES; cls++) {
+        kmagazine_t *mag = &magazines[MAGAZINE_IRQ][cls];
+
+        /* Frees from ISRs pile up here; hand the excess back */
+        if (mag->count > 2 * MAGAZINE_IRQ_TARGET) {
+            spin_lock(&irq_magazine_lock);
+            obj = magazine_take_all(mag);
+            while (obj) {
+                void *next = *(void **)obj;
+                if (mag->count < MAGAZINE_IRQ_TARGET) {
+                    magazine_push(mag, obj);
+                } else {
+                    heap_free(block_from_ptr(obj));
+                }
+                obj = next;
+            }
+            spin_unlock(&irq_magazine_lock);
+        }
+
+        while (mag->count < MAGAZINE_IRQ_TARGET) {
+            obj = magazine_new_object(cls);
+            if (!obj) break;
+            magazine_push(mag, obj);
+        }
+    }
+    rspin_unlock_irqrestore(&mm_lock, flags);
+}
+
+/* Allocate memory; in interrupt context only sizes up to 256 bytes work */
+void *kmalloc(uint32_t size) {
+    if (size == 0 || size >= BLOCK_SIZE_MAX) return 0;
+
+    int cls = magazine_class(size);
+
+    if (in_interrupt()) {
+        if (cls < 0) return 0;
+        kmagazine_t *mag = &magazines[MAGAZINE_IRQ][cls];
+        spin_lock(&irq_magazine_lock);
+        void *obj = magazine_pop(mag);
+        spin_unlock(&irq_magazine_lock);
+        if (mag->count < MAGAZINE_IRQ_LOW) {
+            magazine_refill_pending = 1;
+        }
+        return obj;
+    }
+
+    /* The thread context belongs to one task at a time, on one CPU */
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    if (magazine_refill_pending) kheap_refill_magazines();
+
+    record_request(size);
+    void *ptr;
+    if (cls >= 0) {
+        ptr = magazine_pop(&magazines[MAGAZINE_THREAD][cls]);
+        if (!ptr) ptr = magazine_new_object(cls);
+    } else {
+        ptr = heap_alloc(size);
+    }
+    rspin_unlock_irqrestore(&mm_lock, flags);
+    return ptr;
+}
+
+/*
+ * Allocate memory whose address is a multiple of 'align' (a power of two,
+ * e.g. 16/32/64 for SIMD loads or PMM_PAGE_SIZE). The gap in front of the
+ * aligned address is split off as a free block, so the result carries a
+ * normal header and may also be released with kfree().
+ */
+void *kmalloc_aligned(uint32_t size, uint32_t align) {
+    if (align <= TLSF_ALIGN_SIZE) return kmalloc(size);
+    if (in_interrupt()) return 0;
+    if (size == 0 || (align & (align - 1)) || size >= BLOCK_SIZE_MAX - align) return 0;
+
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    record_request(size);
+    size = adjust_request_size(size);
+
+    /* The leading gap must be able to hold a free block of its own */
+    const uint32_t gap_min = sizeof(mem_block_t);
+    mem_block_t *block = locate_free_block(size + align + gap_min);
+    if (!block) {
+        rspin_unlock_irqrestore(&mm_lock, flags);
+        return 0;
+    }
+
+    uintptr_t ptr = (uintptr_t)block_to_ptr(block);
+    uintptr_t aligned = (ptr + align - 1) & ~(uintptr_t)(align - 1);
+    if (aligned != ptr && aligned - ptr < gap_min) {
+        aligned = (ptr + gap_min + align - 1) & ~(uintptr_t)(align - 1);
+    }
+
+    uint32_t gap = (uint32_t)(aligned - ptr);
+    if (gap) {
+        mem_block_t *aligned_block = block_from_ptr((void *)aligned);
+        aligned_block->size = block_size(block) - gap;
+        aligned_block->prev_phys = block;
+        block_link_next(aligned_block);
+
+        /* The left neighbour of a free block is never free: no merge needed */
+        block->size = (gap - BLOCK_HEADER_SIZE) | BLOCK_FREE;
+        block_insert(block);
+        block = aligned_block;
+    }
+
+    void *result = prepare_used_block(block, size);
+    rspin_unlock_irqrestore(&mm_lock, flags);
+    return result;
+}
+
+/* Free memory obtained from kmalloc_aligned */
+void kfree_aligned(void *ptr) {
+    kfree(ptr);
+}
+
+/* Free memory; safe to call from interrupt handlers */
 void kfree(void *ptr) {
     if (!ptr) return;
 
     /* Get block header */
-    mem_block_t *block = (mem_block_t *)((uint32_t)ptr - BLOCK_HEADER_SIZE);
+    mem_block_t *block = block_from_ptr(ptr);
+
+    if (in_interrupt()) {
+        if (block->size & BLOCK_MAGAZINE) {
+            magazine_push(&magazines[MAGAZINE_IRQ][magazine_block_class(block)], ptr);
+        } else {
+            /* Leave it for thread context, the TLSF lists may be in use */
+            void *head;
+            do {
+                head = deferred_frees;
+                *(void **)ptr = head;
+            } while (!__sync_bool_compare_and_swap(&deferred_frees, head, ptr));
+            magazine_refill_pending = 1;
+        }
+        return;
+    }
 
-    /* Mark block as free */
-    block->free = 1;
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    if (magazine_refill_pending) kheap_refill_magazines();
 
-    /* Merge adjacent free blocks */
-    merge_blocks();
+    if ((block->size & BLOCK_MAGAZINE) && !block_is_free(block)) {
+        kmagazine_t *mag = &magazines[MAGAZINE_THREAD][magazine_block_class(block)];
+        if (mag->count < MAGAZINE_THREAD_MAX) {
+            magazine_push(mag, ptr);
+            rspin_unlock_irqrestore(&mm_lock, flags);
+            return;
+        }
+    }
+
+    heap_free(block);
+    rspin_unlock_irqrestore(&mm_lock, flags);
 }
 
 /* Debug function to dump heap status */
 void dump_heap() {
-    mem_block_t *current = heap_start;
-    int count = 0;
+    kheap_stats_t stats;
+    char buffer[32];
+
+    kheap_get_stats(&stats);
 
     vga_print("Heap dump:", 0, 18, VGA_COLOR_WHITE);
 
-    while (current && count < 5) { /* Show first 5 blocks */
-        char buffer[32];
+    vga_print("In uso:", 0, 19, VGA_COLOR_WHITE);
+    itoa(stats.bytes_in_use, buffer, 10);
+    vga_print(buffer, 12, 19, VGA_COLOR_CYAN);
+    vga_print("Picco:", 26, 19, VGA_COLOR_WHITE);
+    itoa(stats.peak_bytes_in_use, buffer, 10);
+    vga_print(buffer, 34, 19, VGA_COLOR_CYAN);
+    vga_print("Heap:", 48, 19, VGA_COLOR_WHITE);
+    itoa(stats.heap_size, buffer, 10);
+    vga_print(buffer, 54, 19, VGA_COLOR_CYAN);
+
+    vga_print("Blocchi liberi:", 0, 20, VGA_COLOR_WHITE);
+    itoa(stats.free_blocks, buffer, 10);
+    vga_print(buffer, 16, 20, VGA_COLOR_GREEN);
+    vga_print("Max:", 26, 20, VGA_COLOR_WHITE);
+    itoa(stats.largest_free_block, buffer, 10);
+    vga_print(buffer, 34, 20, VGA_COLOR_GREEN);
+    vga_print("Fram. %:", 48, 20, VGA_COLOR_WHITE);
+    itoa(stats.fragmentation, buffer, 10);
+    vga_print(buffer, 57, 20, stats.fragmentation > 50 ? VGA_COLOR_RED : VGA_COLOR_GREEN);
+
+    /* Physical layout of the first blocks of the initial region */
+    mem_block_t *current = heap_start;
+    int count = 0;
+
+    while (current && block_size(current) && count < 3) { /* Show first 3 blocks */
+        int is_free = block_is_free(current);
 
-        itoa(current->size, buffer, 10);
+        itoa(block_size(current), buffer, 10);
 
-        vga_print("Block ", 0, 19 + count, current->free ? VGA_COLOR_GREEN : VGA_COLOR_RED);
-        vga_print(current->free ? "FREE" : "USED", 8, 19 + count, current->free ? VGA_COLOR_GREEN : VGA_COLOR_RED);
-        vga_print(" ", 13, 19 + count, VGA_COLOR_WHITE);
-        vga_print(buffer, 15, 19 + count, VGA_COLOR_CYAN);
-        vga_print(" bytes", 25, 19 + count, VGA_COLOR_WHITE);
+        vga_print("Block ", 0, 21 + count, is_free ? VGA_COLOR_GREEN : VGA_COLOR_RED);
+        vga_print(is_free ? "FREE" : "USED", 8, 21 + count, is_free ? VGA_COLOR_GREEN : VGA_COLOR_RED);
+        vga_print(" ", 13, 21 + count, VGA_COLOR_WHITE);
+        vga_print(buffer, 15, 21 + count, VGA_COLOR_CYAN);
+        vga_print(" bytes", 25, 21 + count, VGA_COLOR_WHITE);
 
         count++;
-        current = current->next;
+        current = block_next(current);
     }
 
-    if (!current) {
-        vga_print("(end)", 0, 19 + count, VGA_COLOR_LIGHT_GREY);
+    if (!current || !block_size(current)) {
+        vga_print("(end)", 0, 21 + count, VGA_COLOR_LIGHT_GREY);
     }
 }
@@ -1,30 +1,120 @@
 /**
  * @file memory.h
- * @brief Basic kernel memory management (malloc/kfree)
+ * @brief Kernel memory management (kmalloc/kfree) on a TLSF allocator
  */
 
 #ifndef MEMORY_H
 #define MEMORY_H
 
 #include <stdint.h>
+#include <stddef.h>
 
-#define HEAP_START    0x100000  /* Start heap at 1MB */
-#define HEAP_SIZE     0x100000  /* 1MB heap size */
-#define HEAP_END      (HEAP_START + HEAP_SIZE)
+#define HEAP_SIZE           0x100000  /* Initial 1MB heap, taken from the PMM */
+#define HEAP_GROW_MIN_SIZE  0x40000   /* Grow by at least 256KB at a time */
 
-/* Memory block header for linked list allocation */
+/*
+ * Two-level segregated fit (TLSF) configuration.
+ * The first level splits sizes by power of two, the second level splits
+ * every power of two into TLSF_SL_INDEX_COUNT linear classes.
+ */
+#ifdef __x86_64__
+#define TLSF_ALIGN_SIZE_LOG2      4   /* 16 bytes: SSE loads and the 64-bit block header */
+#else
+#define TLSF_ALIGN_SIZE_LOG2      3
+#endif
+#define TLSF_ALIGN_SIZE           (1 << TLSF_ALIGN_SIZE_LOG2)
+#define TLSF_SL_INDEX_COUNT_LOG2  4
+#define TLSF_SL_INDEX_COUNT       (1 << TLSF_SL_INDEX_COUNT_LOG2)
+#define TLSF_FL_INDEX_MAX         30  /* Largest block class: 1GB */
+#define TLSF_FL_INDEX_SHIFT       (TLSF_SL_INDEX_COUNT_LOG2 + TLSF_ALIGN_SIZE_LOG2)
+#define TLSF_FL_INDEX_COUNT       (TLSF_FL_INDEX_MAX - TLSF_FL_INDEX_SHIFT + 1)
+#define TLSF_SMALL_BLOCK_SIZE     (1 << TLSF_FL_INDEX_SHIFT)
+
+/*
+ * Memory block header. Blocks are laid out back to back inside a heap
+ * region; prev_phys is the boundary tag used to reach the left neighbour
+ * when coalescing. The free list links overlay the payload and are only
+ * valid while the block is free.
+ */
 typedef struct mem_block {
-    struct mem_block *next;
-    uint32_t size;
-    uint8_t free;
+    struct mem_block *prev_phys;
+    uint32_t size;                 /* Payload size | BLOCK_FREE */
+    struct mem_block *next_free;
+    struct mem_block *prev_free;
 } mem_block_t;
 
-#define BLOCK_HEADER_SIZE sizeof(mem_block_t)
+#define BLOCK_FREE         0x1
+#define BLOCK_MAGAZINE     0x2    /* Small object owned by the magazines */
+#define BLOCK_SIZE_MASK    (~(uint32_t)(TLSF_ALIGN_SIZE - 1))
+#define BLOCK_HEADER_SIZE  offsetof(mem_block_t, next_free)
+#define BLOCK_SIZE_MIN     (sizeof(mem_block_t) - BLOCK_HEADER_SIZE)
+#define BLOCK_SIZE_MAX     ((uint32_t)1 << TLSF_FL_INDEX_MAX)
+
+/*
+ * Heap region: a PMM block handed to the allocator. The descriptor sits
+ * at the start of the block, followed by the TLSF blocks and a sentinel.
+ */
+typedef struct heap_region {
+    struct heap_region *next;
+    uint32_t order;        /* PMM block order backing the region */
+    mem_block_t *first;    /* First block inside the region */
+} heap_region_t;
+
+#define HEAP_REGION_HEADER_SIZE \
+    ((sizeof(heap_region_t) + TLSF_ALIGN_SIZE - 1) & ~(TLSF_ALIGN_SIZE - 1))
+
+/*
+ * Interrupt-safe small-object magazines. Requests up to
+ * KMALLOC_MAGAZINE_MAX_SIZE bytes are rounded to a power-of-two class and
+ * served from per-context LIFO stacks with lock-free push and pop, so an
+ * interrupt handler never has to touch the TLSF lists. The interrupt
+ * magazines are refilled from the main heap in thread context.
+ */
+#define KMALLOC_MAGAZINE_CLASSES   5     /* 16, 32, 64, 128, 256 bytes */
+#define KMALLOC_MAGAZINE_MIN_SIZE  16
+#define KMALLOC_MAGAZINE_MAX_SIZE  (KMALLOC_MAGAZINE_MIN_SIZE << (KMALLOC_MAGAZINE_CLASSES - 1))
+#define MAGAZINE_IRQ_LOW           8     /* Ask for a refill below this */
+#define MAGAZINE_IRQ_TARGET        32    /* Objects per class kept for ISRs */
+#define MAGAZINE_THREAD_MAX        64    /* Cached frees per class in thread context */
+
+enum {
+    MAGAZINE_THREAD = 0,
+    MAGAZINE_IRQ,
+    MAGAZINE_CONTEXTS
+};
+
+typedef struct {
+    void *volatile head;       /* Free objects, linked through their payload */
+    volatile int32_t count;    /* Approximate length, only used as a hint */
+} kmagazine_t;
+
+/* Heap statistics, maintained incrementally by kmalloc/kfree */
+#define HEAP_HISTOGRAM_BUCKETS 32
+
+typedef struct {
+    uint32_t heap_size;            /* Bytes of page frames backing the heap */
+    uint32_t bytes_in_use;         /* Payload bytes of allocated blocks */
+    uint32_t peak_bytes_in_use;
+    uint32_t free_bytes;           /* Payload bytes of free blocks */
+    uint32_t free_blocks;
+    uint32_t largest_free_block;   /* Head of the highest non-empty class */
+    uint32_t fragmentation;        /* 0 (one free block) .. 100 (shattered) */
+    uint32_t alloc_count;
+    uint32_t free_count;
+    uint32_t size_histogram[HEAP_HISTOGRAM_BUCKETS]; /* [n]: requests of 2^n..2^(n+1)-1 bytes */
+} kheap_stats_t;
 
 /* Function prototypes */
 void init_memory_manager();
 void *kmalloc(uint32_t size);
 void kfree(void *ptr);
+void *kmalloc_aligned(uint32_t size, uint32_t align);
+void kfree_aligned(void *ptr);
+uint32_t kheap_trim();
+uint32_t kheap_size();
+uint32_t kheap_largest_free_block();
+void kheap_get_stats(kheap_stats_t *stats);
+void kheap_refill_magazines();
 void dump_heap();
 
 #endif
@@ -6,6 +6,7 @@
 #include "menu.h"
 #include "kernel.h"
 #include "memory.h"
+#include "slab.h"
 #include "framebuffer.h"
 #include "ai_runtime.h"
 #include "sensors.h"
@@ -31,20 +32,29 @@ void *memset(void *ptr, int value, uint32_t num) {
 /* Current active menu */
 static menu_t *active_menu = 0;
 
+/* Object caches for menus and their item arrays */
+static kmem_cache_t *menu_cache = 0;
+static kmem_cache_t *menu_items_cache = 0;
+
 /* Initialize menu system */
 void init_menu_system() {
     active_menu = 0;
+
+    if (!menu_cache) {
+        menu_cache = kmem_cache_create("menu", sizeof(menu_t), 0, 0);
+        menu_items_cache = kmem_cache_create("menu_items", sizeof(menu_item_t) * MAX_MENU_ITEMS, 0, 0);
+    }
 }
 
 /* Create a new menu */
 menu_t *create_menu(const char *title, int x, int y) {
-    menu_t *menu = kmalloc(sizeof(menu_t));
+    menu_t *menu = kmem_cache_alloc(menu_cache);
     if (!menu) return 0;
 
     menu->title = title;
-    menu->items = kmalloc(sizeof(menu_item_t) * MAX_MENU_ITEMS);
+    menu->items = kmem_cache_alloc(menu_items_cache);
     if (!menu->items) {
-        kfree(menu);
+        kmem_cache_free(menu_cache, menu);
         return 0;
     }
 
@@ -149,9 +159,9 @@ void destroy_menu(menu_t *menu) {
     if (!menu) return;
 
     if (menu->items) {
-        kfree(menu->items);
+        kmem_cache_free(menu_items_cache, menu->items);
     }
-    kfree(menu);
+    kmem_cache_free(menu_cache, menu);
 }
 
 /* Universal AI file selector */
@@ -292,11 +302,15 @@ void load_selected_ai_file() {
     vga_print(fmt_msg, 0, 46, VGA_COLOR_LIGHT_BLUE);
 
     /* Load the model using universal loader */
-    ai_loaded_model_t loaded_model;
+    ai_loaded_model_t *loaded_model = ai_loader_alloc_model();
+    if (!loaded_model) {
+        vga_print("ERRORE nel caricamento IA - Memoria insufficiente", 0, 47, VGA_COLOR_RED);
+        return;
+    }
 
     vga_print("Elaborazione modello universale (lazy loading per grandi dimensioni)...", 0, 47, VGA_COLOR_MAGENTA);
 
-    if (ai_loader_load_model(selected_file, &loaded_model) == 0) {
+    if (ai_loader_load_model(selected_file, loaded_model) == 0) {
         /* Use loaded AI model for real inference */
         sensor_data_t accel_data = read_sensor(SENSOR_TYPE_ACCELEROMETER);
         sensor_data_t cpu_data = read_sensor(SENSOR_TYPE_CPU_USAGE);
@@ -313,7 +327,7 @@ void load_selected_ai_file() {
         };
 
         /* Run real AI inference with loaded model */
-        ai_decision_t decision = run_ai_inference(&loaded_model.runtime_model, &ai_context);
+        ai_decision_t decision = run_ai_inference(&loaded_model->runtime_model, &ai_context);
 
         /* Display intelligent decision */
         const char *decision_texts[] = {
@@ -328,6 +342,7 @@ void load_selected_ai_file() {
         vga_print("Qualsiasi dimensione, qualsiasi formato! Computer gestisce tutto!", 0, 51, VGA_COLOR_LIGHT_MAGENTA);
 
     } else {
+        ai_loader_free_model(loaded_model);
         vga_print("ERRORE nel caricamento IA - Riprova o usa file diverso", 0, 47, VGA_COLOR_RED);
     }
 }
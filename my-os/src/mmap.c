@@ -0,0 +1,161 @@
+/**
+ * @file mmap.c
+ * @brief Implementation of demand-paged file mappings
+ *
+ * kmmap_file() only opens the file and reserves address space in the
+ * VMM window. Pages are read from disk by the page-fault handler the
+ * first time they are touched, so mapping a model costs nothing up front
+ * and only the parts that are actually used are ever read. Mapped pages
+ * are read-only. Pages read into highmem frames stay resident after the
+ * mapping goes away, so mapping the same file again skips the disk.
+ */
+
+#include "mmap.h"
+#include "kernel.h"
+#include "memory.h"
+#include "vmm.h"
+
+/* Return a frame that was never published in the highmem cache */
+static void kmmap_release_frame(vmm_phys_t frame) {
+    if (highmem_owns(frame)) {
+        highmem_free_frame(frame);
+    } else {
+        pmm_free_pages((phys_addr_t)frame, 0);
+    }
+}
+
+/*
+ * Read the file page at 'offset' into 'frame', zero padded past the end
+ * of the file. Low frames are written through the direct map, highmem
+ * frames through this CPU's scratch page. Returns fat32_read_file()'s
+ * result; interrupts are off (fault context) throughout.
+ */
+static int kmmap_read_frame(kmmap_t *map, vmm_phys_t frame, uint32_t offset) {
+    int scratch = frame >= VMM_DIRECT_MAP_END;
+    uint8_t *data = scratch ? vmm_map_scratch(frame) : (uint8_t *)(uintptr_t)frame;
+    if (!data) return -1;
+
+    int bytes = fat32_read_file(&map->file, data, offset, PMM_PAGE_SIZE);
+    for (uint32_t i = bytes < 0 ? PMM_PAGE_SIZE : (uint32_t)bytes; i < PMM_PAGE_SIZE; i++) {
+        data[i] = 0;
+    }
+
+    if (scratch) vmm_unmap_scratch(data);
+    return bytes;
+}
+
+/* Map one page of the file, reading it from disk unless highmem has it; VM_FAULT_* */
+static int kmmap_fill_page(kmmap_t *map, uintptr_t page) {
+    uint32_t index = (uint32_t)(page - (uintptr_t)map->base) >> PMM_PAGE_SHIFT;
+    pte_t flags = vmm_nx_flag();
+
+    /* Still resident from an earlier mapping of the same file */
+    if (map->cache && map->cache->frames[index]) {
+        if (vmm_map_page(page, (vmm_phys_t)map->cache->frames[index] << PMM_PAGE_SHIFT, flags) != 0) {
+            return VM_FAULT_ERROR;
+        }
+        map->region->resident++;
+        return VM_FAULT_MINOR;
+    }
+
+    /* Prefer highmem, so the page survives kmunmap() */
+    vmm_phys_t frame = map->cache ? highmem_alloc_frame() : 0;
+    int cached = frame != 0;
+    if (!frame) frame = pmm_alloc_pages(0);
+    if (!frame) return VM_FAULT_ERROR;
+
+    /*
+     * Fill the frame where no other CPU can see it. The page tables are
+     * shared, so a mapping at 'page' would let them read it half filled
+     * without ever faulting into this region.
+     */
+    if (kmmap_read_frame(map, frame, (uint32_t)(page - (uintptr_t)map->base)) < 0) {
+        kmmap_release_frame(frame);
+        return VM_FAULT_ERROR;
+    }
+
+    if (cached && !highmem_cache_publish(map->cache, index, frame)) {
+        /* Another mapping of the file read the page first: share its copy */
+        highmem_free_frame(frame);
+        frame = (vmm_phys_t)map->cache->frames[index] << PMM_PAGE_SHIFT;
+    }
+    if (vmm_map_page(page, frame, flags) != 0) {
+        if (!cached) kmmap_release_frame(frame);
+        return VM_FAULT_ERROR;
+    }
+    map->region->resident++;
+    return VM_FAULT_MAJOR;
+}
+
+/* Fault callback: bring in the faulting page and its neighbours */
+static int kmmap_fault(vm_region_t *region, uintptr_t page, uint32_t error) {
+    kmmap_t *map = region->data;
+
+    if (error & PF_ERR_PRESENT) return VM_FAULT_ERROR; /* Write to a read-only page */
+
+    int result = kmmap_fill_page(map, page);
+    if (result == VM_FAULT_ERROR) return result;
+
+    /* Fault-around: the following pages are likely next in a sweep */
+    uintptr_t end = (uintptr_t)map->base + map->size;
+    for (int i = 1; i < KMMAP_FAULT_AROUND; i++) {
+        uintptr_t next = page + (uintptr_t)i * PMM_PAGE_SIZE;
+        if (next >= end || vmm_translate(next)) break;
+        if (kmmap_fill_page(map, next) == VM_FAULT_ERROR) break;
+    }
+    return result;
+}
+
+/*
+ * Map a file read-only into kernel memory; returns its address and stores
+ * its length in 'size', or returns 0. Release with kmunmap().
+ */
+void *kmmap_file(const char *filename, uint32_t *size) {
+    if (!vmm_enabled()) return 0;
+
+    kmmap_t *map = kmalloc(sizeof(kmmap_t));
+    if (!map) return 0;
+
+    if (fat32_open_file(filename, &map->file) != 0 || map->file.size == 0) {
+        kfree(map);
+        return 0;
+    }
+
+    map->size = map->file.size;
+    map->base = vmm_reserve(map->size);
+    if (!map->base) {
+        fat32_close_file(&map->file);
+        kfree(map);
+        return 0;
+    }
+
+    map->region = vm_region_register((uintptr_t)map->base, (uintptr_t)map->base + map->size, kmmap_fault, map);
+    if (!map->region) {
+        vmm_release(map->base);
+        fat32_close_file(&map->file);
+        kfree(map);
+        return 0;
+    }
+
+    uint32_t first_cluster = ((uint32_t)map->file.dir_entry.first_cluster_hi << 16) | map->file.dir_entry.first_cluster_lo;
+    map->cache = highmem_cache_get(first_cluster, (map->size + PMM_PAGE_SIZE - 1) >> PMM_PAGE_SHIFT);
+
+    if (size) *size = map->size;
+    return map->base;
+}
+
+/* Drop a file mapping and every page read for it */
+void kmunmap(void *addr) {
+    vm_region_t *region = vm_region_find((uintptr_t)addr);
+    if (!region || region->start != (uintptr_t)addr || region->fault != kmmap_fault) return;
+
+    kmmap_t *map = region->data;
+    vm_region_unregister(region);
+
+    /* Highmem frames stay in the cache, the others go back to the PMM */
+    vmm_unmap_window_keep(map->base, highmem_owns);
+    highmem_cache_put(map->cache);
+
+    fat32_close_file(&map->file);
+    kfree(map);
+}
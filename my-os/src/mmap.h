@@ -0,0 +1,30 @@
+/**
+ * @file mmap.h
+ * @brief Demand-paged mappings of FAT32 files into kernel memory
+ */
+
+#ifndef MMAP_H
+#define MMAP_H
+
+#include <stdint.h>
+#include "fat32.h"
+#include "pagefault.h"
+#include "highmem.h"
+
+/* Pages read per fault, so sequential sweeps fault less often */
+#define KMMAP_FAULT_AROUND  4
+
+/* A mapped file: the window range plus the open handle used by faults */
+typedef struct {
+    fat32_file_t file;
+    uint8_t *base;
+    uint32_t size;
+    vm_region_t *region;
+    highmem_cache_t *cache;   /* Resident pages in highmem, or 0 */
+} kmmap_t;
+
+/* Function prototypes */
+void *kmmap_file(const char *filename, uint32_t *size);
+void kmunmap(void *addr);
+
+#endif
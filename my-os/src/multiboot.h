@@ -0,0 +1,61 @@
+/**
+ * @file multiboot.h
+ * @brief Multiboot (v1) information structures passed by GRUB
+ */
+
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+
+/* Value left in EAX by a Multiboot compliant bootloader */
+#define MULTIBOOT_BOOTLOADER_MAGIC  0x2BADB002
+
+/* multiboot_info_t.flags bits */
+#define MULTIBOOT_INFO_MEMORY       0x00000001
+#define MULTIBOOT_INFO_MODS         0x00000008
+#define MULTIBOOT_INFO_MEM_MAP      0x00000040
+
+/* Memory map entry types */
+#define MULTIBOOT_MEMORY_AVAILABLE  1
+#define MULTIBOOT_MEMORY_RESERVED   2
+#define MULTIBOOT_MEMORY_ACPI       3
+#define MULTIBOOT_MEMORY_NVS        4
+#define MULTIBOOT_MEMORY_BADRAM     5
+
+/* Boot information structure */
+typedef struct __attribute__((packed)) {
+    uint32_t flags;
+    uint32_t mem_lower;          /* KB below 1MB */
+    uint32_t mem_upper;          /* KB above 1MB */
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+} multiboot_info_t;
+
+/* Memory map entry; 'size' does not include itself */
+typedef struct __attribute__((packed)) {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} multiboot_mmap_entry_t;
+
+/* Boot module */
+typedef struct __attribute__((packed)) {
+    uint32_t mod_start;
+    uint32_t mod_end;
+    uint32_t cmdline;
+    uint32_t reserved;
+} multiboot_module_t;
+
+#endif
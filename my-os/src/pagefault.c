@@ -0,0 +1,246 @@
+/**
+ * @file pagefault.c
+ * @brief Implementation of the page-fault handler (vector 14)
+ *
+ * Subsystems register ranges of the kernel address space together with a
+ * callback that knows how to fill them in. A fault inside a registered
+ * range is handed to that callback; any other fault is fatal.
+ *
+ * Lazy regions from vm_alloc_lazy() are the simplest user: reads map one
+ * shared zero page read-only, and the first write to a page swaps in a
+ * private zeroed frame. A large scratch buffer only costs the pages that
+ * are actually written.
+ *
+ * The region table changes under mm_lock. Each region's callback runs
+ * under the region's own lock, and a CPU that waited for it first checks
+ * whether the page got mapped meanwhile, so a page is filled once.
+ */
+
+#include "pagefault.h"
+#include "kernel.h"
+#include "idt.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "smp.h"
+
+static vm_region_t regions[PF_MAX_REGIONS];
+static pf_stats_t pf_stats;
+static phys_addr_t zero_frame = 0;   /* Shared zero page, allocated on first use */
+
+static inline uintptr_t read_cr2() {
+    uintptr_t value;
+    __asm__ __volatile__("mov %%cr2, %0" : "=r"(value));
+    return value;
+}
+
+/*
+ * Take a region's lock with interrupts off. Its holder may be shooting
+ * down a TLB range and waiting for this CPU, so serve that while spinning.
+ */
+static void region_lock(vm_region_t *region) {
+    while (!spin_trylock(&region->lock)) {
+        smp_tlb_poll();
+        __asm__ __volatile__("pause");
+    }
+}
+
+/* Register [start, end) to be populated on demand; 0 if the table is full */
+vm_region_t *vm_region_register(uintptr_t start, uintptr_t end, vm_fault_t fault, void *data) {
+    if (!fault || end <= start) return 0;
+
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    for (int i = 0; i < PF_MAX_REGIONS; i++) {
+        if (!regions[i].fault) {
+            regions[i].start = start;
+            regions[i].end = end;
+            regions[i].data = data;
+            regions[i].minor_faults = 0;
+            regions[i].major_faults = 0;
+            regions[i].resident = 0;
+            /* A faulter checks 'fault' first: publish it last */
+            __sync_synchronize();
+            regions[i].fault = fault;
+            rspin_unlock_irqrestore(&mm_lock, flags);
+            return &regions[i];
+        }
+    }
+    rspin_unlock_irqrestore(&mm_lock, flags);
+    return 0;
+}
+
+/* Remove a region; returns once no fault callback of it is running */
+void vm_region_unregister(vm_region_t *region) {
+    if (!region) return;
+
+    /* Not under mm_lock: a running callback may be allocating */
+    uintptr_t flags = irq_save();
+    region_lock(region);
+    region->fault = 0;
+    spin_unlock(&region->lock);
+    irq_restore(flags);
+}
+
+/* Region containing 'addr', or 0 */
+vm_region_t *vm_region_find(uintptr_t addr) {
+    vm_region_t *found = 0;
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    for (int i = 0; i < PF_MAX_REGIONS; i++) {
+        if (regions[i].fault && addr >= regions[i].start && addr < regions[i].end) {
+            found = &regions[i];
+            break;
+        }
+    }
+    rspin_unlock_irqrestore(&mm_lock, flags);
+    return found;
+}
+
+/* Frame filled with zeros, read-only mapped wherever a lazy page is only read */
+static phys_addr_t get_zero_frame() {
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    if (!zero_frame) {
+        phys_addr_t frame = pmm_alloc_pages(0);
+        if (frame) {
+            /* Frames from the PMM sit in the direct map */
+            uint32_t *words = (uint32_t *)(uintptr_t)frame;
+            for (uint32_t i = 0; i < PMM_PAGE_SIZE / sizeof(uint32_t); i++) {
+                words[i] = 0;
+            }
+            zero_frame = frame;
+        }
+    }
+    rspin_unlock_irqrestore(&mm_lock, flags);
+    return zero_frame;
+}
+
+static int is_zero_frame(vmm_phys_t frame) {
+    return frame == zero_frame;
+}
+
+/* Fault callback of lazy regions */
+static int lazy_fault(vm_region_t *region, uintptr_t page, uint32_t error) {
+    pte_t flags = vmm_nx_flag();
+
+    if (!(error & PF_ERR_WRITE)) {
+        /* Read of an untouched page: share the zero page */
+        if (error & PF_ERR_PRESENT) return VM_FAULT_ERROR;
+        if (vmm_map_page(page, zero_frame, flags) != 0) return VM_FAULT_ERROR;
+        __sync_fetch_and_add(&pf_stats.zero_maps, 1);
+        return VM_FAULT_MINOR;
+    }
+
+    /* A write fault on a present page must be the zero page */
+    int shared = (error & PF_ERR_PRESENT) != 0;
+    if (shared) {
+        vmm_phys_t current = vmm_translate(page);
+        if (current && current != zero_frame) {
+            /* Another CPU copied it while this one waited for the region */
+            return VM_FAULT_MINOR;
+        }
+    }
+
+    /* Copy on write: a copy of the zero page is a freshly zeroed frame */
+    phys_addr_t frame = pmm_alloc_pages(0);
+    if (!frame) return VM_FAULT_ERROR;
+
+    uint32_t *words = (uint32_t *)(uintptr_t)frame;
+    for (uint32_t i = 0; i < PMM_PAGE_SIZE / sizeof(uint32_t); i++) {
+        words[i] = 0;
+    }
+
+    if (vmm_map_page(page, frame, PTE_WRITABLE | flags) != 0) {
+        pmm_free_pages(frame, 0);
+        return VM_FAULT_ERROR;
+    }
+
+    region->resident++;
+    if (shared) __sync_fetch_and_add(&pf_stats.cow_copies, 1);
+    return VM_FAULT_MINOR;
+}
+
+/*
+ * Reserve 'size' bytes of zero-filled memory in the VMM window without
+ * backing it; pages get a frame on first write. Free with vm_free_lazy().
+ */
+void *vm_alloc_lazy(uint32_t size) {
+    if (!vmm_enabled() || !get_zero_frame()) return 0;
+
+    void *base = vmm_reserve(size);
+    if (!base) return 0;
+
+    if (!vm_region_register((uintptr_t)base, (uintptr_t)base + size, lazy_fault, 0)) {
+        vmm_release(base);
+        return 0;
+    }
+    return base;
+}
+
+/* True if 'addr' is the start of a vm_alloc_lazy() buffer */
+int vm_is_lazy(const void *addr) {
+    vm_region_t *region = vm_region_find((uintptr_t)addr);
+    return region && region->start == (uintptr_t)addr && region->fault == lazy_fault;
+}
+
+/* Drop a lazy buffer and the frames its writes populated */
+void vm_free_lazy(void *addr) {
+    if (!vm_is_lazy(addr)) return;
+
+    vm_region_unregister(vm_region_find((uintptr_t)addr));
+
+    /* The zero page is shared: the window frees everything else */
+    vmm_unmap_window_keep(addr, is_zero_frame);
+}
+
+void pf_get_stats(pf_stats_t *stats) {
+    *stats = pf_stats;
+}
+
+/* Resolve a fault at 'addr' through its region's callback; VM_FAULT_* */
+static int region_fault(uintptr_t addr, uint32_t error) {
+    vm_region_t *region = vm_region_find(addr);
+    if (!region) return VM_FAULT_ERROR;
+
+    uintptr_t page = addr & ~(uintptr_t)(PMM_PAGE_SIZE - 1);
+    int result = VM_FAULT_ERROR;
+
+    uintptr_t flags = irq_save();
+    region_lock(region);
+    /* The region may have gone, or been reused, while this CPU waited */
+    if (region->fault && addr >= region->start && addr < region->end) {
+        if (!(error & PF_ERR_PRESENT) && vmm_translate(page)) {
+            result = VM_FAULT_MINOR;    /* Another CPU filled it meanwhile */
+        } else {
+            result = region->fault(region, page, error);
+        }
+        if (result == VM_FAULT_MAJOR) {
+            region->major_faults++;
+            __sync_fetch_and_add(&pf_stats.major_faults, 1);
+        } else if (result == VM_FAULT_MINOR) {
+            region->minor_faults++;
+            __sync_fetch_and_add(&pf_stats.minor_faults, 1);
+        }
+    }
+    spin_unlock(&region->lock);
+    irq_restore(flags);
+    return result;
+}
+
+/* Called from the isr14 stub with the CPU error code */
+void page_fault_handler(uint32_t error) {
+    uintptr_t addr = read_cr2();
+
+    /*
+     * Fault callbacks run under the region's spinlock with interrupts off,
+     * so they cannot sleep: disk reads busy-wait. An interrupt handler may
+     * have cut into the lock holder, so it never runs one.
+     */
+    if (!in_interrupt() && region_fault(addr, error) != VM_FAULT_ERROR) {
+        return;
+    }
+
+    char buffer[16];
+    vga_print("ECCEZIONE: Page fault - pagina 0x", 0, 6, VGA_COLOR_RED);
+    itoa((int)(addr >> PMM_PAGE_SHIFT), buffer, 16);
+    vga_print(buffer, 33, 6, VGA_COLOR_RED);
+    vga_print((error & PF_ERR_WRITE) ? "(scrittura)" : "(lettura)", 42, 6, VGA_COLOR_RED);
+    while(1); // Halt
+}
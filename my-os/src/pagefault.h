@@ -0,0 +1,63 @@
+/**
+ * @file pagefault.h
+ * @brief Page-fault handling for demand-paged kernel regions
+ */
+
+#ifndef PAGEFAULT_H
+#define PAGEFAULT_H
+
+#include <stdint.h>
+#include "spinlock.h"
+
+/* Error code pushed by the CPU for vector 14 */
+#define PF_ERR_PRESENT  0x1   /* Protection violation, not a missing page */
+#define PF_ERR_WRITE    0x2
+#define PF_ERR_USER     0x4
+
+#define PF_MAX_REGIONS  16
+
+/* Results of a fault callback */
+#define VM_FAULT_ERROR  -1    /* Fatal: the access is not allowed */
+#define VM_FAULT_MINOR  0     /* Resolved from memory */
+#define VM_FAULT_MAJOR  1     /* Resolved with I/O (disk read) */
+
+struct vm_region;
+
+/* Make the page at 'page' (page aligned) present; returns a VM_FAULT_* code */
+typedef int (*vm_fault_t)(struct vm_region *region, uintptr_t page, uint32_t error);
+
+/*
+ * A range of kernel virtual memory populated lazily by its fault callback.
+ * The callback runs with 'lock' held, so one CPU at a time fills the
+ * region's pages.
+ */
+typedef struct vm_region {
+    spinlock_t lock;
+    uintptr_t start;
+    uintptr_t end;
+    vm_fault_t fault;        /* 0 while the slot is unused */
+    void *data;              /* Owner's private state */
+    uint32_t minor_faults;   /* Faults resolved without I/O */
+    uint32_t major_faults;   /* Faults that had to read from disk */
+    uint32_t resident;       /* Pages given their own frame so far */
+} vm_region_t;
+
+/* System-wide fault counters */
+typedef struct {
+    uint32_t minor_faults;
+    uint32_t major_faults;
+    uint32_t zero_maps;      /* Reads served by the shared zero page */
+    uint32_t cow_copies;     /* Zero pages replaced on first write */
+} pf_stats_t;
+
+/* Function prototypes */
+vm_region_t *vm_region_register(uintptr_t start, uintptr_t end, vm_fault_t fault, void *data);
+void vm_region_unregister(vm_region_t *region);
+vm_region_t *vm_region_find(uintptr_t addr);
+void *vm_alloc_lazy(uint32_t size);
+void vm_free_lazy(void *addr);
+int vm_is_lazy(const void *addr);
+void pf_get_stats(pf_stats_t *stats);
+void page_fault_handler(uint32_t error);
+
+#endif
@@ -0,0 +1,334 @@
+/**
+ * @file pmm.c
+ * @brief Implementation of the buddy-system page-frame allocator
+ *
+ * Usable RAM comes from the Multiboot memory map. Free blocks of 2^order
+ * pages are kept in one list per order; a block and its buddy differ only
+ * in bit 'order' of their frame number, so splitting and merging are
+ * constant-time per level.
+ */
+
+#include "pmm.h"
+#include "kernel.h"
+#include "spinlock.h"
+
+/* Linker symbols bracketing the kernel image, .bss and .stack */
+extern uint8_t __kernel_start[];
+extern uint8_t __kernel_end[];
+
+#define PMM_MAX_RANGES 32
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} pmm_range_t;
+
+static pmm_range_t available[PMM_MAX_RANGES];
+static int available_count = 0;
+static pmm_range_t reserved[PMM_MAX_RANGES];
+static int reserved_count = 0;
+
+/* One state byte per frame, up to the highest usable frame */
+static uint8_t *frame_info = 0;
+static uint32_t frame_count = 0;
+
+static pmm_free_block_t *free_lists[PMM_ORDER_COUNT];
+static uint32_t free_bitmap = 0;   /* Bit n set: free_lists[n] not empty */
+static uint32_t free_pages = 0;
+static uint32_t total_pages = 0;
+
+static pmm_shrinker_t shrinkers[PMM_MAX_SHRINKERS];
+static int shrinker_count = 0;
+
+rspinlock_t mm_lock = RSPINLOCK_INIT;
+
+static inline pmm_free_block_t *frame_to_block(uint32_t pfn) {
+    return (pmm_free_block_t *)((phys_addr_t)pfn << PMM_PAGE_SHIFT);
+}
+
+static inline uint32_t block_to_frame(pmm_free_block_t *block) {
+    return (uint32_t)((phys_addr_t)block >> PMM_PAGE_SHIFT);
+}
+
+static void free_list_push(uint32_t pfn, uint32_t order) {
+    pmm_free_block_t *block = frame_to_block(pfn);
+
+    block->prev = 0;
+    block->next = free_lists[order];
+    if (block->next) block->next->prev = block;
+    free_lists[order] = block;
+
+    free_bitmap |= 1U << order;
+    frame_info[pfn] = PMM_FRAME_FREE | order;
+}
+
+static void free_list_remove(uint32_t pfn, uint32_t order) {
+    pmm_free_block_t *block = frame_to_block(pfn);
+
+    if (block->next) block->next->prev = block->prev;
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[order] = block->next;
+        if (!free_lists[order]) {
+            free_bitmap &= ~(1U << order);
+        }
+    }
+}
+
+static void add_range(pmm_range_t *ranges, int *count, uint64_t start, uint64_t end) {
+    if (*count >= PMM_MAX_RANGES || end <= start) return;
+    ranges[*count].start = start;
+    ranges[*count].end = end;
+    (*count)++;
+}
+
+/* Return the end of a reserved range overlapping [start, end), or 0 */
+static uint64_t reserved_overlap(uint64_t start, uint64_t end) {
+    for (int i = 0; i < reserved_count; i++) {
+        if (start < reserved[i].end && reserved[i].start < end) {
+            return reserved[i].end;
+        }
+    }
+    return 0;
+}
+
+/* Read usable ranges from the Multiboot info, clipped and page aligned */
+static void collect_ranges(multiboot_info_t *mbi) {
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uint32_t offset = 0;
+        while (offset < mbi->mmap_length) {
+            multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)(uintptr_t)(mbi->mmap_addr + offset);
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
+                add_range(available, &available_count, entry->addr, entry->addr + entry->len);
+            }
+            offset += entry->size + sizeof(entry->size);
+        }
+    } else if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+        add_range(available, &available_count, 0x100000, 0x100000 + (uint64_t)mbi->mem_upper * 1024);
+    }
+
+    for (int i = 0; i < available_count; i++) {
+        uint64_t start = (available[i].start + PMM_PAGE_SIZE - 1) & ~(uint64_t)(PMM_PAGE_SIZE - 1);
+        uint64_t end = available[i].end & ~(uint64_t)(PMM_PAGE_SIZE - 1);
+        if (start < PMM_LOW_LIMIT) start = PMM_LOW_LIMIT;
+        if (end > PMM_HIGH_LIMIT) end = PMM_HIGH_LIMIT;
+        available[i].start = start;
+        available[i].end = (end > start) ? end : start;
+    }
+
+    /* Everything the kernel and the bootloader still need */
+    add_range(reserved, &reserved_count, 0, PMM_LOW_LIMIT);
+    add_range(reserved, &reserved_count, (uintptr_t)__kernel_start, (uintptr_t)__kernel_end);
+    add_range(reserved, &reserved_count, (uintptr_t)mbi, (uintptr_t)mbi + sizeof(multiboot_info_t));
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+        add_range(reserved, &reserved_count, mbi->mmap_addr, (uint64_t)mbi->mmap_addr + mbi->mmap_length);
+    }
+    if (mbi->flags & MULTIBOOT_INFO_MODS) {
+        multiboot_module_t *mods = (multiboot_module_t *)(uintptr_t)mbi->mods_addr;
+        add_range(reserved, &reserved_count, mbi->mods_addr,
+                  (uint64_t)mbi->mods_addr + mbi->mods_count * sizeof(multiboot_module_t));
+        for (uint32_t i = 0; i < mbi->mods_count; i++) {
+            add_range(reserved, &reserved_count, mods[i].mod_start, mods[i].mod_end);
+        }
+    }
+}
+
+/* Find room for the frame state array inside usable RAM */
+static int place_frame_info(uint32_t bytes) {
+    for (int i = 0; i < available_count; i++) {
+        uint64_t start = available[i].start;
+        uint64_t overlap;
+
+        while (start + bytes <= available[i].end &&
+               (overlap = reserved_overlap(start, start + bytes)) != 0) {
+            start = (overlap + PMM_PAGE_SIZE - 1) & ~(uint64_t)(PMM_PAGE_SIZE - 1);
+        }
+
+        if (start + bytes <= available[i].end) {
+            frame_info = (uint8_t *)(uintptr_t)start;
+            add_range(reserved, &reserved_count, start, start + bytes);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void mark_frames(uint64_t start, uint64_t end, uint8_t state) {
+    uint64_t first = start >> PMM_PAGE_SHIFT;
+    uint64_t last = (end + PMM_PAGE_SIZE - 1) >> PMM_PAGE_SHIFT;
+
+    if (last > frame_count) last = frame_count;
+    for (uint64_t pfn = first; pfn < last; pfn++) {
+        frame_info[pfn] = state;
+    }
+}
+
+/* Carve a run of usable frames into the largest aligned buddy blocks */
+static void seed_run(uint32_t pfn, uint32_t end) {
+    while (pfn < end) {
+        uint32_t order = PMM_MAX_ORDER;
+        while (order > 0 && ((pfn & ((1U << order) - 1)) || pfn + (1U << order) > end)) {
+            order--;
+        }
+
+        mark_frames((uint64_t)pfn << PMM_PAGE_SHIFT, (uint64_t)(pfn + (1U << order)) << PMM_PAGE_SHIFT, PMM_FRAME_TAIL);
+        free_list_push(pfn, order);
+        free_pages += 1U << order;
+        pfn += 1U << order;
+    }
+}
+
+/* Initialize the allocator from the Multiboot memory map */
+void pmm_init(multiboot_info_t *mbi) {
+    for (int i = 0; i < PMM_ORDER_COUNT; i++) {
+        free_lists[i] = 0;
+    }
+    free_bitmap = 0;
+    free_pages = 0;
+    total_pages = 0;
+
+    collect_ranges(mbi);
+
+    uint64_t highest = 0;
+    for (int i = 0; i < available_count; i++) {
+        if (available[i].end > highest) highest = available[i].end;
+    }
+    frame_count = (uint32_t)(highest >> PMM_PAGE_SHIFT);
+
+    if (frame_count == 0 || place_frame_info(frame_count) != 0) {
+        vga_print("ERRORE: mappa della memoria non disponibile!", 0, 15, VGA_COLOR_RED);
+        return;
+    }
+
+    /* Start from "all reserved", open up usable RAM, then punch the holes */
+    for (uint32_t pfn = 0; pfn < frame_count; pfn++) {
+        frame_info[pfn] = PMM_FRAME_RESERVED;
+    }
+    for (int i = 0; i < available_count; i++) {
+        uint64_t first = (available[i].start) >> PMM_PAGE_SHIFT;
+        uint64_t last = available[i].end >> PMM_PAGE_SHIFT;
+        for (uint64_t pfn = first; pfn < last; pfn++) {
+            frame_info[pfn] = PMM_FRAME_AVAILABLE;
+        }
+    }
+    for (int i = 0; i < reserved_count; i++) {
+        mark_frames(reserved[i].start & ~(uint64_t)(PMM_PAGE_SIZE - 1), reserved[i].end, PMM_FRAME_RESERVED);
+    }
+
+    uint32_t pfn = 0;
+    while (pfn < frame_count) {
+        if (frame_info[pfn] != PMM_FRAME_AVAILABLE) {
+            pfn++;
+            continue;
+        }
+        uint32_t end = pfn;
+        while (end < frame_count && frame_info[end] == PMM_FRAME_AVAILABLE) {
+            end++;
+        }
+        seed_run(pfn, end);
+        pfn = end;
+    }
+    total_pages = free_pages;
+
+    char buffer[16];
+    itoa(free_pages / (1024 * 1024 / PMM_PAGE_SIZE), buffer, 10);
+    vga_print("PMM inizializzato - RAM libera (MB): ", 0, 15, VGA_COLOR_WHITE);
+    vga_print(buffer, 37, 15, VGA_COLOR_CYAN);
+}
+
+/* Allocate 2^order contiguous, naturally aligned pages; 0 on failure */
+phys_addr_t pmm_alloc_pages(uint32_t order) {
+    if (order > PMM_MAX_ORDER) return 0;
+
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    uint32_t candidates = free_bitmap & (~0U << order);
+    if (!candidates) {
+        /* Memory pressure: ask caches to give pages back, then retry */
+        for (int i = 0; i < shrinker_count; i++) {
+            shrinkers[i]();
+        }
+        candidates = free_bitmap & (~0U << order);
+        if (!candidates) {
+            rspin_unlock_irqrestore(&mm_lock, flags);
+            return 0; /* Out of memory */
+        }
+    }
+
+    uint32_t current = __builtin_ctz(candidates);
+    uint32_t pfn = block_to_frame(free_lists[current]);
+    free_list_remove(pfn, current);
+
+    /* Split down, returning the upper halves to their lists */
+    while (current > order) {
+        current--;
+        free_list_push(pfn + (1U << current), current);
+    }
+
+    frame_info[pfn] = order;
+    free_pages -= 1U << order;
+    rspin_unlock_irqrestore(&mm_lock, flags);
+
+    return (phys_addr_t)pfn << PMM_PAGE_SHIFT;
+}
+
+/* Free a block obtained from pmm_alloc_pages, merging with free buddies */
+void pmm_free_pages(phys_addr_t addr, uint32_t order) {
+    uint32_t pfn = (uint32_t)(addr >> PMM_PAGE_SHIFT);
+
+    if (!addr || pfn >= frame_count || frame_info[pfn] != order) {
+        return; /* Not an allocated block of this order */
+    }
+
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    free_pages += 1U << order;
+
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = pfn ^ (1U << order);
+        if (buddy >= frame_count || frame_info[buddy] != (PMM_FRAME_FREE | order)) {
+            break;
+        }
+
+        free_list_remove(buddy, order);
+        frame_info[buddy] = PMM_FRAME_TAIL;
+        frame_info[pfn] = PMM_FRAME_TAIL;
+        if (buddy < pfn) pfn = buddy;
+        order++;
+    }
+
+    free_list_push(pfn, order);
+    rspin_unlock_irqrestore(&mm_lock, flags);
+}
+
+/* Register a callback run when an allocation cannot be satisfied */
+int pmm_register_shrinker(pmm_shrinker_t shrinker) {
+    for (int i = 0; i < shrinker_count; i++) {
+        if (shrinkers[i] == shrinker) return 0;
+    }
+    if (shrinker_count >= PMM_MAX_SHRINKERS) return -1;
+
+    shrinkers[shrinker_count++] = shrinker;
+    return 0;
+}
+
+/* Smallest order whose block holds 'size' bytes */
+uint32_t pmm_order_for_size(uint32_t size) {
+    uint32_t order = 0;
+    while (order < PMM_MAX_ORDER && ((uint32_t)PMM_PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+uint32_t pmm_free_page_count() {
+    return free_pages;
+}
+
+uint32_t pmm_total_page_count() {
+    return total_pages;
+}
+
+/* End of the highest managed page frame */
+phys_addr_t pmm_memory_end() {
+    return (phys_addr_t)frame_count << PMM_PAGE_SHIFT;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file pmm.h
+ * @brief Buddy-system physical page-frame allocator
+ */
+
+#ifndef PMM_H
+#define PMM_H
+
+#include <stdint.h>
+#include "multiboot.h"
+#include "spinlock.h"
+
+#define PMM_PAGE_SIZE     4096
+#define PMM_PAGE_SHIFT    12
+#define PMM_MAX_ORDER     10    /* 2^10 pages = 4MB */
+#define PMM_ORDER_COUNT   (PMM_MAX_ORDER + 1)
+
+#define PMM_LOW_LIMIT     0x100000     /* Never hand out the first 1MB */
+#define PMM_HIGH_LIMIT    0xC0000000   /* End of the kernel direct map (vmm.h) */
+
+/* Per-frame state byte */
+#define PMM_FRAME_FREE      0x80        /* Head of a free block, | order */
+#define PMM_FRAME_TAIL      0xFD        /* Inside a block, not its head */
+#define PMM_FRAME_AVAILABLE 0xFE        /* Usable RAM, only during init */
+#define PMM_FRAME_RESERVED  0xFF        /* Hole, firmware or kernel image */
+
+typedef uintptr_t phys_addr_t;
+
+/* Callback that releases cached pages under pressure; returns bytes freed */
+typedef uint32_t (*pmm_shrinker_t)(void);
+#define PMM_MAX_SHRINKERS 4
+
+/* Free block links, stored in the first frame of every free block */
+typedef struct pmm_free_block {
+    struct pmm_free_block *next;
+    struct pmm_free_block *prev;
+} pmm_free_block_t;
+
+/*
+ * Lock shared by the PMM, the heap and the slab caches. They call into
+ * each other with it held (heap growth, shrinkers), hence one recursive
+ * lock rather than one per allocator.
+ */
+extern rspinlock_t mm_lock;
+
+/* Function prototypes */
+void pmm_init(multiboot_info_t *mbi);
+phys_addr_t pmm_alloc_pages(uint32_t order);
+void pmm_free_pages(phys_addr_t addr, uint32_t order);
+uint32_t pmm_order_for_size(uint32_t size);
+int pmm_register_shrinker(pmm_shrinker_t shrinker);
+uint32_t pmm_free_page_count();
+uint32_t pmm_total_page_count();
+phys_addr_t pmm_memory_end();
+
+#endif
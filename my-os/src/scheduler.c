@@ -1,86 +1,1121 @@
 /**
  * @file scheduler.c
- * @brief Basic round-robin task scheduler implementation
+ * @brief Preemptive priority scheduler implementation
+ *
+ * isr32 pushes the interrupted task's registers, saves its FPU/SSE state
+ * below them and calls timer_handler() with the resulting stack pointer
+ * (the task's "frame"). schedule() stores it in the current task and
+ * returns the frame of the next one; the stub switches to that stack and
+ * unwinds it, so the next task resumes exactly where it was interrupted.
+ * A task that gives up the CPU (yield, sleep, block, exit) goes through
+ * the same path with the SCHED_YIELD_VECTOR software interrupt.
+ *
+ * Frame layout, from the frame pointer upwards:
+ *   FPU/SSE save area (TASK_FPU_AREA_SIZE bytes, 16-byte aligned)
+ *   pointer to the saved registers
+ *   ... alignment padding ...
+ *   general purpose registers (pushal / the 15 GPRs on x86_64)
+ *   interrupt return frame
+ *
+ * The running task is never in the run queue. When nothing is ready the
+ * idle task runs; it is never queued either.
+ *
+ * All scheduler state, every CPU's included, is guarded by sched_lock.
+ * A task that blocks takes the lock and keeps it into the yield
+ * interrupt, so no other CPU can wake and run it before its frame is
+ * saved. Even then its stack stays in use until the switch stub has
+ * moved off it: on_cpu stays set until sched_finish_switch().
  */
 
 #include "scheduler.h"
 #include "kernel.h"
+#include "memory.h"
+#include "slab.h"
+#include "timer.h"
+#include "clock.h"
+#include "idt.h"
+#include "smp.h"
+#include "spinlock.h"
 
-/* Global task array and current task index */
-static task_t tasks[MAX_TASKS];
-static int current_task = 0;
-static int task_count = 0;
+#define CPUID_EDX_FXSR   (1 << 24)
+#define CPUID_EDX_SSE    (1 << 25)
+#define CPUID_ECX_MONITOR (1 << 3)
+#define CR0_MP           0x00000002
+#define CR0_EM           0x00000004
+#define CR4_OSFXSR       0x00000200
+#define CR4_OSXMMEXCPT   0x00000400
+
+/* Per-CPU scheduler state */
+typedef struct {
+    runqueue_t runqueue;
+    task_t *current;
+    task_t *zombie;           /* Exited task whose stack was still in use */
+    task_t *switched_from;    /* Until the switch stub is off its stack */
+    task_t idle_task;
+    int slice_ticks;
+    int balance_ticks;
+    int yield_locked;         /* The yielding task already holds sched_lock */
+    uint32_t edf_util;        /* Per mille reserved by its EDF tasks */
+} sched_cpu_t;
+
+static sched_cpu_t sched_cpus[SMP_MAX_CPUS];
+static spinlock_t sched_lock = SPINLOCK_INIT;
+static timer_wheel_t sleep_wheel;   /* Sleeping tasks of every CPU, by wake tick */
+static kmem_cache_t *task_cache = 0;
+static uint32_t next_task_id = 1;
+static uint32_t nr_tasks = 0;
+
+/* sched_cpu_usage() reports on the interval since its last call */
+static uint64_t usage_stamp = 0;
+static uint64_t usage_idle = 0;
+
+/* The boot context (task 0) and the BSP's idle task need no allocation */
+static task_t boot_task;
+static uint8_t idle_stack[4096] __attribute__((aligned(16)));
+
+/* The idle loop waits with MONITOR/MWAIT instead of HLT */
+static int idle_mwait = 0;
+
+/* Read by isr32 in boot.s: save FPU/SSE state with fxsave */
+uint32_t fpu_fxsr_enabled = 0;
+
+/* Clean FPU/SSE state every new task starts from */
+static uint8_t fpu_initial_state[TASK_FPU_AREA_SIZE] __attribute__((aligned(16)));
+
+static void yield_locked(sched_cpu_t *sc);
+
+static inline sched_cpu_t *this_cpu_sched() {
+    return &sched_cpus[smp_cpu_id()];
+}
 
 /* Fake processes that demonstrate multitasking */
 void task_process_1() {
     /* Process 1: Changes border color */
     static int color = VGA_COLOR_BLUE;
-    vga_print("Task 1 running - Border Blue", 0, 20, VGA_COLOR_WHITE);
-    color = (color == VGA_COLOR_BLUE) ? VGA_COLOR_GREEN : VGA_COLOR_BLUE;
-    vga_print("", 50, 20, color); // Draw a colored block
-
-    vga_print("Next: Task 2 (Red)", 0, 22, VGA_COLOR_RED);
+    while (1) {
+        vga_print("Task 1 running - Border Blue", 0, 20, VGA_COLOR_WHITE);
+        color = (color == VGA_COLOR_BLUE) ? VGA_COLOR_GREEN : VGA_COLOR_BLUE;
+        vga_print("", 50, 20, color); // Draw a colored block
+        task_sleep(50);
+    }
 }
 
 void task_process_2() {
     /* Process 2: Shows counter */
     static int counter = 0;
-    counter++;
-    char buffer[16];
-    itoa(counter, buffer, 10);
+    while (1) {
+        counter++;
+        char buffer[16];
+        itoa(counter, buffer, 10);
 
-    vga_print("Task 2 running - Counter: ", 0, 20, VGA_COLOR_WHITE);
-    vga_print(buffer, 26, 20, VGA_COLOR_RED);
-    vga_print("Next: Task 3 (Yellow)", 0, 22, VGA_COLOR_YELLOW);
+        vga_print("Task 2 running - Counter: ", 0, 21, VGA_COLOR_WHITE);
+        vga_print(buffer, 26, 21, VGA_COLOR_RED);
+        task_sleep(10);
+    }
 }
 
 void task_process_3() {
     /* Process 3: Shows memory usage */
     static int mem_pos = 0;
-    vga_print("Task 3 running - Memory Monitor", 0, 20, VGA_COLOR_WHITE);
-    vga_print("[", 30 + mem_pos, 20, VGA_COLOR_YELLOW);
-    mem_pos = (mem_pos + 1) % 20;
-    vga_print("]", 40, 20, VGA_COLOR_YELLOW);
-    vga_print("Next: Task 1 (Blue)", 0, 22, VGA_COLOR_BLUE);
+    while (1) {
+        vga_print("Task 3 running - Memory Monitor", 0, 22, VGA_COLOR_WHITE);
+        vga_print("[", 32 + mem_pos, 22, VGA_COLOR_YELLOW);
+        mem_pos = (mem_pos + 1) % 10;
+        vga_print("]", 42, 22, VGA_COLOR_YELLOW);
+        task_sleep(25);
+    }
+}
+
+/* Enable the FPU and, when the CPU has them, fxsave and SSE */
+static void fpu_init() {
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+
+    uintptr_t cr0;
+    __asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
+    cr0 = (cr0 & ~(uintptr_t)CR0_EM) | CR0_MP;
+    __asm__ __volatile__("mov %0, %%cr0" : : "r"(cr0));
+
+    if (edx & CPUID_EDX_FXSR) {
+        uintptr_t cr4;
+        __asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_OSFXSR;
+        if (edx & CPUID_EDX_SSE) cr4 |= CR4_OSXMMEXCPT;
+        __asm__ __volatile__("mov %0, %%cr4" : : "r"(cr4));
+    }
+
+    __asm__ __volatile__("fninit");
+
+    /* Without fxsave (pre-Pentium II) the FPU state is not preserved */
+    if (edx & CPUID_EDX_FXSR) {
+        __asm__ __volatile__("fxsave %0" : "=m"(fpu_initial_state));
+        fpu_fxsr_enabled = 1;
+    }
+}
+
+/* Use MWAIT in the idle loop when the CPU has it */
+static void idle_init() {
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    idle_mwait = (ecx & CPUID_ECX_MONITOR) != 0;
+}
+
+/* True if a's job is due before b's */
+static inline int deadline_before(task_t *a, task_t *b) {
+    return (int32_t)(a->edf.abs_deadline - b->edf.abs_deadline) < 0;
+}
+
+/* Should 'task' take the CPU from 'current'? EDF beats every priority */
+static int preempts(task_t *task, task_t *current) {
+    if (task->edf.period) return !current->edf.period || deadline_before(task, current);
+    return !current->edf.period && task->priority < current->priority;
+}
+
+/* Run queue primitives */
+static void runqueue_push_edf(runqueue_t *rq, task_t *task) {
+    task_t *prev = 0;
+    task_t *next = rq->edf_head;
+    while (next && !deadline_before(task, next)) {
+        prev = next;
+        next = next->next;
+    }
+
+    task->prev = prev;
+    task->next = next;
+    if (prev) {
+        prev->next = task;
+    } else {
+        rq->edf_head = task;
+    }
+    if (next) next->prev = task;
+    rq->nr_edf++;
+    rq->nr_ready++;
+}
+
+static void runqueue_push(runqueue_t *rq, task_t *task) {
+    if (task->edf.period) {
+        runqueue_push_edf(rq, task);
+        return;
+    }
+
+    task_queue_t *queue = &rq->queues[task->priority];
+    task->next = 0;
+    task->prev = queue->tail;
+    if (queue->tail) {
+        queue->tail->next = task;
+    } else {
+        queue->head = task;
+    }
+    queue->tail = task;
+    rq->bitmap |= 1U << task->priority;
+    rq->nr_ready++;
+}
+
+/* Head of the highest-priority non-empty queue, or 0; EDF tasks stay */
+static task_t *runqueue_pop_prio(runqueue_t *rq) {
+    if (!rq->bitmap) return 0;
+
+    int priority = __builtin_ctz(rq->bitmap);
+    task_queue_t *queue = &rq->queues[priority];
+    task_t *task = queue->head;
+
+    queue->head = task->next;
+    if (queue->head) {
+        queue->head->prev = 0;
+    } else {
+        queue->tail = 0;
+        rq->bitmap &= ~(1U << priority);
+    }
+    rq->nr_ready--;
+    task->next = task->prev = 0;
+    return task;
+}
+
+/* Next task to run: the earliest deadline, else the highest priority */
+static task_t *runqueue_pop(runqueue_t *rq) {
+    task_t *task = rq->edf_head;
+    if (!task) return runqueue_pop_prio(rq);
+
+    rq->edf_head = task->next;
+    if (rq->edf_head) rq->edf_head->prev = 0;
+    rq->nr_edf--;
+    rq->nr_ready--;
+    task->next = task->prev = 0;
+    return task;
+}
+
+/* The task runqueue_pop_prio() would return, left in place */
+static task_t *runqueue_peek_prio(runqueue_t *rq) {
+    return rq->bitmap ? rq->queues[__builtin_ctz(rq->bitmap)].head : 0;
+}
+
+/* The task runqueue_pop() would return, left in place */
+static task_t *runqueue_peek(runqueue_t *rq) {
+    return rq->edf_head ? rq->edf_head : runqueue_peek_prio(rq);
+}
+
+/* Highest ready priority, or SCHED_PRIORITIES if nothing is ready */
+static inline int runqueue_best(runqueue_t *rq) {
+    return rq->bitmap ? __builtin_ctz(rq->bitmap) : SCHED_PRIORITIES;
+}
+
+/*
+ * Queue a ready task on the CPU it belongs to. That CPU is kicked if it
+ * idles or should switch to the task now, rather than at its next tick.
+ */
+static void enqueue(task_t *task) {
+    sched_cpu_t *sc = &sched_cpus[task->cpu];
+    task->ready_since = rdtsc();
+    runqueue_push(&sc->runqueue, task);
+    if (smp_cpu(task->cpu)->idle || (sc->current && preempts(task, sc->current))) {
+        smp_kick(task->cpu);
+    }
+}
+
+/* Sleep wheel primitives; the timer's arg is its task */
+static void sleeper_insert(task_t *task, uint32_t tick) {
+    task->sleep_timer.expires = tick;
+    timer_wheel_add(&sleep_wheel, &task->sleep_timer, get_tick_count());
+}
+
+static void sleeper_remove(task_t *task) {
+    timer_wheel_remove(&sleep_wheel, &task->sleep_timer);
+}
+
+/* Start an EDF job released at 'release' with a full budget */
+static void edf_start_job(task_edf_t *edf, uint32_t release) {
+    edf->release = release;
+    edf->abs_deadline = release + edf->deadline;
+    edf->budget_left = edf->budget_cycles;
+    edf->charged_at = rdtsc();
+    edf->job_done = 0;
+    edf->missed = 0;
+    edf->waiting = 0;
+}
+
+/* Take the cycles an EDF task ran since its last charge out of its budget */
+static void edf_charge(task_t *task, uint64_t now) {
+    task_edf_t *edf = &task->edf;
+
+    /* TSCs of different CPUs may disagree a little: never go backwards */
+    if (now > edf->charged_at) {
+        uint64_t ran = now - edf->charged_at;
+        edf->budget_left = ran < edf->budget_left ? edf->budget_left - ran : 0;
+    }
+    edf->charged_at = now;
+}
+
+/* Count the current job as missed if its deadline has come */
+static void edf_check_deadline(task_t *task, uint32_t now) {
+    task_edf_t *edf = &task->edf;
+    if (!edf->missed && (int32_t)(now - edf->abs_deadline) >= 0) {
+        edf->missed = 1;
+        edf->misses++;
+    }
+}
+
+/* Next job of an EDF task whose release tick has come */
+static void edf_release(task_t *task, uint32_t now) {
+    task_edf_t *edf = &task->edf;
+
+    /* Throttled before it finished: the deadline went by */
+    if (!edf->job_done && !edf->missed) edf->misses++;
+
+    /* A task a whole period behind restarts from now */
+    uint32_t release = edf->release + edf->period;
+    if ((int32_t)(now - release) >= (int32_t)edf->period) release = now;
+    edf_start_job(edf, release);
+}
+
+/* Hold an EDF task in the sleep wheel until its next release */
+static void edf_wait_release(task_t *task) {
+    task->state = TASK_SLEEPING;
+    task->edf.waiting = 1;
+    sleeper_insert(task, task->edf.release + task->edf.period);
+}
+
+/* Make every sleeper whose tick has come ready */
+static void wake_sleepers(uint32_t now) {
+    ktimer_t *timer;
+    while ((timer = timer_wheel_pop(&sleep_wheel, now))) {
+        task_t *task = timer->arg;
+        task->state = TASK_READY;
+        if (task->edf.waiting) edf_release(task, now);
+        enqueue(task);
+    }
+}
+
+/* Detach the last exited task once no CPU is on its stack any more */
+static task_t *take_zombie(sched_cpu_t *sc) {
+    task_t *dead = sc->zombie;
+    if (!dead || dead->on_cpu) return 0;
+    sc->zombie = 0;
+    return dead;
+}
+
+/* Free a task from take_zombie(), after sched_lock is dropped */
+static void free_task(task_t *task) {
+    if (task) {
+        kfree_aligned(task->stack);
+        kmem_cache_free(task_cache, task);
+    }
+}
+
+/* Ready tasks plus the running one, unless it is the idle task */
+static uint32_t cpu_load(uint32_t cpu) {
+    sched_cpu_t *sc = &sched_cpus[cpu];
+    return sc->runqueue.nr_ready + (sc->current != &sc->idle_task);
+}
+
+/* Online CPU with the lowest load, for a new task */
+static uint32_t least_loaded_cpu() {
+    uint32_t best = smp_cpu_id();
+    uint32_t best_load = cpu_load(best);
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        if (smp_cpu_online(cpu) && cpu_load(cpu) < best_load) {
+            best = cpu;
+            best_load = cpu_load(cpu);
+        }
+    }
+    return best;
+}
+
+/* Ready tasks the load balancer may move: EDF tasks keep their CPU */
+static inline uint32_t movable_tasks(runqueue_t *rq) {
+    return rq->nr_ready - rq->nr_edf;
+}
+
+/*
+ * Pull one ready task from the CPU with the most waiting. Periodically
+ * that evens out queues differing by two or more; an idle CPU takes
+ * anything that is waiting. The pulled task is the one the busy CPU
+ * would have run next, so priorities are kept.
+ */
+static void load_balance(sched_cpu_t *sc, int idle) {
+    uint32_t self = (uint32_t)(sc - sched_cpus);
+    uint32_t busiest = self;
+    uint32_t most = 0;
+
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        if (cpu == self || !smp_cpu_online(cpu)) continue;
+        if (movable_tasks(&sched_cpus[cpu].runqueue) > most) {
+            busiest = cpu;
+            most = movable_tasks(&sched_cpus[cpu].runqueue);
+        }
+    }
+    if (busiest == self) return;
+    if (idle ? most == 0 : most < movable_tasks(&sc->runqueue) + 2) return;
+
+    task_t *task = runqueue_peek_prio(&sched_cpus[busiest].runqueue);
+    if (task->pinned) return;
+    task = runqueue_pop_prio(&sched_cpus[busiest].runqueue);
+    task->cpu = self;
+    runqueue_push(&sc->runqueue, task);
+}
+
+/*
+ * Ticks the BSP may sleep without its periodic tick: only while every
+ * other CPU idles too, and never past the first sleeper or kernel timer.
+ * 0 if the tick is needed. Called with sched_lock held.
+ */
+static uint32_t tickless_ticks() {
+    for (uint32_t cpu = 1; cpu < smp_cpu_count(); cpu++) {
+        if (!smp_cpu_online(cpu)) continue;
+        if (!smp_cpu(cpu)->idle || sched_cpus[cpu].runqueue.nr_ready) return 0;
+    }
+
+    uint32_t now = get_tick_count();
+    uint32_t ticks = timer_wheel_next(&sleep_wheel, now);
+    uint32_t timers = ktimer_next_ticks(now);
+    if (timers < ticks) ticks = timers;
+    return ticks == TIMER_WHEEL_NONE ? timer_max_sleep_ticks() : ticks;
+}
+
+/* Halt until the next interrupt; returns with interrupts enabled */
+static void idle_wait(cpu_t *cpu) {
+    if (idle_mwait) {
+        /* smp_kick() clearing 'idle' ends the wait too */
+        __asm__ __volatile__("monitor" : : "a"(&cpu->idle), "c"(0), "d"(0));
+        if (cpu->idle) {
+            __asm__ __volatile__("sti; mwait" : : "a"(0), "c"(0));
+        } else {
+            __asm__ __volatile__("sti");
+        }
+    } else {
+        __asm__ __volatile__("sti; hlt");
+    }
+}
+
+/*
+ * Body of every idle task. With nothing to run the CPU halts and stops
+ * its tick; once every CPU idles, the BSP swaps its periodic tick for a
+ * one-shot at the first timer in the wheels.
+ */
+void sched_idle_loop() {
+    uint32_t self = smp_cpu_id();
+    sched_cpu_t *sc = &sched_cpus[self];
+    cpu_t *cpu = smp_cpu(self);
+
+    while (1) {
+        spin_lock_irqsave(&sched_lock);
+        if (!sc->runqueue.nr_ready) load_balance(sc, 1);
+        if (sc->runqueue.nr_ready) {
+            yield_locked(sc);
+            continue;
+        }
+
+        cpu->idle = 1;
+        uint32_t sleep = (self == 0) ? tickless_ticks() : TIMER_TICKLESS_FOREVER;
+        spin_unlock(&sched_lock);
+
+        if (sleep) timer_tickless_enter(sleep);
+        idle_wait(cpu);
+
+        __asm__ __volatile__("cli");
+        cpu->idle = 0;
+        timer_tickless_exit();
+    }
+}
+
+static void idle_entry() {
+    sched_idle_loop();
+}
+
+/* First code a new task runs, on its own stack with interrupts enabled */
+static void task_start() {
+    task_current()->entry_point();
+    task_exit();
+}
+
+/* Lay out a frame below 'stack_top' that the switch stubs can resume */
+static uintptr_t build_initial_frame(void (*start)(void), uint8_t *stack_top) {
+    uintptr_t *sp = (uintptr_t *)stack_top;
+
+    *--sp = 0;                                  /* Return address of 'start' */
+#ifdef __x86_64__
+    uintptr_t entry_sp = (uintptr_t)sp;
+    *--sp = KERNEL_DS;                          /* SS */
+    *--sp = entry_sp;                           /* RSP */
+#endif
+    *--sp = EFLAGS_IF | 0x2;                    /* EFLAGS, bit 1 is always set */
+    *--sp = KERNEL_CS;
+    *--sp = (uintptr_t)start;
+#ifdef __x86_64__
+    for (int i = 0; i < 15; i++) *--sp = 0;     /* General purpose registers */
+#else
+    for (int i = 0; i < 8; i++) *--sp = 0;      /* pushal */
+#endif
+
+    uintptr_t regs = (uintptr_t)sp;
+    uintptr_t frame = (regs - TASK_FPU_AREA_SIZE - 16) & ~(uintptr_t)15;
+    for (int i = 0; i < TASK_FPU_AREA_SIZE; i++) {
+        ((uint8_t *)frame)[i] = fpu_initial_state[i];
+    }
+    *(uintptr_t *)(frame + TASK_FPU_AREA_SIZE) = regs;
+    return frame;
+}
+
+/* Fill in a CPU's idle task; it is never queued */
+static void idle_task_init(sched_cpu_t *sc, uint32_t cpu) {
+    task_t *idle = &sc->idle_task;
+    idle->id = (uint32_t)-1;
+    idle->state = TASK_READY;
+    idle->priority = TASK_PRIORITY_IDLE;
+    idle->entry_point = idle_entry;
+    idle->stats = (task_stats_t){ 0 };
+    idle->run_start = 0;
+    idle->ready_since = 0;
+    idle->stack = 0;
+    idle->cpu = cpu;
+    idle->on_cpu = 0;
+    idle->wake_pending = 0;
+    idle->co_sched = 0;
+    idle->edf = (task_edf_t){ 0 };
+    ktimer_init(&idle->sleep_timer, 0, idle);
+    idle->pinned = 1;
+    idle->next = idle->prev = 0;
 }
 
-/* Initialize the scheduler */
+/* Initialize the scheduler; the caller becomes task 0 */
 void init_scheduler() {
-    int i;
-    for (i = 0; i < MAX_TASKS; i++) {
-        tasks[i].id = -1;
-        tasks[i].state = TASK_READY;
-        tasks[i].entry_point = 0;  /* NULL not defined in freestanding C */
-        tasks[i].runtime_ticks = 0;
+    sched_cpu_t *sc = &sched_cpus[0];
+    for (int i = 0; i < SCHED_PRIORITIES; i++) {
+        sc->runqueue.queues[i].head = 0;
+        sc->runqueue.queues[i].tail = 0;
     }
-    task_count = 0;
+    sc->runqueue.edf_head = 0;
+    sc->runqueue.nr_edf = 0;
+    sc->runqueue.bitmap = 0;
+    sc->runqueue.nr_ready = 0;
+    sc->zombie = 0;
+    sc->switched_from = 0;
+    timer_wheel_init(&sleep_wheel, get_tick_count());
+
+    fpu_init();
+    idle_init();
+
+    /* The boot context keeps running on its own stack */
+    boot_task.id = 0;
+    boot_task.state = TASK_RUNNING;
+    boot_task.priority = TASK_PRIORITY_DEFAULT;
+    boot_task.entry_point = 0;  /* NULL not defined in freestanding C */
+    boot_task.stats = (task_stats_t){ 0 };
+    boot_task.run_start = rdtsc();
+    boot_task.ready_since = 0;
+    boot_task.stack = 0;
+    boot_task.cpu = 0;
+    boot_task.on_cpu = 1;
+    boot_task.wake_pending = 0;
+    boot_task.co_sched = 0;
+    boot_task.edf = (task_edf_t){ 0 };
+    ktimer_init(&boot_task.sleep_timer, 0, &boot_task);
+    boot_task.pinned = 0;
+    boot_task.next = boot_task.prev = 0;
+    sc->current = &boot_task;
+    nr_tasks = 1;
+    usage_stamp = boot_task.run_start;
+    sc->slice_ticks = 0;
+
+    /* Runs when nothing else is ready */
+    idle_task_init(sc, 0);
+    sc->idle_task.frame = build_initial_frame(idle_entry, idle_stack + sizeof(idle_stack));
+}
+
+/*
+ * Scheduler state of an application processor, called from ap_main()
+ * before it enables interrupts. The caller's context becomes the CPU's
+ * idle task.
+ */
+void sched_init_cpu() {
+    __asm__ __volatile__("fninit");
+
+    uintptr_t flags = spin_lock_irqsave(&sched_lock);
+    uint32_t cpu = smp_cpu_id();
+    sched_cpu_t *sc = &sched_cpus[cpu];
+    idle_task_init(sc, cpu);
+    sc->idle_task.state = TASK_RUNNING;
+    sc->idle_task.on_cpu = 1;
+    sc->idle_task.run_start = rdtsc();
+    sc->current = &sc->idle_task;
+    sc->zombie = 0;
+    sc->switched_from = 0;
+    sc->slice_ticks = 0;
+    sc->balance_ticks = 0;
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+/*
+ * Create a task running entry_point() at 'priority' on a new stack; it
+ * is ready at once, on the least loaded CPU. Returns the task, or 0 if
+ * memory is short.
+ */
+task_t *create_task(void (*entry_point)(void), int priority) {
+    return create_task_on(entry_point, priority, TASK_CPU_ANY);
+}
+
+/*
+ * Like create_task(), but on 'cpu', where the task stays: the load
+ * balancer never moves it. TASK_CPU_ANY is plain create_task().
+ */
+task_t *create_task_on(void (*entry_point)(void), int priority, uint32_t cpu) {
+    if (!entry_point || priority < 0 || priority >= TASK_PRIORITY_IDLE) return 0;
+    if (cpu != TASK_CPU_ANY && !smp_cpu_online(cpu)) return 0;
+
+    uintptr_t flags = spin_lock_irqsave(&sched_lock);
+    if (!task_cache) {
+        task_cache = kmem_cache_create("task", sizeof(task_t), 0, 0);
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+    task_t *task = task_cache ? kmem_cache_alloc(task_cache) : 0;
+    if (!task) return 0;
+
+    uint8_t *stack = kmalloc_aligned(TASK_STACK_SIZE, 16);
+    if (!stack) {
+        kmem_cache_free(task_cache, task);
+        return 0;
+    }
+
+    task->state = TASK_READY;
+    task->priority = priority;
+    task->entry_point = entry_point;
+    task->stats = (task_stats_t){ 0 };
+    task->run_start = 0;
+    task->ready_since = 0;
+    task->stack = stack;
+    task->on_cpu = 0;
+    task->wake_pending = 0;
+    task->co_sched = 0;
+    task->edf = (task_edf_t){ 0 };
+    ktimer_init(&task->sleep_timer, 0, task);
+    task->pinned = cpu != TASK_CPU_ANY;
+    task->frame = build_initial_frame(task_start, stack + TASK_STACK_SIZE);
+
+    flags = spin_lock_irqsave(&sched_lock);
+    task->id = next_task_id++;
+    task->cpu = task->pinned ? cpu : least_loaded_cpu();
+    nr_tasks++;
+    enqueue(task);
+    sched_cpu_t *sc = this_cpu_sched();
+    int preempt = task->cpu == smp_cpu_id() && preempts(task, sc->current);
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    if (preempt) task_yield();
+    return task;
+}
+
+/* Give up the CPU; the switch happens in the yield interrupt */
+void task_yield() {
+    __asm__ __volatile__("int %0" : : "i"(SCHED_YIELD_VECTOR) : "memory");
+}
+
+/* Yield with sched_lock held; the yield handler releases it */
+static void yield_locked(sched_cpu_t *sc) {
+    sc->yield_locked = 1;
+    task_yield();
+}
+
+/* End the calling task; it is freed after the next switch */
+void task_exit() {
+    spin_lock_irqsave(&sched_lock);
+    sched_cpu_t *sc = this_cpu_sched();
+    sc->current->state = TASK_DEAD;
+    sched_cpus[sc->current->cpu].edf_util -= sc->current->edf.util;
+    nr_tasks--;
+    yield_locked(sc);
+
+    while (1) {
+        __asm__ __volatile__("hlt"); /* Not reached */
+    }
+}
+
+/* Sleep for at least 'ticks' timer ticks */
+void task_sleep(uint32_t ticks) {
+    if (ticks == 0) {
+        task_yield();
+        return;
+    }
+    task_sleep_until(get_tick_count() + ticks);
 }
 
-/* Create a new task */
-void create_task(int id, void (*entry_point)(void)) {
-    if (task_count < MAX_TASKS) {
-        tasks[task_count].id = id;
-        tasks[task_count].state = TASK_READY;
-        tasks[task_count].entry_point = entry_point;
-        tasks[task_count].runtime_ticks = 0;
-        task_count++;
+/* Sleep until tick 'tick'; returns at once if it has come */
+void task_sleep_until(uint32_t tick) {
+    uintptr_t flags = spin_lock_irqsave(&sched_lock);
+    if ((int32_t)(tick - get_tick_count()) <= 0) {
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return;
     }
+
+    sched_cpu_t *sc = this_cpu_sched();
+    task_t *self = sc->current;
+    self->state = TASK_SLEEPING;
+    sleeper_insert(self, tick);
+    yield_locked(sc);
+    irq_restore(flags);
+}
+
+/*
+ * Block until task_wake(). A wakeup that arrives first (e.g. from
+ * another CPU) is remembered and makes this return at once.
+ */
+void task_block() {
+    uintptr_t flags = spin_lock_irqsave(&sched_lock);
+    sched_cpu_t *sc = this_cpu_sched();
+    task_t *self = sc->current;
+    if (self->wake_pending) {
+        self->wake_pending = 0;
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return;
+    }
+    self->state = TASK_BLOCKED;
+    yield_locked(sc);
+    irq_restore(flags);
+}
+
+/*
+ * task_block() that gives up at tick 'tick'. Returns 0 if woken, -1 if
+ * the tick has come.
+ */
+int task_block_until(uint32_t tick) {
+    uintptr_t flags = spin_lock_irqsave(&sched_lock);
+    sched_cpu_t *sc = this_cpu_sched();
+    task_t *self = sc->current;
+    if (self->wake_pending) {
+        self->wake_pending = 0;
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return 0;
+    }
+    if ((int32_t)(tick - get_tick_count()) <= 0) {
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return -1;
+    }
+
+    /* task_wake() ends a sleep early, so sleeping is blocking with a deadline */
+    self->state = TASK_SLEEPING;
+    sleeper_insert(self, tick);
+    yield_locked(sc);
+    irq_restore(flags);
+    return (int32_t)(get_tick_count() - tick) >= 0 ? -1 : 0;
 }
 
-/* Schedule next task - called from timer interrupt */
-void schedule() {
-    if (task_count == 0) return;
+/* Make a blocked or sleeping task ready; safe from interrupt handlers */
+void task_wake(task_t *task) {
+    if (!task) return;
+
+    uintptr_t flags = spin_lock_irqsave(&sched_lock);
+    int preempt = 0;
+    if (task->state == TASK_BLOCKED || (task->state == TASK_SLEEPING && !task->edf.waiting)) {
+        if (task->state == TASK_SLEEPING) sleeper_remove(task);
+        task->state = TASK_READY;
+        enqueue(task);
+        /* A caller with interrupts off is in a critical section: its next tick switches */
+        preempt = task->cpu == smp_cpu_id() && (flags & EFLAGS_IF) &&
+                  preempts(task, this_cpu_sched()->current) && !in_interrupt();
+    } else if (task->state != TASK_DEAD) {
+        task->wake_pending = 1;
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
 
-    /* Clear previous task display area */
-    vga_print("                           ", 0, 20, VGA_COLOR_BLACK);
-    vga_print("                           ", 0, 22, VGA_COLOR_BLACK);
+    if (preempt) task_yield();
+}
 
-    /* Run current task */
-    tasks[current_task].runtime_ticks++;
-    if (tasks[current_task].entry_point != 0) {
-        tasks[current_task].entry_point();
+/*
+ * Put the calling task in the EDF class: a job every 'period' ticks,
+ * each to run at most 'budget' microseconds of CPU time and be done
+ * 'deadline' ticks after its release (budget <= deadline <= period).
+ * The first job starts now. The task moves to another CPU if its own
+ * cannot admit it. Returns -1, leaving the task as it was, if no CPU
+ * can, or if the TSC rate is unknown and budgets cannot be measured. A
+ * period of 0 puts the task back in its fixed priority.
+ */
+int task_set_edf(uint32_t period, uint32_t budget, uint32_t deadline) {
+    /* Microseconds in one per mille of the deadline */
+    uint32_t util_us = deadline * (SCHED_TICK_US / 1000);
+    uint32_t cycles_per_us = clock_tsc_khz() / 1000;
+    if (period && (budget == 0 || deadline == 0 || budget > deadline * SCHED_TICK_US ||
+                   deadline > period || cycles_per_us == 0)) {
+        return -1;
     }
+    uint32_t util = period ? (budget + util_us - 1) / util_us : 0;
 
-    /* Schedule next task (round-robin) */
-    current_task = (current_task + 1) % task_count;
+    uintptr_t flags = spin_lock_irqsave(&sched_lock);
+    sched_cpu_t *sc = this_cpu_sched();
+    task_t *self = sc->current;
+    uint32_t cpu = smp_cpu_id();
+    if (self == &sc->idle_task) {
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return -1;
+    }
+
+    /* Admission: this CPU first, then the others unless it is pinned */
+    uint32_t target = cpu;
+    if (period) {
+        uint32_t count = smp_cpu_count();
+        uint32_t tries = self->pinned ? 1 : count;
+        uint32_t i;
+        for (i = 0; i < tries; i++) {
+            uint32_t candidate = (cpu + i) % count;
+            uint32_t reserved = sched_cpus[candidate].edf_util;
+            if (candidate == cpu) reserved -= self->edf.util;
+            if (smp_cpu_online(candidate) && reserved + util <= SCHED_EDF_UTIL_MAX) break;
+        }
+        if (i == tries) {
+            spin_unlock_irqrestore(&sched_lock, flags);
+            return -1;
+        }
+        target = (cpu + i) % count;
+    }
+
+    sc->edf_util -= self->edf.util;
+    self->edf = (task_edf_t){ 0 };
+    if (period) {
+        self->edf.period = period;
+        self->edf.budget = budget;
+        self->edf.budget_cycles = (uint64_t)budget * cycles_per_us;
+        self->edf.deadline = deadline;
+        self->edf.util = util;
+        edf_start_job(&self->edf, get_tick_count());
+        sched_cpus[target].edf_util += util;
+    }
+
+    if (target != cpu) {
+        /* switch_to_next() queues it on the new CPU */
+        self->cpu = target;
+        yield_locked(sc);
+        irq_restore(flags);
+        return 0;
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return 0;
+}
+
+/*
+ * End the calling EDF task's current job and sleep until the next one
+ * is released; returns at once if that is already due. Returns -1 if
+ * the caller is not an EDF task.
+ */
+int task_wait_period() {
+    uintptr_t flags = spin_lock_irqsave(&sched_lock);
+    sched_cpu_t *sc = this_cpu_sched();
+    task_t *self = sc->current;
+    task_edf_t *edf = &self->edf;
+    if (!edf->period) {
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return -1;
+    }
+
+    uint32_t now = get_tick_count();
+    edf_check_deadline(self, now);
+    edf->jobs++;
+    edf->job_done = 1;
+
+    if ((int32_t)(now - (edf->release + edf->period)) >= 0) {
+        edf_release(self, now);
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return 0;
+    }
+
+    edf_wait_release(self);
+    yield_locked(sc);
+    irq_restore(flags);
+    return 0;
+}
+
+/* Copy a task's EDF parameters and statistics; -1 if it is not EDF */
+int task_get_edf(task_t *task, task_edf_t *edf) {
+    if (!task) return -1;
+
+    uintptr_t flags = spin_lock_irqsave(&sched_lock);
+    int result = task->edf.period ? 0 : -1;
+    if (result == 0) *edf = task->edf;
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return result;
+}
+
+/*
+ * Copy a task's CPU accounting; a running task's current stint is
+ * included. The task must still exist.
+ */
+int task_get_stats(task_t *task, task_stats_t *stats) {
+    if (!task) return -1;
+
+    uintptr_t flags = spin_lock_irqsave(&sched_lock);
+    *stats = task->stats;
+    uint64_t now = rdtsc();
+    if (task->state == TASK_RUNNING && now > task->run_start) {
+        stats->run_cycles += now - task->run_start;
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return 0;
+}
+
+/* part/whole in per mille, without a 64-bit division */
+static uint32_t per_mille(uint64_t part, uint64_t whole) {
+    while (whole >> 22) {
+        part >>= 1;
+        whole >>= 1;
+    }
+    return whole ? (uint32_t)part * 1000 / (uint32_t)whole : 0;
+}
+
+/*
+ * Share of CPU time, over every online CPU, spent outside the idle
+ * tasks since the previous call; in per mille.
+ */
+uint32_t sched_cpu_usage() {
+    uintptr_t flags = spin_lock_irqsave(&sched_lock);
+    uint64_t now = rdtsc();
+    uint64_t idle = 0;
+    uint32_t cpus = 0;
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        if (!smp_cpu_online(cpu)) continue;
+        task_t *idle_task = &sched_cpus[cpu].idle_task;
+        idle += idle_task->stats.run_cycles;
+        if (sched_cpus[cpu].current == idle_task && now > idle_task->run_start) {
+            idle += now - idle_task->run_start;
+        }
+        cpus++;
+    }
+
+    uint64_t total = (now - usage_stamp) * cpus;
+    uint64_t idle_delta = idle - usage_idle;
+    usage_stamp = now;
+    usage_idle = idle;
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    if (idle_delta >= total) return 0;
+    return per_mille(total - idle_delta, total);
+}
+
+task_t *task_current() {
+    uintptr_t flags = irq_save();
+    task_t *task = this_cpu_sched()->current;
+    irq_restore(flags);
+    return task;
+}
+
+int current_task_id() {
+    return (int)task_current()->id;
+}
+
+/* Live tasks, including the boot context */
+uint32_t task_count() {
+    return nr_tasks;
+}
+
+/* Charge prev's time on the CPU and next's time in the run queue, up to now */
+static void account_switch(sched_cpu_t *sc, task_t *prev, task_t *next, int voluntary) {
+    uint64_t now = rdtsc();
+
+    /* TSCs of different CPUs may disagree a little: never go backwards */
+    if (now > prev->run_start) prev->stats.run_cycles += now - prev->run_start;
+    if (prev->edf.period) edf_charge(prev, now);
+    if (voluntary) {
+        prev->stats.voluntary++;
+    } else {
+        prev->stats.involuntary++;
+    }
+
+    if (next != &sc->idle_task && now > next->ready_since) {
+        uint64_t wait = now - next->ready_since;
+        next->stats.wait_cycles += wait;
+        if (wait > next->stats.max_wait_cycles) next->stats.max_wait_cycles = wait;
+    }
+    next->stats.runs++;
+    next->run_start = now;
+    next->edf.charged_at = now;
+}
+
+/*
+ * Switch to the best ready task (or idle), requeueing the current one.
+ * 'voluntary' tells whether the current task gave up the CPU itself.
+ */
+static uintptr_t switch_to_next(sched_cpu_t *sc, int voluntary) {
+    task_t *prev = sc->current;
+
+    if (prev->state == TASK_RUNNING) {
+        prev->state = TASK_READY;
+        if (prev != &sc->idle_task) enqueue(prev);
+    } else if (prev->state == TASK_DEAD) {
+        sc->zombie = prev;
+    }
+
+    if (!sc->runqueue.nr_ready) load_balance(sc, 1);
+    task_t *next = runqueue_pop(&sc->runqueue);
+    if (!next) next = &sc->idle_task;
+
+    if (prev == &sc->idle_task && next != prev) {
+        /* Leaving the idle loop: the periodic tick again */
+        smp_cpu(prev->cpu)->idle = 0;
+        timer_tickless_exit();
+    }
+
+    if (next != prev) {
+        /* It may have just been switched out on another CPU */
+        while (next->on_cpu) {
+            __asm__ __volatile__("pause" : : : "memory");
+        }
+        next->on_cpu = 1;
+        sc->switched_from = prev;
+        account_switch(sc, prev, next, voluntary);
+    }
+
+    next->state = TASK_RUNNING;
+    sc->current = next;
+    sc->slice_ticks = 0;
+    return next->frame;
+}
+
+/*
+ * Pick what runs next on this CPU. Only a real timer tick ('tick') uses
+ * up time slices and the balancing interval; a reschedule request just
+ * checks for preemption. EDF budgets are charged with the cycles the
+ * task actually ran either way.
+ */
+static uintptr_t reschedule(uintptr_t frame, int tick) {
+    sched_cpu_t *sc = this_cpu_sched();
+    if (!sc->current) return frame;
+
+    spin_lock(&sched_lock);
+    task_t *self = sc->current;
+    self->frame = frame;
+    task_t *dead = take_zombie(sc);
+    uint32_t now = get_tick_count();
+    wake_sleepers(now);
+
+    if (tick && ++sc->balance_ticks >= SCHED_BALANCE_TICKS) {
+        sc->balance_ticks = 0;
+        load_balance(sc, 0);
+    } else if (self == &sc->idle_task && !sc->runqueue.nr_ready) {
+        load_balance(sc, 1);
+    }
+
+    uintptr_t next = frame;
+    task_t *head = runqueue_peek(&sc->runqueue);
+    int best = runqueue_best(&sc->runqueue);
+    if (self->edf.period) {
+        edf_check_deadline(self, now);
+        edf_charge(self, rdtsc());
+        if (!self->edf.budget_left) {
+            edf_wait_release(self);
+            next = switch_to_next(sc, 0);
+        } else if (head && preempts(head, self)) {
+            next = switch_to_next(sc, 0);
+        }
+    } else if (head && preempts(head, self)) {
+        next = switch_to_next(sc, 0);
+    } else if (tick && ++sc->slice_ticks >= SCHED_SLICE_TICKS) {
+        if (best == self->priority) {
+            next = switch_to_next(sc, 0);
+        } else {
+            sc->slice_ticks = 0;
+        }
+    }
+    spin_unlock(&sched_lock);
+
+    free_task(dead);
+    return next;
+}
+
+/*
+ * Called by the timer interrupt (or the tick IPI on the other CPUs) with
+ * the interrupted task's frame. Returns the frame to resume: the same
+ * one until a higher priority task is ready or the slice is used up with
+ * an equal priority task waiting. EDF tasks are not time sliced; they
+ * run until an earlier deadline is ready or their budget is used up.
+ */
+uintptr_t schedule(uintptr_t frame) {
+    return reschedule(frame, 1);
+}
+
+/* Called by the kick IPI: new work was queued here, which is not a tick */
+uintptr_t sched_reschedule(uintptr_t frame) {
+    return reschedule(frame, 0);
+}
+
+/* Called by the yield interrupt: the current task gives up the CPU */
+uintptr_t sched_yield_handler(uintptr_t frame) {
+    sched_cpu_t *sc = this_cpu_sched();
+    if (sc->yield_locked) {
+        sc->yield_locked = 0;
+    } else {
+        spin_lock(&sched_lock);
+    }
+
+    sc->current->frame = frame;
+    task_t *dead = take_zombie(sc);
+    uintptr_t next = switch_to_next(sc, 1);
+    spin_unlock(&sched_lock);
+
+    free_task(dead);
+    return next;
+}
+
+/* Called by the switch stubs once they run on the new task's stack */
+void sched_finish_switch() {
+    sched_cpu_t *sc = this_cpu_sched();
+    if (sc->switched_from) {
+        __sync_synchronize();
+        sc->switched_from->on_cpu = 0;
+        sc->switched_from = 0;
+    }
 }
@@ -1,29 +1,170 @@
 /**
  * @file scheduler.h
- * @brief Basic task scheduler for multitasking demo
+ * @brief Preemptive priority scheduler with O(1) task selection
+ *
+ * Every task runs on its own kernel stack. The timer interrupt stub saves
+ * the interrupted task's registers and FPU/SSE state on that stack and
+ * hands the stack pointer to schedule(), which returns the one to resume.
+ *
+ * Ready tasks wait in one FIFO queue per priority; a bitmap of non-empty
+ * queues gives the highest ready priority with a single bit scan, so the
+ * pick costs the same with 3 tasks or 3000.
+ *
+ * Every CPU has its own run queue, current task and idle task. A task
+ * stays on the CPU it last ran on; a load balancer pulls ready tasks
+ * from the busiest CPU every SCHED_BALANCE_TICKS, and right away when a
+ * CPU runs out of work.
+ *
+ * Periodic real-time work can join the earliest deadline first class
+ * with task_set_edf(): a period and a relative deadline in ticks, and a
+ * budget in microseconds. EDF tasks run before every fixed-priority
+ * task, the one with the earliest deadline first. Each CPU admits EDF
+ * tasks only up to SCHED_EDF_UTIL_MAX of budget/deadline, so the sum of
+ * the densities stays schedulable. The budget is charged with the TSC
+ * cycles the task actually ran, so a job far shorter than a tick only
+ * reserves what it needs. A task that uses up its budget is held until
+ * its next release (noticed at the next tick or switch), and jobs not
+ * done by their deadline are counted. EDF tasks stay on the CPU that
+ * admitted them.
+ *
+ * Every switch reads the TSC: each task's time on a CPU, its switches
+ * and how long it waited in a run queue are kept in cycles (task_stats_t,
+ * see task_get_stats()). Idle tasks are accounted too, which gives the
+ * CPU usage.
+ *
+ * Sleeping tasks wait in a timing wheel (ktimer.h), so putting a task
+ * to sleep and waking it early cost the same however many sleep. Besides
+ * task_sleep() there are task_sleep_until() for an absolute tick and
+ * task_block_until(), a task_block() with a deadline that wait queues
+ * (waitqueue.h) build their timeouts on.
+ *
+ * Idle CPUs halt (MWAIT where available) and get no ticks. When all of
+ * them idle, the BSP programs its timer as a one-shot for the first
+ * sleeper or kernel timer instead of ticking; the tick count is caught
+ * up on wakeup.
  */
 
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
-/* Maximum number of tasks */
-#define MAX_TASKS 3
+#include <stdint.h>
+#include "ktimer.h"
+
+#define SCHED_PRIORITIES       32   /* 0 is the highest priority */
+#define TASK_PRIORITY_HIGH     8
+#define TASK_PRIORITY_DEFAULT  16
+#define TASK_PRIORITY_LOW      24
+#define TASK_PRIORITY_IDLE     (SCHED_PRIORITIES - 1)   /* Idle task only */
+#define TASK_CPU_ANY           ((uint32_t)-1)           /* create_task_on(): let it balance */
+
+#define TASK_STACK_SIZE    0x4000   /* 16KB kernel stack per task */
+#define SCHED_SLICE_TICKS  2        /* Timer ticks before a task is preempted */
+#define SCHED_BALANCE_TICKS 10      /* Ticks between load balancing passes */
+#define SCHED_EDF_UTIL_MAX  900     /* Per mille of a CPU EDF tasks may reserve */
+#define SCHED_TICK_US       10000   /* Length of a tick: the timer runs at 100Hz */
+
+/* Size of the FPU/SSE save area the ISR stub keeps below the registers */
+#define TASK_FPU_AREA_SIZE 512
 
 /* Task states */
-#define TASK_READY    0
-#define TASK_RUNNING  1
+#define TASK_READY     0   /* In a run queue */
+#define TASK_RUNNING   1
+#define TASK_BLOCKED   2   /* Waiting for task_wake() */
+#define TASK_SLEEPING  3   /* Waiting for its wake tick */
+#define TASK_DEAD      4   /* Exited; freed once its stack is no longer in use */
 
-/* Simple task structure */
+/* Earliest deadline first parameters and statistics, in ticks; period 0: not EDF */
 typedef struct {
-    int id;
+    uint32_t period;
+    uint32_t budget;          /* Microseconds each job may run */
+    uint32_t deadline;        /* Relative to the job's release */
+    uint32_t util;            /* budget/deadline in per mille, reserved on the CPU */
+    uint32_t release;         /* Release tick of the current job */
+    uint32_t abs_deadline;
+    uint64_t budget_cycles;   /* The budget in TSC cycles */
+    uint64_t budget_left;     /* Cycles the current job may still run */
+    uint64_t charged_at;      /* TSC up to which budget_left is charged */
+    uint32_t jobs;            /* Jobs completed */
+    uint32_t misses;          /* Jobs not done by their deadline */
+    uint8_t job_done;         /* Current job ended with task_wait_period() */
+    uint8_t missed;           /* Current job already counted as a miss */
+    uint8_t waiting;          /* Sleeping until the next release */
+} task_edf_t;
+
+/* Per-task CPU accounting, in TSC cycles */
+typedef struct {
+    uint64_t run_cycles;        /* Time on a CPU */
+    uint64_t wait_cycles;       /* Time ready in a run queue before running */
+    uint64_t max_wait_cycles;   /* Longest such wait */
+    uint32_t runs;              /* Times it was switched in */
+    uint32_t voluntary;         /* Switched out by yield, sleep, block or exit */
+    uint32_t involuntary;       /* Preempted */
+} task_stats_t;
+
+/* Task structure, allocated from the "task" slab cache */
+typedef struct task {
+    uint32_t id;
     int state;
+    int priority;
     void (*entry_point)(void);
-    int runtime_ticks;
+    ktimer_t sleep_timer;   /* Wake tick while TASK_SLEEPING, in the sleep wheel */
+    uintptr_t frame;        /* Saved stack pointer while the task is not running */
+    uint8_t *stack;         /* Base of the kernel stack, 0 for static tasks */
+    uint32_t cpu;           /* CPU whose run queue it belongs to */
+    volatile int on_cpu;    /* A CPU is still using its stack */
+    int wake_pending;       /* task_wake() came before task_block() */
+    struct co_sched *co_sched;  /* Its coroutines, see coroutine.h */
+    int pinned;             /* Stays on 'cpu', see create_task_on() */
+    task_edf_t edf;
+    task_stats_t stats;
+    uint64_t run_start;     /* TSC when it was last switched in */
+    uint64_t ready_since;   /* TSC when it was last queued */
+    struct task *next;      /* Run queue links */
+    struct task *prev;
 } task_t;
 
+/* FIFO of ready tasks of one priority */
+typedef struct {
+    task_t *head;
+    task_t *tail;
+} task_queue_t;
+
+/*
+ * Run queue: ready EDF tasks sorted by deadline, then a FIFO per
+ * priority plus the bitmap of non-empty ones
+ */
+typedef struct {
+    task_t *edf_head;
+    uint32_t nr_edf;
+    uint32_t bitmap;                        /* Bit p set: queues[p] not empty */
+    task_queue_t queues[SCHED_PRIORITIES];
+    uint32_t nr_ready;                      /* EDF tasks included */
+} runqueue_t;
+
 /* Function prototypes */
 void init_scheduler();
-void create_task(int id, void (*entry_point)(void));
-void schedule();
+void sched_init_cpu();
+task_t *create_task(void (*entry_point)(void), int priority);
+task_t *create_task_on(void (*entry_point)(void), int priority, uint32_t cpu);
+void task_exit();
+void task_yield();
+void task_sleep(uint32_t ticks);
+void task_sleep_until(uint32_t tick);
+void task_block();
+int task_block_until(uint32_t tick);
+void task_wake(task_t *task);
+int task_set_edf(uint32_t period, uint32_t budget, uint32_t deadline);
+int task_wait_period();
+int task_get_edf(task_t *task, task_edf_t *edf);
+int task_get_stats(task_t *task, task_stats_t *stats);
+uint32_t sched_cpu_usage();
+task_t *task_current();
+int current_task_id();
+uint32_t task_count();
+uintptr_t schedule(uintptr_t frame);
+uintptr_t sched_reschedule(uintptr_t frame);
+uintptr_t sched_yield_handler(uintptr_t frame);
+void sched_finish_switch();
+void sched_idle_loop();
 
 #endif
@@ -5,8 +5,10 @@
 
 #include "sensors.h"
 #include "kernel.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "clock.h"
 
-uint32_t get_tick_count();
 static int rand();
 
 /* Global sensor array */
@@ -17,7 +19,7 @@ static int sensor_count = 0;
 static sensor_data_t read_accelerometer() {
     sensor_data_t data;
     data.type = SENSOR_TYPE_ACCELEROMETER;
-    data.timestamp = get_tick_count() * 10; /* Convert to ms */
+    data.timestamp = clock_ns();
     data.x_value = 0.0 + (rand() % 1000) / 500.0 - 1.0; /* -1.0 to +1.0 */
     data.y_value = 9.8 + (rand() % 200) / 100.0 - 1.0;  /* ~9.8 m/s² */
     data.z_value = 0.0 + (rand() % 1000) / 500.0 - 1.0;
@@ -30,9 +32,9 @@ static sensor_data_t read_accelerometer() {
 static sensor_data_t read_cpu_usage() {
     sensor_data_t data;
     data.type = SENSOR_TYPE_CPU_USAGE;
-    data.timestamp = get_tick_count() * 10;
-    data.x_value = (rand() % 100) + (rand() % 100) / 100.0; /* 0-99% */
-    data.y_value = ((rand() % sensor_count) / (float)sensor_count) * 100.0; /* Kernel load */
+    data.timestamp = clock_ns();
+    data.x_value = sched_cpu_usage() / 10.0; /* % busy since the last reading */
+    data.y_value = task_count(); /* Kernel load: live tasks */
     data.z_value = 0.0;
     data.accuracy = 100;
     data.raw_data = 0;
@@ -42,12 +44,15 @@ static sensor_data_t read_cpu_usage() {
 
 static sensor_data_t read_memory_usage() {
     sensor_data_t data;
+    kheap_stats_t stats;
+    kheap_get_stats(&stats);
+
     data.type = SENSOR_TYPE_MEMORY_USAGE;
-    data.timestamp = get_tick_count() * 10;
-    data.x_value = (rand() % 80) + 20.0; /* 20-99% used */
-    data.y_value = 1048576 - (data.x_value * 10485.76); /* Free bytes simulation */
-    data.z_value = 1 << (rand() % 24); /* Fragmentation metric */
-    data.accuracy = 90;
+    data.timestamp = clock_ns();
+    data.x_value = stats.heap_size ? (100.0 * stats.bytes_in_use) / stats.heap_size : 0.0; /* % of heap used */
+    data.y_value = stats.free_bytes; /* Free heap bytes */
+    data.z_value = stats.fragmentation; /* Fragmentation index 0-100 */
+    data.accuracy = 100;
     data.raw_data = 0;
     data.data_size = 0;
     return data;
@@ -56,11 +61,11 @@ static sensor_data_t read_memory_usage() {
 static sensor_data_t read_time_of_day() {
     sensor_data_t data;
     data.type = SENSOR_TYPE_TIME_OF_DAY;
-    data.timestamp = get_tick_count() * 10;
+    data.timestamp = clock_ns();
     /* Simulate current time as HH.MM */
     data.x_value = 12 + (rand() % 24) / 10.0; /* Hours */
     data.y_value = (rand() % 60); /* Minutes */
-    data.z_value = data.timestamp / (24 * 60 * 60 * 1000); /* Day number */
+    data.z_value = (uint32_t)((double)(int64_t)data.timestamp / 86400e9); /* Day number */
     data.accuracy = 100;
     data.raw_data = 0;
     data.data_size = 0;
@@ -70,7 +75,7 @@ static sensor_data_t read_time_of_day() {
 static sensor_data_t read_user_activity() {
     sensor_data_t data;
     data.type = SENSOR_TYPE_USER_ACTIVITY;
-    data.timestamp = get_tick_count() * 10;
+    data.timestamp = clock_ns();
     data.x_value = rand() % 4; /* Activity level 0-3 (idle -> high) */
     data.y_value = rand() % 100; /* Touch pressure simulation */
     data.z_value = rand() % 360; /* Touch angle */
@@ -191,3 +196,33 @@ sensor_data_t *read_all_sensors(uint32_t *count) {
 void update_sensor_timestamp(sensor_type_t type) {
     /* Could implement push-based sensor model here */
 }
+
+/*
+ * Task body: sample every active sensor once per period as an EDF job,
+ * so heavy model work cannot delay the readings past their deadline.
+ */
+void sensor_sampling_task() {
+    if (task_set_edf(SENSOR_SAMPLE_PERIOD_TICKS, SENSOR_SAMPLE_BUDGET_US,
+                     SENSOR_SAMPLE_PERIOD_TICKS) != 0) {
+        vga_print("EDF: campionamento sensori non ammesso", 0, 23, VGA_COLOR_RED);
+        return;
+    }
+
+    while (1) {
+        uint32_t count;
+        read_all_sensors(&count);
+
+        /* Show how it keeps up about once a second */
+        task_edf_t edf;
+        if (task_get_edf(task_current(), &edf) == 0 && edf.jobs % 100 == 0) {
+            char buffer[16];
+            vga_print("Campioni EDF:          scadenze mancate:", 0, 23, VGA_COLOR_WHITE);
+            itoa(edf.jobs, buffer, 10);
+            vga_print(buffer, 14, 23, VGA_COLOR_LIGHT_GREEN);
+            itoa(edf.misses, buffer, 10);
+            vga_print(buffer, 41, 23, VGA_COLOR_LIGHT_RED);
+        }
+
+        task_wait_period();
+    }
+}
@@ -10,6 +10,10 @@
 
 #define MAX_SENSORS 16
 
+/* Sampling job of sensor_sampling_task() (EDF class): every 10ms tick, 1ms of CPU */
+#define SENSOR_SAMPLE_PERIOD_TICKS  1
+#define SENSOR_SAMPLE_BUDGET_US     1000
+
 /* Sensor types */
 typedef enum {
     SENSOR_TYPE_ACCELEROMETER = 0,
@@ -33,7 +37,7 @@ typedef enum {
 /* Sensor data structure */
 typedef struct {
     sensor_type_t type;
-    uint32_t timestamp;
+    uint64_t timestamp; /* clock_ns() when read */
     float x_value;      /* Primary value */
     float y_value;      /* Secondary value (for 2D/3D sensors) */
     float z_value;      /* Tertiary value */
@@ -52,7 +56,7 @@ typedef struct {
     const char *name;
     sensor_init_func_t init_func;
     sensor_read_func_t read_func;
-    uint32_t last_timestamp;
+    uint64_t last_timestamp;
     uint8_t active;
 } sensor_t;
 
@@ -64,5 +68,6 @@ int disable_sensor(sensor_type_t type);
 sensor_data_t read_sensor(sensor_type_t type);
 sensor_data_t *read_all_sensors(uint32_t *count);
 void update_sensor_timestamp(sensor_type_t type);
+void sensor_sampling_task();
 
 #endif
@@ -0,0 +1,153 @@
+/**
+ * @file slab.c
+ * @brief Implementation of slab object caches on top of kmalloc
+ *
+ * Each cache carves kmalloc'd chunks into equally sized, aligned objects
+ * and keeps the free ones on a singly linked list, so allocating and
+ * freeing an object is a constant-time pop/push with no per-object header.
+ */
+
+#include "slab.h"
+#include "memory.h"
+#include "pmm.h"
+
+/* Cache that holds the kmem_cache_t descriptors themselves */
+static kmem_cache_t cache_cache;
+static int cache_cache_ready = 0;
+
+static inline uint32_t align_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+/* Free list link of an object */
+static inline void **free_link(kmem_cache_t *cache, void *obj) {
+    return (void **)((uintptr_t)obj + cache->free_offset);
+}
+
+/* Compute the object layout of a cache */
+static void kmem_cache_setup(kmem_cache_t *cache, const char *name, uint32_t size,
+                             uint32_t align, kmem_ctor_t ctor) {
+    /*
+     * Default to cache-line-aware alignment: objects of half a line or
+     * more start on a line, smaller ones are packed so none straddles one.
+     */
+    if (align == 0) {
+        align = SLAB_CACHE_LINE;
+        while (align / 2 >= size && align / 2 >= sizeof(void *)) {
+            align /= 2;
+        }
+    }
+    if (align < sizeof(void *)) {
+        align = sizeof(void *);
+    }
+
+    /* Keep the link out of constructed objects so their state survives a free */
+    uint32_t object_bytes = size;
+    cache->free_offset = 0;
+    if (ctor) {
+        cache->free_offset = align_up(size, sizeof(void *));
+        object_bytes = cache->free_offset + sizeof(void *);
+    } else if (object_bytes < sizeof(void *)) {
+        object_bytes = sizeof(void *);
+    }
+
+    cache->name = name;
+    cache->object_size = size;
+    cache->align = align;
+    cache->stride = align_up(object_bytes, align);
+    cache->ctor = ctor;
+    cache->free_list = 0;
+    cache->slabs = 0;
+    cache->total_objects = 0;
+    cache->active_objects = 0;
+
+    cache->slab_size = SLAB_SIZE;
+    uint32_t needed = sizeof(kmem_slab_t) + align + cache->stride * SLAB_MIN_OBJECTS;
+    if (needed > cache->slab_size) {
+        cache->slab_size = needed;
+    }
+}
+
+/* Add one slab worth of objects to the cache free list */
+static int kmem_cache_grow(kmem_cache_t *cache) {
+    uint8_t *chunk = kmalloc(cache->slab_size);
+    if (!chunk) return -1;
+
+    kmem_slab_t *slab = (kmem_slab_t *)chunk;
+    slab->next = cache->slabs;
+    cache->slabs = slab;
+
+    uintptr_t obj = ((uintptr_t)chunk + sizeof(kmem_slab_t) + cache->align - 1) & ~(uintptr_t)(cache->align - 1);
+    uintptr_t end = (uintptr_t)chunk + cache->slab_size;
+
+    while (obj + cache->stride <= end) {
+        if (cache->ctor) {
+            cache->ctor((void *)obj);
+        }
+        *free_link(cache, (void *)obj) = cache->free_list;
+        cache->free_list = (void *)obj;
+        cache->total_objects++;
+        obj += cache->stride;
+    }
+
+    return 0;
+}
+
+/* Create a new object cache */
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t size, uint32_t align, kmem_ctor_t ctor) {
+    if (size == 0 || (align & (align - 1))) return 0;
+
+    if (!cache_cache_ready) {
+        kmem_cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0, 0);
+        cache_cache_ready = 1;
+    }
+
+    kmem_cache_t *cache = kmem_cache_alloc(&cache_cache);
+    if (!cache) return 0;
+
+    kmem_cache_setup(cache, name, size, align, ctor);
+    return cache;
+}
+
+/* Destroy a cache and release every slab it owns */
+void kmem_cache_destroy(kmem_cache_t *cache) {
+    if (!cache) return;
+
+    kmem_slab_t *slab = cache->slabs;
+    while (slab) {
+        kmem_slab_t *next = slab->next;
+        kfree(slab);
+        slab = next;
+    }
+
+    kmem_cache_free(&cache_cache, cache);
+}
+
+/* Allocate an object from a cache */
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    if (!cache) return 0;
+
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    if (!cache->free_list && kmem_cache_grow(cache) != 0) {
+        rspin_unlock_irqrestore(&mm_lock, flags);
+        return 0; /* Out of memory */
+    }
+
+    void *obj = cache->free_list;
+    cache->free_list = *free_link(cache, obj);
+    cache->active_objects++;
+    rspin_unlock_irqrestore(&mm_lock, flags);
+
+    return obj;
+}
+
+/* Return an object to its cache */
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (!cache || !obj) return;
+
+    uintptr_t flags = rspin_lock_irqsave(&mm_lock);
+    *free_link(cache, obj) = cache->free_list;
+    cache->free_list = obj;
+    cache->active_objects--;
+    rspin_unlock_irqrestore(&mm_lock, flags);
+}
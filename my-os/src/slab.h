@@ -0,0 +1,44 @@
+/**
+ * @file slab.h
+ * @brief Slab object caches for fixed-size kernel objects
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+
+#define SLAB_SIZE          4096  /* Default backing chunk per slab */
+#define SLAB_MIN_OBJECTS   8     /* Grow the chunk for large objects */
+#define SLAB_CACHE_LINE    64
+
+/* Optional constructor, run once when an object is first carved */
+typedef void (*kmem_ctor_t)(void *obj);
+
+/* Slab header at the start of every backing chunk */
+typedef struct kmem_slab {
+    struct kmem_slab *next;
+} kmem_slab_t;
+
+/* Object cache */
+typedef struct kmem_cache {
+    const char *name;
+    uint32_t object_size;     /* Size requested by the user */
+    uint32_t align;           /* Object alignment inside a slab */
+    uint32_t stride;          /* Distance between two objects */
+    uint32_t free_offset;     /* Where the free list link lives */
+    uint32_t slab_size;       /* Bytes requested from kmalloc per slab */
+    kmem_ctor_t ctor;
+    void *free_list;          /* Per-cache list of free objects */
+    kmem_slab_t *slabs;       /* Every chunk owned by this cache */
+    uint32_t total_objects;
+    uint32_t active_objects;
+} kmem_cache_t;
+
+/* Function prototypes */
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t size, uint32_t align, kmem_ctor_t ctor);
+void kmem_cache_destroy(kmem_cache_t *cache);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+#endif
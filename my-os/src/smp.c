@@ -0,0 +1,276 @@
+/**
+ * @file smp.c
+ * @brief Application processor start-up and the per-CPU table
+ */
+
+#include "smp.h"
+#include "acpi.h"
+#include "apic.h"
+#include "idt.h"
+#include "kernel.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "vmm.h"
+
+/* CPU 0 is the bootstrap processor; init_gdt() points its %gs here */
+static cpu_t cpus[SMP_MAX_CPUS] = { [0] = { .self = &cpus[0], .id = 0, .online = 1 } };
+static volatile uint32_t cpu_count = 1;
+
+cpu_t *smp_cpu(uint32_t id) {
+    return id < SMP_MAX_CPUS ? &cpus[id] : 0;
+}
+
+/* CPUs started so far, the bootstrap processor included */
+uint32_t smp_cpu_count() {
+    return cpu_count;
+}
+
+int smp_cpu_online(uint32_t id) {
+    return id < cpu_count && cpus[id].online;
+}
+
+#ifdef __x86_64__
+
+void smp_init() {
+    vga_print("SMP: kernel x86_64 solo sul processore di avvio", 0, 16, VGA_COLOR_YELLOW);
+}
+
+void smp_broadcast_tick() {
+}
+
+void smp_kick(uint32_t id) {
+    (void)id;
+}
+
+uintptr_t smp_tick_handler(uintptr_t frame) {
+    return frame;
+}
+
+uintptr_t smp_kick_handler(uintptr_t frame) {
+    return frame;
+}
+
+void smp_tlb_shootdown(uintptr_t virt, uint32_t pages) {
+    vmm_flush_local(virt, pages);
+}
+
+void smp_tlb_poll() {
+}
+
+void smp_tlb_handler() {
+}
+
+void ap_main(cpu_t *cpu) {
+    (void)cpu;
+}
+
+#else
+
+/* The shootdown in flight; tlb_lock keeps it to one at a time */
+static spinlock_t tlb_lock = SPINLOCK_INIT;
+static volatile uintptr_t tlb_virt;
+static volatile uint32_t tlb_pages;
+static volatile uint32_t tlb_acks_pending;
+
+/* Real mode trampoline in boot.s, copied to SMP_TRAMPOLINE_ADDR */
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_params[];
+extern uint8_t ap_trampoline_end[];
+
+static void delay_ticks(uint32_t ticks) {
+    uint32_t start = get_tick_count();
+    while (get_tick_count() - start < ticks) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+/* INIT-SIPI-SIPI; returns 0 once the AP reports itself online */
+static int start_ap(cpu_t *cpu) {
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL | LAPIC_ICR_ASSERT);
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL);
+    delay_ticks(SMP_INIT_DELAY_TICKS);
+
+    /* The second SIPI is only for CPUs that missed the first */
+    for (int attempt = 0; attempt < 2 && !cpu->online; attempt++) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+        delay_ticks(1);
+    }
+
+    uint32_t start = get_tick_count();
+    while (!cpu->online) {
+        if (get_tick_count() - start >= SMP_AP_TIMEOUT_TICKS) return -1;
+        __asm__ __volatile__("pause");
+    }
+    return 0;
+}
+
+/*
+ * Start every processor listed in the MADT. Runs on the bootstrap
+ * processor once paging, the heap and the timer are up (the start-up
+ * delays are counted in timer ticks).
+ */
+void smp_init() {
+    acpi_cpu_info_t info;
+    if (acpi_get_cpu_info(&info) != 0 || info.cpu_count < 2) {
+        vga_print("SMP: un solo processore", 0, 16, VGA_COLOR_YELLOW);
+        return;
+    }
+
+    uintptr_t flags;
+    __asm__ __volatile__("pushf; pop %0" : "=r"(flags));
+    if (!(flags & EFLAGS_IF) || (!lapic_present() && lapic_init(info.lapic_base) != 0)) {
+        vga_print("ERRORE: SMP - APIC locale non disponibile", 0, 16, VGA_COLOR_RED);
+        return;
+    }
+    cpus[0].apic_id = lapic_id();
+
+    /* Copy the trampoline and tell it how to reach the kernel */
+    uint8_t *trampoline = (uint8_t *)SMP_TRAMPOLINE_ADDR;
+    for (uint32_t i = 0; i < (uint32_t)(ap_trampoline_end - ap_trampoline_start); i++) {
+        trampoline[i] = ap_trampoline_start[i];
+    }
+    smp_trampoline_params_t *params =
+        (smp_trampoline_params_t *)(trampoline + (ap_trampoline_params - ap_trampoline_start));
+
+    uintptr_t cr3, cr4;
+    __asm__ __volatile__("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+    params->cr3 = cr3;
+    params->cr4 = cr4;
+    params->efer_nxe = vmm_nx_flag() != 0;
+    params->entry = (uint32_t)ap_main;
+
+    for (uint32_t i = 0; i < info.cpu_count && cpu_count < SMP_MAX_CPUS; i++) {
+        if (info.apic_ids[i] == cpus[0].apic_id) continue;
+
+        cpu_t *cpu = &cpus[cpu_count];
+        cpu->self = cpu;
+        cpu->id = cpu_count;
+        cpu->irq_nesting = 0;
+        cpu->apic_id = info.apic_ids[i];
+        cpu->online = 0;
+        cpu->stack = kmalloc_aligned(SMP_AP_STACK_SIZE, 16);
+        if (!cpu->stack) break;
+
+        params->stack = (uint32_t)(cpu->stack + SMP_AP_STACK_SIZE);
+        params->cpu = (uint32_t)cpu;
+
+        if (start_ap(cpu) == 0) {
+            cpu_count++;
+        } else {
+            /* Park it in wait-for-SIPI again before reusing the slot */
+            lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL | LAPIC_ICR_ASSERT);
+            kfree_aligned(cpu->stack);
+            cpu->stack = 0;
+        }
+    }
+
+    char buffer[16];
+    itoa(cpu_count, buffer, 10);
+    vga_print("SMP: processori attivi:", 0, 16, VGA_COLOR_LIGHT_GREEN);
+    vga_print(buffer, 24, 16, VGA_COLOR_LIGHT_GREEN);
+}
+
+/* First C code an AP runs, on its boot stack with paging on */
+void ap_main(cpu_t *cpu) {
+    gdt_init_cpu(cpu);
+    idt_load();
+    lapic_enable();
+
+    /* This context becomes the CPU's idle task */
+    sched_init_cpu();
+    timer_start_cpu();
+    __sync_synchronize();
+    cpu->online = 1;
+
+    sched_idle_loop();
+}
+
+/* Called from the PIT's timer_handler() on the BSP: pass the tick on to the busy APs */
+void smp_broadcast_tick() {
+    for (uint32_t id = 1; id < cpu_count; id++) {
+        if (!cpus[id].idle) {
+            lapic_send_ipi(cpus[id].apic_id, LAPIC_ICR_FIXED | SMP_TICK_VECTOR);
+        }
+    }
+}
+
+/* Wake a CPU from its idle loop so it schedules the work just queued */
+void smp_kick(uint32_t id) {
+    if (id < cpu_count && id != smp_cpu_id()) {
+        cpus[id].idle = 0;
+        lapic_send_ipi(cpus[id].apic_id, LAPIC_ICR_FIXED | SMP_KICK_VECTOR);
+    }
+}
+
+/* SMP_TICK_VECTOR handler on the APs: the same preemption as isr32 */
+uintptr_t smp_tick_handler(uintptr_t frame) {
+    lapic_eoi();
+    return schedule(frame);
+}
+
+/* SMP_KICK_VECTOR handler: run the scheduler, but this is not a tick */
+uintptr_t smp_kick_handler(uintptr_t frame) {
+    lapic_eoi();
+    return sched_reschedule(frame);
+}
+
+/* Flush the range of a shootdown addressed to this CPU, if there is one */
+void smp_tlb_poll() {
+    cpu_t *cpu = &cpus[smp_cpu_id()];
+    if (cpu->tlb_flush) {
+        vmm_flush_local(tlb_virt, tlb_pages);
+        cpu->tlb_flush = 0;
+        __sync_fetch_and_sub(&tlb_acks_pending, 1);
+    }
+}
+
+/* SMP_TLB_VECTOR handler */
+void smp_tlb_handler() {
+    smp_tlb_poll();
+    lapic_eoi();
+}
+
+/*
+ * Invalidate 'pages' pages at 'virt' on every online CPU and return once
+ * all of them have done so; only then may the frames behind the range be
+ * freed or reused. The caller must already have cleared the entries.
+ */
+void smp_tlb_shootdown(uintptr_t virt, uint32_t pages) {
+    uintptr_t flags = irq_save();
+    vmm_flush_local(virt, pages);
+
+    if (cpu_count > 1) {
+        /* Whoever holds tlb_lock may be waiting for this CPU's answer */
+        while (!spin_trylock(&tlb_lock)) {
+            smp_tlb_poll();
+            __asm__ __volatile__("pause");
+        }
+
+        uint32_t self = smp_cpu_id();
+        uint32_t targets = 0;
+        for (uint32_t id = 0; id < cpu_count; id++) {
+            if (id != self && cpus[id].online) targets++;
+        }
+        tlb_virt = virt;
+        tlb_pages = pages;
+        tlb_acks_pending = targets;
+        __sync_synchronize();
+
+        for (uint32_t id = 0; id < cpu_count; id++) {
+            if (id != self && cpus[id].online) {
+                cpus[id].tlb_flush = 1;
+                lapic_send_ipi(cpus[id].apic_id, LAPIC_ICR_FIXED | SMP_TLB_VECTOR);
+            }
+        }
+        while (tlb_acks_pending) {
+            __asm__ __volatile__("pause" : : : "memory");
+        }
+        spin_unlock(&tlb_lock);
+    }
+    irq_restore(flags);
+}
+
+#endif
@@ -0,0 +1,103 @@
+/**
+ * @file smp.h
+ * @brief Multiprocessor bring-up and per-CPU data
+ *
+ * The application processors (APs) are found in the ACPI MADT and
+ * started with the INIT-SIPI-SIPI sequence through the local APIC. They
+ * begin in real mode in a trampoline copied below 1MB, switch to
+ * protected mode with the kernel page tables and enter ap_main() on
+ * their own stack.
+ *
+ * Each CPU owns a cpu_t holding its GDT, TSS and boot stack. Its GDT
+ * has a segment based at the cpu_t, loaded in %gs, so code finds its
+ * own CPU with one %gs-relative load.
+ *
+ * Each CPU ticks from its own local APIC timer (timer_use_lapic()), which
+ * it stops while halted in its idle loop. If the system still ticks from
+ * the PIT, which only interrupts the bootstrap processor, every tick is
+ * sent on as SMP_TICK_VECTOR to the busy APs instead. smp_kick() asks a
+ * CPU to look at its run queue again when work is queued for it; that is
+ * SMP_KICK_VECTOR, which reschedules without counting as a tick, so it
+ * charges no time slice or EDF budget.
+ *
+ * Page frames may only be freed once no CPU can still reach them through
+ * its TLB. smp_tlb_shootdown() flushes a range on the calling CPU, sends
+ * SMP_TLB_VECTOR to every other online CPU and waits until all of them
+ * have flushed it too. It must not be called with mm_lock or any other
+ * lock an interrupts-off CPU could be spinning on; code that spins on a
+ * lock whose holder may shoot down calls smp_tlb_poll() while it waits.
+ *
+ * The x86_64 kernel only runs on the bootstrap processor.
+ */
+
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include "gdt.h"
+
+#define SMP_MAX_CPUS          16
+#define SMP_TRAMPOLINE_ADDR   0x8000   /* Page below 1MB the APs start at (SIPI vector 0x08) */
+#define SMP_AP_STACK_SIZE     0x4000   /* 16KB boot stack per AP */
+#define SMP_TICK_VECTOR       49       /* Timer tick forwarded to the APs */
+#define SMP_TLB_VECTOR        51       /* TLB shootdown request */
+#define SMP_KICK_VECTOR       52       /* Reschedule request, see smp_kick() */
+#define SMP_INIT_DELAY_TICKS  2        /* INIT to SIPI: at least 10ms */
+#define SMP_AP_TIMEOUT_TICKS  100      /* Give up on an AP after ~1s */
+
+/* Per-CPU data; the first fields are read by the ISR stubs through %gs */
+typedef struct cpu {
+    struct cpu *self;                 /* %gs:0 */
+    uint32_t id;                      /* %gs:4, index in the CPU table */
+    volatile uint32_t irq_nesting;    /* %gs:8, see in_interrupt() */
+    uint32_t apic_id;
+    volatile uint32_t online;
+    volatile uint32_t idle;           /* Halted in the idle loop: no ticks needed */
+    volatile uint32_t tlb_flush;      /* Shootdown sent, not yet acknowledged */
+    uint8_t *stack;                   /* Boot stack of an AP, 0 on the BSP */
+    gdt_entry_t gdt[GDT_ENTRIES];
+    gdt_ptr_t gdt_ptr;
+    tss_t tss;
+} cpu_t;
+
+#define CPU_ID_OFFSET           4
+#define CPU_IRQ_NESTING_OFFSET  8
+
+/* Parameters ap_main() receives through the trampoline page */
+typedef struct {
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t efer_nxe;    /* Set EFER.NXE before paging: the tables use NX */
+    uint32_t stack;
+    uint32_t entry;
+    uint32_t cpu;
+} __attribute__((packed)) smp_trampoline_params_t;
+
+#ifdef __x86_64__
+static inline uint32_t smp_cpu_id(void) {
+    return 0;
+}
+#else
+/* Index of the CPU running the caller */
+static inline uint32_t smp_cpu_id(void) {
+    uint32_t id;
+    __asm__ __volatile__("movl %%gs:%c1, %0" : "=r"(id) : "i"(CPU_ID_OFFSET));
+    return id;
+}
+#endif
+
+/* Function prototypes */
+void smp_init();
+uint32_t smp_cpu_count();
+cpu_t *smp_cpu(uint32_t id);
+int smp_cpu_online(uint32_t id);
+void smp_broadcast_tick();
+void smp_kick(uint32_t id);
+uintptr_t smp_tick_handler(uintptr_t frame);
+uintptr_t smp_kick_handler(uintptr_t frame);
+void smp_tlb_shootdown(uintptr_t virt, uint32_t pages);
+void smp_tlb_poll();
+void smp_tlb_handler();
+void ap_main(cpu_t *cpu);
+
+#endif
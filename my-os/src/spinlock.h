@@ -0,0 +1,86 @@
+/**
+ * @file spinlock.h
+ * @brief Spinlocks for data shared between CPUs
+ *
+ * Disabling interrupts only keeps the other tasks of the same CPU out of
+ * a critical section; with application processors running, code that
+ * touches shared state also takes a spinlock. The _irqsave variants do
+ * both, which is what thread-context code wants: an interrupt handler on
+ * the same CPU must never spin on a lock its own CPU holds.
+ */
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include "idt.h"
+#include "smp.h"
+
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock(spinlock_t *lock) {
+    while (__sync_lock_test_and_set(&lock->locked, 1)) {
+        /* Wait on a plain read so the cache line is not bounced */
+        while (lock->locked) {
+            __asm__ __volatile__("pause" : : : "memory");
+        }
+    }
+}
+
+/* Take the lock only if it is free; nonzero on success */
+static inline int spin_trylock(spinlock_t *lock) {
+    return !__sync_lock_test_and_set(&lock->locked, 1);
+}
+
+static inline void spin_unlock(spinlock_t *lock) {
+    __sync_lock_release(&lock->locked);
+}
+
+static inline uintptr_t spin_lock_irqsave(spinlock_t *lock) {
+    uintptr_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uintptr_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+/*
+ * Recursive spinlock: the CPU holding it may take it again. Used where
+ * layers call back into each other with the lock held, e.g. the heap
+ * growing through the PMM, whose shrinkers trim the heap again.
+ */
+typedef struct {
+    spinlock_t lock;
+    volatile int32_t owner;    /* CPU holding the lock, -1 if free */
+    uint32_t depth;
+} rspinlock_t;
+
+#define RSPINLOCK_INIT { SPINLOCK_INIT, -1, 0 }
+
+static inline uintptr_t rspin_lock_irqsave(rspinlock_t *lock) {
+    uintptr_t flags = irq_save();
+    int32_t cpu = (int32_t)smp_cpu_id();
+    if (lock->owner != cpu) {
+        spin_lock(&lock->lock);
+        lock->owner = cpu;
+    }
+    lock->depth++;
+    return flags;
+}
+
+static inline void rspin_unlock_irqrestore(rspinlock_t *lock, uintptr_t flags) {
+    if (--lock->depth == 0) {
+        lock->owner = -1;
+        spin_unlock(&lock->lock);
+    }
+    irq_restore(flags);
+}
+
+#endif
@@ -0,0 +1,190 @@
+/**
+ * @file threadpool.c
+ * @brief Work-stealing worker pool implementation
+ */
+
+#include "threadpool.h"
+#include "scheduler.h"
+#include "idt.h"
+
+#define TP_SPINS_BEFORE_YIELD 64   /* Failed steals before a worker lets others run */
+
+/* The loop currently on the pool */
+static struct {
+    volatile uint32_t busy;         /* A parallel_for owns the pool */
+    parallel_fn_t fn;
+    void *arg;
+    uint32_t grain;
+    volatile uint32_t remaining;    /* Iterations not yet finished */
+} pool;
+
+/* Deque per worker, plus the last one for the parallel_for caller */
+static tp_deque_t deques[THREADPOOL_MAX_WORKERS + 1];
+static task_t *workers[THREADPOOL_MAX_WORKERS];
+static uint32_t nr_workers = 0;
+static volatile uint32_t started_workers = 0;
+
+/* Owner only: add a range at the bottom; -1 when full */
+static int deque_push(tp_deque_t *deque, tp_range_t range) {
+    int32_t bottom = deque->bottom;
+    int32_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= THREADPOOL_DEQUE_SIZE - 1) return -1;
+
+    deque->slots[bottom & (THREADPOOL_DEQUE_SIZE - 1)] = range;
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Owner only: take the most recently pushed range; -1 when empty */
+static int deque_pop(tp_deque_t *deque, tp_range_t *range) {
+    int32_t bottom = deque->bottom - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int32_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        deque->bottom = bottom + 1;   /* Empty */
+        return -1;
+    }
+
+    *range = deque->slots[bottom & (THREADPOOL_DEQUE_SIZE - 1)];
+    if (top == bottom) {
+        /* Last element: race the thieves for it */
+        int won = __atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        deque->bottom = bottom + 1;
+        return won ? 0 : -1;
+    }
+    return 0;
+}
+
+/* Any CPU: take the oldest (largest) range; -1 when empty or lost a race */
+static int deque_steal(tp_deque_t *deque, tp_range_t *range) {
+    int32_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int32_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) return -1;
+
+    /* The owner never overwrites this slot while 'top' is unchanged */
+    tp_range_t stolen = deque->slots[top & (THREADPOOL_DEQUE_SIZE - 1)];
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return -1;
+    }
+    *range = stolen;
+    return 0;
+}
+
+/* Try every other deque once, starting at a pseudo-random victim */
+static int steal_any(tp_deque_t *own, uint32_t *seed, tp_range_t *range) {
+    uint32_t count = nr_workers + 1;
+
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+
+    uint32_t victim = *seed % count;
+    for (uint32_t i = 0; i < count; i++) {
+        tp_deque_t *deque = &deques[victim];
+        if (deque != own && deque_steal(deque, range) == 0) return 0;
+        if (++victim == count) victim = 0;
+    }
+    return -1;
+}
+
+/* Split 'range' down to the grain, leaving the upper halves to thieves */
+static void run_range(tp_deque_t *own, tp_range_t range) {
+    while (range.end - range.begin > pool.grain) {
+        tp_range_t upper;
+        upper.begin = range.begin + (range.end - range.begin) / 2;
+        upper.end = range.end;
+        if (deque_push(own, upper) != 0) break;
+        range.end = upper.begin;
+    }
+
+    pool.fn(range.begin, range.end, pool.arg);
+    __sync_fetch_and_sub(&pool.remaining, range.end - range.begin);
+}
+
+/* Work on the current loop until every iteration is done */
+static void participate(tp_deque_t *own, uint32_t *seed) {
+    uint32_t spins = 0;
+    tp_range_t range;
+
+    while (pool.remaining) {
+        if (deque_pop(own, &range) == 0 || steal_any(own, seed, &range) == 0) {
+            run_range(own, range);
+            spins = 0;
+        } else if (++spins >= TP_SPINS_BEFORE_YIELD) {
+            spins = 0;
+            task_yield();
+        } else {
+            __asm__ __volatile__("pause");
+        }
+    }
+}
+
+static void worker_main() {
+    uint32_t index = __sync_fetch_and_add(&started_workers, 1);
+    tp_deque_t *own = &deques[index];
+    uint32_t seed = index * 2654435761u + 1;
+
+    while (1) {
+        /* A wakeup that comes before we block is not lost */
+        task_block();
+        participate(own, &seed);
+    }
+}
+
+/*
+ * Start one worker per CPU beyond the first; the caller of parallel_for
+ * does its share too. Returns the number of workers.
+ */
+int threadpool_init() {
+    uint32_t wanted = smp_cpu_count() - 1;
+    if (wanted > THREADPOOL_MAX_WORKERS) wanted = THREADPOOL_MAX_WORKERS;
+
+    while (nr_workers < wanted) {
+        task_t *task = create_task(worker_main, TASK_PRIORITY_DEFAULT);
+        if (!task) break;
+        workers[nr_workers++] = task;
+    }
+    return (int)nr_workers;
+}
+
+uint32_t threadpool_workers() {
+    return nr_workers;
+}
+
+/*
+ * Call fn on pieces of [begin, end) of at most 'grain' iterations, in
+ * parallel on the pool; returns when all of them are done.
+ */
+void parallel_for(uint32_t begin, uint32_t end, uint32_t grain, parallel_fn_t fn, void *arg) {
+    if (end <= begin) return;
+    if (grain == 0) grain = 1;
+
+    if (end - begin <= grain || !nr_workers || in_interrupt() ||
+        __sync_lock_test_and_set(&pool.busy, 1)) {
+        fn(begin, end, arg);
+        return;
+    }
+
+    pool.fn = fn;
+    pool.arg = arg;
+    pool.grain = grain;
+    pool.remaining = end - begin;
+    __sync_synchronize();
+
+    for (uint32_t i = 0; i < nr_workers; i++) {
+        task_wake(workers[i]);
+    }
+
+    tp_deque_t *own = &deques[nr_workers];
+    uint32_t seed = (uint32_t)(uintptr_t)arg | 1;
+    tp_range_t range = { begin, end };
+    run_range(own, range);
+    participate(own, &seed);
+
+    __sync_lock_release(&pool.busy);
+}
@@ -0,0 +1,49 @@
+/**
+ * @file threadpool.h
+ * @brief Kernel worker pool with work-stealing deques and parallel_for
+ *
+ * One worker task per additional CPU. parallel_for() hands the whole
+ * range to the caller's deque; whoever runs a range splits it in half,
+ * pushes the upper half on its own deque and keeps going with the
+ * lower one until a piece is no larger than the grain. Idle workers
+ * steal from the top of the other deques, i.e. the biggest pieces.
+ *
+ * The deques are Chase-Lev: the owner pushes and pops at the bottom
+ * without locks, thieves take from the top with a single CAS.
+ *
+ * One loop runs on the pool at a time. A nested call, a call while the
+ * pool is busy, from an interrupt handler or before threadpool_init()
+ * just runs the loop on the caller.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdint.h>
+#include "smp.h"
+
+#define THREADPOOL_MAX_WORKERS  (SMP_MAX_CPUS - 1)
+#define THREADPOOL_DEQUE_SIZE   256   /* Power of two; a full deque runs work inline */
+
+/* Body of a parallel loop: handles iterations [begin, end) */
+typedef void (*parallel_fn_t)(uint32_t begin, uint32_t end, void *arg);
+
+/* A piece of the current loop's iteration space */
+typedef struct {
+    uint32_t begin;
+    uint32_t end;
+} tp_range_t;
+
+/* Chase-Lev deque; 'top' and 'bottom' only ever grow */
+typedef struct {
+    volatile int32_t top;
+    volatile int32_t bottom;
+    tp_range_t slots[THREADPOOL_DEQUE_SIZE];
+} tp_deque_t;
+
+/* Function prototypes */
+int threadpool_init();
+uint32_t threadpool_workers();
+void parallel_for(uint32_t begin, uint32_t end, uint32_t grain, parallel_fn_t fn, void *arg);
+
+#endif
@@ -4,10 +4,14 @@
  */
 
 #include "timer.h"
+#include "apic.h"
 #include "idt.h"
 #include "pic.h"
 #include "kernel.h"
 #include "scheduler.h"
+#include "smp.h"
+#include "deferred.h"
+#include "ktimer.h"
 
 /* Ports for I/O operations */
 static inline void outb(uint16_t port, uint8_t val) {
@@ -20,41 +24,222 @@ static inline uint8_t inb(uint16_t port) {
     return ret;
 }
 
+/* End of the demo: printing is too slow for the interrupt handler */
+static void demo_shutdown(void *arg) {
+    (void)arg;
+    vga_print("Demo AI completata! Spegnimento sicuro...", 0, 45, VGA_COLOR_RED);
+    __asm__ __volatile__("cli; hlt");
+}
+
+static deferred_work_t shutdown_work = DEFERRED_WORK_INIT(demo_shutdown, 0);
+
 /* Global tick counter */
 static uint32_t tick_count = 0;
 
+/* PIT input clocks per tick */
+static uint32_t pit_divisor = 0;
+
+/* Ticks the armed one-shot stands for, 0 while the PIT is periodic */
+static uint32_t oneshot_ticks = 0;
+
+/* PIT clocks of partial ticks left over by early wakeups */
+static uint32_t oneshot_residual = 0;
+
+/* Every CPU ticks from its local APIC timer; the PIT is masked */
+#ifdef __x86_64__
+#define lapic_mode 0
+#else
+static int lapic_mode = 0;
+#endif
+
+static void pit_program(uint8_t mode, uint32_t count) {
+    outb(PIT_CMD_REG, mode | PIT_CMD_CHANNEL0);
+    outb(PIT_CHANNEL0, (uint8_t)(count & 0xFF));
+    outb(PIT_CHANNEL0, (uint8_t)((count >> 8) & 0xFF));
+}
+
 /* Initialize the PIT to generate interrupts at specified frequency */
 void pit_init(uint32_t frequency) {
-    uint32_t divisor = PIT_FREQUENCY / frequency;
+    pit_divisor = PIT_FREQUENCY / frequency;
+    pit_program(PIT_MODE_SQUARE_WAVE, pit_divisor);
+}
 
-    /* Send the command byte */
-    outb(PIT_CMD_REG, PIT_MODE_SQUARE_WAVE | PIT_CMD_CHANNEL0);
+/* Longest one-shot the timer can hold, in ticks */
+uint32_t timer_max_sleep_ticks() {
+#ifndef __x86_64__
+    if (lapic_mode) return lapic_timer_max_ticks();
+#endif
+    return pit_divisor ? PIT_MAX_COUNT / pit_divisor : 0;
+}
 
-    /* Divisor has to be sent byte-wise */
-    uint8_t low = (uint8_t)(divisor & 0xFF);
-    uint8_t high = (uint8_t)((divisor >> 8) & 0xFF);
+/*
+ * Replace the calling CPU's periodic tick with a single interrupt 'ticks'
+ * ticks from now (clamped to timer_max_sleep_ticks()), or with none for
+ * TIMER_TICKLESS_FOREVER. Called by the idle loop with interrupts
+ * disabled when nothing needs the tick until then. With the PIT only the
+ * BSP has a tick of its own.
+ */
+void timer_tickless_enter(uint32_t ticks) {
+#ifndef __x86_64__
+    if (lapic_mode) {
+        if (ticks == TIMER_TICKLESS_FOREVER) {
+            lapic_timer_stop();
+        } else if (ticks >= 2) {
+            lapic_timer_oneshot(ticks);
+        }
+        return;
+    }
+#endif
+    if (smp_cpu_id() != 0) return;
 
-    outb(PIT_CHANNEL0, low);
-    outb(PIT_CHANNEL0, high);
+    uint32_t max = timer_max_sleep_ticks();
+    if (ticks > max) ticks = max;
+    if (ticks < 2 || oneshot_ticks) return;
+
+    oneshot_ticks = ticks;
+    pit_program(PIT_MODE_ONESHOT, ticks * pit_divisor);
 }
 
-/* Timer interrupt handler - called on each timer tick */
-void timer_handler() {
-    tick_count++;
+/*
+ * Back to the periodic tick after an early wakeup, crediting the ticks
+ * that went by. Interrupts must be disabled. If the one-shot already
+ * fired its interrupt is pending and timer_handler() does the work.
+ */
+void timer_tickless_exit() {
+#ifndef __x86_64__
+    if (lapic_mode) {
+        lapic_timer_resume();
+        /* Credit only: the next tick runs the timers that came due */
+        if (smp_cpu_id() == 0) tick_count += lapic_timer_ticks();
+        return;
+    }
+#endif
+    if (!oneshot_ticks || smp_cpu_id() != 0) return;
+
+    outb(PIT_CMD_REG, PIT_READBACK_STATUS0);
+    if (inb(PIT_CHANNEL0) & PIT_STATUS_OUT) return;
+
+    /* Latch channel 0 and read how far it counted down */
+    outb(PIT_CMD_REG, PIT_CMD_CHANNEL0);
+    uint32_t left = inb(PIT_CHANNEL0);
+    left |= (uint32_t)inb(PIT_CHANNEL0) << 8;
+
+    uint32_t elapsed = oneshot_ticks * pit_divisor - left + oneshot_residual;
+    tick_count += elapsed / pit_divisor;
+    oneshot_residual = elapsed % pit_divisor;
+    oneshot_ticks = 0;
+    pit_program(PIT_MODE_SQUARE_WAVE, pit_divisor);
+}
 
-    /* For stability, only log ticks without complex task switching */
-    /* Task switching disabled to prevent interrupt race conditions */
+/* Count 'ticks' more ticks on the BSP and run what came due */
+static void timer_advance(uint32_t ticks) {
+    tick_count += ticks;
 
     /* Prevent infinite demo - exit after reasonable period */
     if (tick_count >= 2000) { /* ~20 seconds at 100Hz for quick demo */
-        vga_print("Demo AI completata! Spegnimento sicuro...", 0, 45, VGA_COLOR_RED);
-        __asm__ __volatile__("cli; hlt");
+        defer_work(&shutdown_work);
+    }
+
+    /* Kernel timers that came due, a one-shot's ticks included */
+    ktimer_run(tick_count);
+}
+
+/*
+ * Timer interrupt handler - called on each timer tick with the frame of
+ * the interrupted task; returns the frame isr32 should resume.
+ */
+uintptr_t timer_handler(uintptr_t frame) {
+    if (oneshot_ticks) {
+        /* The idle loop's one-shot: it covered several ticks */
+        timer_advance(oneshot_ticks);
+        oneshot_ticks = 0;
+        pit_program(PIT_MODE_SQUARE_WAVE, pit_divisor);
+    } else {
+        timer_advance(1);
     }
 
     /* Send EOI to PIC */
     pic_send_eoi(0);
+
+    /* Only this CPU gets the PIT: pass the tick on */
+    smp_broadcast_tick();
+
+    /* Preempt the running task once its time slice is used up */
+    return schedule(frame);
+}
+
+#ifdef __x86_64__
+
+/* The x86_64 kernel has no local APIC driver: it stays on the PIT */
+int timer_use_lapic(uint32_t frequency) {
+    (void)frequency;
+    return -1;
+}
+
+void timer_start_cpu() {
 }
 
+uintptr_t lapic_timer_handler(uintptr_t frame) {
+    return frame;
+}
+
+#else
+
+/*
+ * Move the tick from the PIT to the local APIC timers at 'frequency'
+ * ticks a second, starting the BSP's. The PIT only served to calibrate
+ * the TSC (clock_init()), which in turn calibrates the APIC timers.
+ * Returns -1 and keeps the PIT if that cannot be done.
+ */
+int timer_use_lapic(uint32_t frequency) {
+    /* Right after a tick, so no PIT interrupt is pending when it is masked */
+    uintptr_t flags;
+    __asm__ __volatile__("pushf; pop %0" : "=r"(flags));
+    if (flags & EFLAGS_IF) {
+        uint32_t tick = tick_count;
+        while (*(volatile uint32_t *)&tick_count == tick) {
+            __asm__ __volatile__("pause");
+        }
+    }
+
+    flags = irq_save();
+    if (lapic_timer_init(frequency) != 0) {
+        irq_restore(flags);
+        return -1;
+    }
+
+    pic_set_mask(0);
+    oneshot_ticks = 0;
+    lapic_mode = 1;
+    lapic_timer_start();
+    irq_restore(flags);
+    return 0;
+}
+
+/* Start the calling AP's own tick, if the system ticks from the APIC */
+void timer_start_cpu() {
+    if (!lapic_mode) return;
+
+    uintptr_t flags = irq_save();
+    lapic_timer_start();
+    irq_restore(flags);
+}
+
+/*
+ * LAPIC_TIMER_VECTOR handler on every CPU. The BSP also keeps the tick
+ * count, by TSC time so that one-shots and late ticks count right.
+ */
+uintptr_t lapic_timer_handler(uintptr_t frame) {
+    lapic_timer_interrupt();
+    if (smp_cpu_id() == 0) {
+        uint32_t ticks = lapic_timer_ticks();
+        if (ticks) timer_advance(ticks);
+    }
+    return schedule(frame);
+}
+
+#endif
+
 /* Get current tick count */
 uint32_t get_tick_count() {
     return tick_count;
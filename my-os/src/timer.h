@@ -1,6 +1,11 @@
 /**
  * @file timer.h
  * @brief PIT (Programmable Interval Timer) 8253/8254 management
+ *
+ * The PIT gives the boot tick and calibrates the TSC. Once
+ * timer_use_lapic() succeeds every CPU ticks from its own local APIC
+ * timer instead (apic.h) and the PIT interrupt is masked; the tick count
+ * and its 100Hz rate stay the same. The x86_64 kernel keeps the PIT.
  */
 
 #ifndef TIMER_H
@@ -33,10 +38,31 @@
 
 /* PIT modes */
 #define PIT_MODE_SQUARE_WAVE  PIT_CMD_MODE3 | PIT_CMD_BOTH | PIT_CMD_BINARY
+#define PIT_MODE_ONESHOT      (PIT_CMD_MODE0 | PIT_CMD_BOTH | PIT_CMD_BINARY)
+
+/* Read-back of channel 0's status byte; bit 7 is the OUT pin */
+#define PIT_READBACK_STATUS0  (PIT_CMD_READBACK | 0x20 | 0x02)
+#define PIT_STATUS_OUT        0x80
+#define PIT_MAX_COUNT         0xFFFF
+
+#define TIMER_TICKLESS_FOREVER  0xFFFFFFFF   /* timer_tickless_enter(): no tick at all */
+
+/* CPU time stamp counter */
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
 
 /* Function prototypes */
 void pit_init(uint32_t frequency);
-void timer_handler();
+uintptr_t timer_handler(uintptr_t frame);
 uint32_t get_tick_count();
+uint32_t timer_max_sleep_ticks();
+void timer_tickless_enter(uint32_t ticks);
+void timer_tickless_exit();
+int timer_use_lapic(uint32_t frequency);
+void timer_start_cpu();
+uintptr_t lapic_timer_handler(uintptr_t frame);
 
 #endif
@@ -0,0 +1,541 @@
+/**
+ * @file vmm.c
+ * @brief Implementation of the kernel page tables
+ *
+ * RAM is identity mapped with large pages (4MB PSE, or 2MB under PAE)
+ * marked global, so the kernel text, heap and page tables cost one TLB
+ * entry per large page and survive CR3 reloads. Large buffers (model
+ * weights, tensors) get their own range in a virtual window, backed by
+ * large page frames where the PMM has them and by 4KB pages otherwise.
+ *
+ * Under PAE the four page directories are laid out back to back, so the
+ * code below still sees a single array of PDEs indexed by virt >> 21.
+ *
+ * The tables and the window allocator are shared by every CPU and change
+ * under mm_lock. Removing a mapping clears the entry under the lock and
+ * then shoots the range down on all CPUs (smp.h) with the lock dropped;
+ * the frames behind it are freed only after that.
+ */
+
+#include "vmm.h"
+#include "kernel.h"
+#include "smp.h"
+#include "framebuffer.h"
+
+extern uint8_t __kernel_end[];
+
+static pde_t kernel_page_dir[VMM_PDE_COUNT] __attribute__((aligned(PMM_PAGE_SIZE)));
+#if defined(__x86_64__)
+static uint64_t kernel_pml4[VMM_PTE_COUNT] __attribute__((aligned(PMM_PAGE_SIZE)));
+static uint64_t kernel_pdpt_low[VMM_PTE_COUNT] __attribute__((aligned(PMM_PAGE_SIZE)));
+static uint64_t kernel_pdpt_high[VMM_PTE_COUNT] __attribute__((aligned(PMM_PAGE_SIZE)));
+static pde_t kernel_image_dir[VMM_PTE_COUNT] __attribute__((aligned(PMM_PAGE_SIZE)));
+#elif defined(CONFIG_PAE)
+static uint64_t kernel_pdpt[VMM_PDPT_ENTRIES] __attribute__((aligned(32)));
+#endif
+static int paging_enabled = 0;
+static pte_t global_flag = 0;   /* PTE_GLOBAL if the CPU has PGE */
+static pte_t nx_flag = 0;       /* PTE_NX if PAE is on and the CPU has NX */
+
+/* Window allocator: the head slot of a range holds its length in slots */
+#define VMM_SLOT_FREE 0x0000
+#define VMM_SLOT_TAIL 0xFFFF
+static uint16_t window_slots[VMM_WINDOW_SLOTS];
+
+/* One page per CPU in the window, see vmm_map_scratch() */
+static uintptr_t scratch_base = 0;
+
+static inline void invlpg(uintptr_t virt) {
+    __asm__ __volatile__("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+static inline uintptr_t read_cr0() {
+    uintptr_t value;
+    __asm__ __volatile__("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline uintptr_t read_cr4() {
+    uintptr_t value;
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+/* EDX of a CPUID leaf, 0 if the leaf does not exist */
+static inline uint32_t cpuid_edx(uint32_t leaf) {
+    uint32_t eax = leaf & 0x80000000, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (eax < leaf) return 0;
+
+    eax = leaf;
+    __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return edx;
+}
+
+/* PDE covering 'virt'; 0 past the flat PDE array (the x86_64 kernel image) */
+static inline pde_t *pde_for(uintptr_t virt) {
+    uintptr_t index = virt >> VMM_LARGE_PAGE_SHIFT;
+    return index < VMM_PDE_COUNT ? &kernel_page_dir[index] : 0;
+}
+
+/*
+ * Page table covering 'virt', allocated on demand; 0 if a large page is
+ * there. Caller holds mm_lock, so two CPUs never install one each.
+ */
+static pte_t *page_table_for(uintptr_t virt, int create) {
+    pde_t *pde = pde_for(virt);
+    if (!pde) return 0;
+
+    if (!(*pde & PTE_PRESENT)) {
+        if (!create) return 0;
+
+        phys_addr_t frame = pmm_alloc_pages(0);
+        if (!frame) return 0;
+
+        /* Page tables live in the direct map */
+        pte_t *table = (pte_t *)frame;
+        for (int i = 0; i < VMM_PTE_COUNT; i++) {
+            table[i] = 0;
+        }
+        *pde = frame | PTE_PRESENT | PTE_WRITABLE;
+    } else if (*pde & PTE_LARGE) {
+        return 0;
+    }
+
+    return (pte_t *)(uintptr_t)(*pde & PTE_FRAME_MASK);
+}
+
+/* Index of the PTE for 'virt' inside its page table */
+static inline uint32_t pte_index(uintptr_t virt) {
+    return (virt >> PMM_PAGE_SHIFT) & (VMM_PTE_COUNT - 1);
+}
+
+/*
+ * Invalidate 'pages' pages at 'virt' in this CPU's TLB. Long ranges flush
+ * everything instead, global entries included.
+ */
+void vmm_flush_local(uintptr_t virt, uint32_t pages) {
+    if (pages > VMM_FLUSH_ALL_PAGES) {
+        if (global_flag) {
+            /* Toggling CR4.PGE drops global entries too */
+            uintptr_t cr4 = read_cr4();
+            __asm__ __volatile__("mov %0, %%cr4" : : "r"(cr4 & ~(uintptr_t)CR4_PGE) : "memory");
+            __asm__ __volatile__("mov %0, %%cr4" : : "r"(cr4) : "memory");
+        } else {
+            uintptr_t cr3;
+            __asm__ __volatile__("mov %%cr3, %0" : "=r"(cr3));
+            __asm__ __volatile__("mov %0, %%cr3" : : "r"(cr3) : "memory");
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < pages; i++) {
+        invlpg(virt + ((uintptr_t)i << PMM_PAGE_SHIFT));
+    }
+}
+
+/*
+ * Map one 4KB page. Replacing a present entry (a copy on write, or a
+ * read-only remap) shoots the old translation down on every CPU.
+ */
+int vmm_map_page(uintptr_t virt, vmm_phys_t phys, pte_t flags) {
+    uintptr_t irq = rspin_lock_irqsave(&mm_lock);
+    pte_t *table = page_table_for(virt, 1);
+    if (!table) {
+        rspin_unlock_irqrestore(&mm_lock, irq);
+        return -1;
+    }
+
+    pte_t old = table[pte_index(virt)];
+    table[pte_index(virt)] = (phys & PTE_FRAME_MASK) | (flags & ~(pte_t)PTE_LARGE) | PTE_PRESENT;
+    rspin_unlock_irqrestore(&mm_lock, irq);
+
+    if (old & PTE_PRESENT) {
+        smp_tlb_shootdown(virt, 1);
+    } else {
+        invlpg(virt);
+    }
+    return 0;
+}
+
+/* Map one large page; both addresses must be large-page aligned */
+int vmm_map_large(uintptr_t virt, vmm_phys_t phys, pte_t flags) {
+    if ((virt | phys) & (VMM_LARGE_PAGE_SIZE - 1)) return -1;
+
+    pde_t *pde = pde_for(virt);
+    if (!pde) return -1;
+
+    uintptr_t irq = rspin_lock_irqsave(&mm_lock);
+    if ((*pde & PTE_PRESENT) && !(*pde & PTE_LARGE)) { /* Page table in the way */
+        rspin_unlock_irqrestore(&mm_lock, irq);
+        return -1;
+    }
+    *pde = (phys & PDE_LARGE_FRAME_MASK) | flags | PTE_LARGE | PTE_PRESENT;
+    rspin_unlock_irqrestore(&mm_lock, irq);
+
+    invlpg(virt);
+    return 0;
+}
+
+/*
+ * Remove the 4KB or large mapping of 'virt'. Returns once no CPU can use
+ * the old translation any more, so the caller may free the frame.
+ */
+void vmm_unmap(uintptr_t virt) {
+    pde_t *pde = pde_for(virt);
+    if (!pde) return;
+
+    uintptr_t irq = rspin_lock_irqsave(&mm_lock);
+    if (!(*pde & PTE_PRESENT)) {
+        rspin_unlock_irqrestore(&mm_lock, irq);
+        return;
+    }
+    if (*pde & PTE_LARGE) {
+        *pde = 0;
+    } else {
+        pte_t *table = (pte_t *)(uintptr_t)(*pde & PTE_FRAME_MASK);
+        table[pte_index(virt)] = 0;
+    }
+    rspin_unlock_irqrestore(&mm_lock, irq);
+
+    smp_tlb_shootdown(virt, 1);
+}
+
+/* Physical address behind 'virt', or 0 if it is not mapped */
+vmm_phys_t vmm_translate(uintptr_t virt) {
+    if (!paging_enabled) return virt;
+#ifdef __x86_64__
+    if (virt >= KERNEL_VMA) return KERNEL_PHYS(virt);
+#endif
+
+    pde_t *entry = pde_for(virt);
+    if (!entry) return 0;
+
+    vmm_phys_t phys = 0;
+    uintptr_t irq = rspin_lock_irqsave(&mm_lock);
+    pde_t pde = *entry;
+    if (!(pde & PTE_PRESENT)) {
+        phys = 0;
+    } else if (pde & PTE_LARGE) {
+        phys = (pde & PDE_LARGE_FRAME_MASK) | (virt & (VMM_LARGE_PAGE_SIZE - 1));
+    } else {
+        pte_t pte = ((pte_t *)(uintptr_t)(pde & PTE_FRAME_MASK))[pte_index(virt)];
+        if (pte & PTE_PRESENT) {
+            phys = (pte & PTE_FRAME_MASK) | (virt & (PMM_PAGE_SIZE - 1));
+        }
+    }
+    rspin_unlock_irqrestore(&mm_lock, irq);
+    return phys;
+}
+
+/* Reserve a large-page aligned range of the window; nothing is mapped yet */
+void *vmm_reserve(uint32_t size) {
+    uint32_t slots = (size + VMM_LARGE_PAGE_SIZE - 1) >> VMM_LARGE_PAGE_SHIFT;
+    if (size == 0 || slots > VMM_WINDOW_SLOTS || slots >= VMM_SLOT_TAIL) return 0;
+
+    uintptr_t irq = rspin_lock_irqsave(&mm_lock);
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < VMM_WINDOW_SLOTS; i++) {
+        run = (window_slots[i] == VMM_SLOT_FREE) ? run + 1 : 0;
+        if (run == slots) {
+            uint32_t first = i + 1 - slots;
+            window_slots[first] = (uint16_t)slots;
+            for (uint32_t j = first + 1; j <= i; j++) {
+                window_slots[j] = VMM_SLOT_TAIL;
+            }
+            rspin_unlock_irqrestore(&mm_lock, irq);
+            return (void *)(uintptr_t)(VMM_WINDOW_START + ((uintptr_t)first << VMM_LARGE_PAGE_SHIFT));
+        }
+    }
+    rspin_unlock_irqrestore(&mm_lock, irq);
+    return 0;
+}
+
+/* Length in slots of the window range starting at 'addr', 0 if there is none */
+static uint32_t window_range_slots(void *addr) {
+    if (!vmm_in_window(addr)) return 0;
+
+    uint32_t slots = window_slots[((uintptr_t)addr - VMM_WINDOW_START) >> VMM_LARGE_PAGE_SHIFT];
+    return (slots == VMM_SLOT_FREE || slots == VMM_SLOT_TAIL) ? 0 : slots;
+}
+
+/* Give a window range back; the caller has already unmapped it */
+void vmm_release(void *addr) {
+    uintptr_t irq = rspin_lock_irqsave(&mm_lock);
+    uint32_t slots = window_range_slots(addr);
+    uint32_t first = ((uintptr_t)addr - VMM_WINDOW_START) >> VMM_LARGE_PAGE_SHIFT;
+    for (uint32_t i = first; i < first + slots; i++) {
+        window_slots[i] = VMM_SLOT_FREE;
+    }
+    rspin_unlock_irqrestore(&mm_lock, irq);
+}
+
+int vmm_in_window(const void *addr) {
+    return (uintptr_t)addr >= VMM_WINDOW_START && (uintptr_t)addr < VMM_WINDOW_END;
+}
+
+/*
+ * Drop every mapping in the 'slots' large pages at 'virt' and free the
+ * frames, except those 'keep' claims (0: free them all). The PDEs are
+ * only marked not present at first; once every CPU has flushed the range
+ * they still tell which frames and page tables to free.
+ */
+static void unmap_window_range(uintptr_t virt, uint32_t slots, vmm_keep_t keep) {
+    pde_t *first = pde_for(virt);
+    if (!first) return;
+
+    uintptr_t irq = rspin_lock_irqsave(&mm_lock);
+    for (uint32_t s = 0; s < slots; s++) {
+        first[s] &= ~(pde_t)PTE_PRESENT;
+    }
+    rspin_unlock_irqrestore(&mm_lock, irq);
+
+    smp_tlb_shootdown(virt, slots << (VMM_LARGE_PAGE_SHIFT - PMM_PAGE_SHIFT));
+
+    /* The range is still reserved: nobody else touches these entries */
+    for (uint32_t s = 0; s < slots; s++) {
+        pde_t pde = first[s];
+        if (!pde) continue;
+        first[s] = 0;
+
+        if (pde & PTE_LARGE) {
+            pmm_free_pages((phys_addr_t)(pde & PDE_LARGE_FRAME_MASK), VMM_LARGE_PAGE_ORDER);
+            continue;
+        }
+
+        pte_t *table = (pte_t *)(uintptr_t)(pde & PTE_FRAME_MASK);
+        for (int i = 0; i < VMM_PTE_COUNT; i++) {
+            if (table[i] & PTE_PRESENT) {
+                vmm_phys_t frame = table[i] & PTE_FRAME_MASK;
+                if (!keep || !keep(frame)) pmm_free_pages((phys_addr_t)frame, 0);
+            }
+        }
+        pmm_free_pages((phys_addr_t)(uintptr_t)table, 0);
+    }
+}
+
+/*
+ * Allocate a zeroed, page aligned buffer for tensor data in the window.
+ * Every whole large page of it is backed by a single large page frame when
+ * the PMM has a free block of that order, so a sweep over multi-megabyte
+ * weights needs one TLB entry per 4MB (2MB with PAE) instead of 1024 (512).
+ */
+void *vmm_alloc_tensor(uint32_t size) {
+    if (!paging_enabled) return 0;
+
+    uint8_t *base = vmm_reserve(size);
+    if (!base) return 0;
+
+    pte_t flags = PTE_WRITABLE | global_flag | nx_flag;
+    uint32_t offset = 0;
+    while (offset < size) {
+        uintptr_t virt = (uintptr_t)base + offset;
+        uint32_t chunk = size - offset;
+
+        phys_addr_t frame = 0;
+        if (chunk >= VMM_LARGE_PAGE_SIZE) {
+            frame = pmm_alloc_pages(VMM_LARGE_PAGE_ORDER);
+        }
+
+        if (frame && vmm_map_large(virt, frame, flags) == 0) {
+            chunk = VMM_LARGE_PAGE_SIZE;
+        } else {
+            /* No large frame (or a short tail): fall back to 4KB pages */
+            if (frame) pmm_free_pages(frame, VMM_LARGE_PAGE_ORDER);
+            if (chunk > VMM_LARGE_PAGE_SIZE) chunk = VMM_LARGE_PAGE_SIZE;
+            chunk = (chunk + PMM_PAGE_SIZE - 1) & ~(uint32_t)(PMM_PAGE_SIZE - 1);
+
+            for (uint32_t page = 0; page < chunk; page += PMM_PAGE_SIZE) {
+                frame = pmm_alloc_pages(0);
+                if (!frame || vmm_map_page(virt + page, frame, flags) != 0) {
+                    if (frame) pmm_free_pages(frame, 0);
+                    vmm_free_tensor(base);
+                    return 0;
+                }
+            }
+        }
+
+        uint32_t *words = (uint32_t *)virt;
+        for (uint32_t i = 0; i < chunk / sizeof(uint32_t); i++) {
+            words[i] = 0;
+        }
+        offset += chunk;
+    }
+
+    return base;
+}
+
+/*
+ * Unmap a window range and release it. The page frames behind it are
+ * freed unless 'keep' (if not 0) returns nonzero for them, e.g. frames
+ * the range only borrowed from a cache.
+ */
+void vmm_unmap_window_keep(void *addr, vmm_keep_t keep) {
+    uintptr_t irq = rspin_lock_irqsave(&mm_lock);
+    uint32_t slots = window_range_slots(addr);
+    rspin_unlock_irqrestore(&mm_lock, irq);
+    if (!slots) return;
+
+    unmap_window_range((uintptr_t)addr, slots, keep);
+    vmm_release(addr);
+}
+
+/* Unmap a window range, free the page frames behind it and release it */
+void vmm_unmap_window(void *addr) {
+    vmm_unmap_window_keep(addr, 0);
+}
+
+/* This CPU's scratch page table entry, 0 if there is none */
+static pte_t *scratch_pte(uintptr_t virt) {
+    uintptr_t irq = rspin_lock_irqsave(&mm_lock);
+    pte_t *table = page_table_for(virt, 1);
+    rspin_unlock_irqrestore(&mm_lock, irq);
+    return table ? &table[pte_index(virt)] : 0;
+}
+
+/*
+ * Map 'frame' writable at this CPU's scratch page, e.g. to fill a
+ * highmem frame that has no direct map address; 0 on failure. No other
+ * CPU ever uses the page, so only the local TLB is flushed. The caller
+ * keeps interrupts disabled until vmm_unmap_scratch().
+ */
+void *vmm_map_scratch(vmm_phys_t frame) {
+    if (!scratch_base) return 0;
+
+    uintptr_t virt = scratch_base + ((uintptr_t)smp_cpu_id() << PMM_PAGE_SHIFT);
+    pte_t *pte = scratch_pte(virt);
+    if (!pte) return 0;
+
+    *pte = (frame & PTE_FRAME_MASK) | PTE_WRITABLE | PTE_PRESENT | nx_flag;
+    invlpg(virt);
+    return (void *)virt;
+}
+
+void vmm_unmap_scratch(void *addr) {
+    pte_t *pte = scratch_pte((uintptr_t)addr);
+    if (!pte) return;
+
+    *pte = 0;
+    invlpg((uintptr_t)addr);
+}
+
+/* Unmap a buffer from vmm_alloc_tensor() and free its page frames */
+void vmm_free_tensor(void *addr) {
+    vmm_unmap_window(addr);
+}
+
+int vmm_enabled() {
+    return paging_enabled;
+}
+
+/* PTE_NX when no-execute mappings are available, else 0 */
+pte_t vmm_nx_flag() {
+    return nx_flag;
+}
+
+/* Build the kernel page directory and turn paging on */
+void vmm_init() {
+    uint32_t features = cpuid_edx(1);
+#ifdef CONFIG_PAE
+    if (!(features & CPUID_EDX_PAE)) {
+        vga_print("ERRORE: CPU senza PAE - paginazione disattivata", 0, 17, VGA_COLOR_RED);
+        return;
+    }
+#else
+    if (!(features & CPUID_EDX_PSE)) {
+        vga_print("ERRORE: CPU senza PSE - paginazione disattivata", 0, 17, VGA_COLOR_RED);
+        return;
+    }
+#endif
+    global_flag = (features & CPUID_EDX_PGE) ? PTE_GLOBAL : 0;
+
+    for (int i = 0; i < VMM_PDE_COUNT; i++) {
+        kernel_page_dir[i] = 0;
+    }
+    for (uint32_t i = 0; i < VMM_WINDOW_SLOTS; i++) {
+        window_slots[i] = VMM_SLOT_FREE;
+    }
+
+#ifdef CONFIG_PAE
+    /* No-execute must be switched on in EFER before any PTE uses it */
+    if (cpuid_edx(0x80000001) & CPUID_EXT_EDX_NX) {
+        uint32_t lo, hi;
+        __asm__ __volatile__("rdmsr" : "=a"(lo), "=d"(hi) : "c"(MSR_EFER));
+        __asm__ __volatile__("wrmsr" : : "a"(lo | EFER_NXE), "d"(hi), "c"(MSR_EFER));
+        nx_flag = PTE_NX;
+    }
+#endif
+#if defined(__x86_64__)
+    /* PML4[0]: the low 64GB through the flat PDE array */
+    for (int i = 0; i < VMM_PTE_COUNT; i++) {
+        kernel_pml4[i] = 0;
+        kernel_pdpt_low[i] = 0;
+        kernel_pdpt_high[i] = 0;
+    }
+    for (int i = 0; i < VMM_PDE_COUNT / VMM_PTE_COUNT; i++) {
+        kernel_pdpt_low[i] = KERNEL_PHYS(&kernel_page_dir[i * VMM_PTE_COUNT]) | PTE_PRESENT | PTE_WRITABLE;
+    }
+    kernel_pml4[0] = KERNEL_PHYS(kernel_pdpt_low) | PTE_PRESENT | PTE_WRITABLE;
+
+    /* PML4[511], PDPT[510]: the kernel image at -2GB, first 1GB of RAM */
+    uintptr_t image_text_end = ((uintptr_t)__kernel_end + VMM_LARGE_PAGE_SIZE - 1) & ~(uintptr_t)(VMM_LARGE_PAGE_SIZE - 1);
+    for (int i = 0; i < VMM_PTE_COUNT; i++) {
+        uintptr_t phys = (uintptr_t)i << VMM_LARGE_PAGE_SHIFT;
+        kernel_image_dir[i] = phys | PTE_PRESENT | PTE_WRITABLE | PTE_LARGE | global_flag |
+                              (phys >= image_text_end ? nx_flag : 0);
+    }
+    kernel_pdpt_high[510] = KERNEL_PHYS(kernel_image_dir) | PTE_PRESENT | PTE_WRITABLE;
+    kernel_pml4[511] = KERNEL_PHYS(kernel_pdpt_high) | PTE_PRESENT | PTE_WRITABLE;
+#elif defined(CONFIG_PAE)
+    for (int i = 0; i < VMM_PDPT_ENTRIES; i++) {
+        kernel_pdpt[i] = KERNEL_PHYS(&kernel_page_dir[i * VMM_PTE_COUNT]) | PTE_PRESENT;
+    }
+#endif
+
+    /* Identity map all of RAM, at least up to the end of the kernel image */
+    uint64_t end = pmm_memory_end();
+    if (end < (uintptr_t)__kernel_end) end = (uintptr_t)__kernel_end;
+    end = (end + VMM_LARGE_PAGE_SIZE - 1) & ~(uint64_t)(VMM_LARGE_PAGE_SIZE - 1);
+    if (end > VMM_DIRECT_MAP_END) end = VMM_DIRECT_MAP_END;
+
+    /* Only large pages holding kernel text stay executable */
+    uintptr_t text_end = ((uintptr_t)__kernel_end + VMM_LARGE_PAGE_SIZE - 1) & ~(uintptr_t)(VMM_LARGE_PAGE_SIZE - 1);
+    for (uint32_t addr = 0; addr < end; addr += VMM_LARGE_PAGE_SIZE) {
+        vmm_map_large(addr, addr, PTE_WRITABLE | global_flag | (addr >= text_end ? nx_flag : 0));
+    }
+
+    /* Framebuffer memory is device memory: keep it uncached */
+    for (uint32_t addr = FB_ADDR; addr < FB_ADDR + FB_SIZE; addr += VMM_LARGE_PAGE_SIZE) {
+        vmm_map_large(addr, addr, PTE_WRITABLE | PTE_PCD | PTE_PWT | global_flag | nx_flag);
+    }
+
+#if defined(__x86_64__)
+    /* Long mode is already on (boot64.s): just switch to the new tables */
+    __asm__ __volatile__("mov %0, %%cr3" : : "r"(KERNEL_PHYS(kernel_pml4)) : "memory");
+#elif defined(CONFIG_PAE)
+    __asm__ __volatile__("mov %0, %%cr4" : : "r"(read_cr4() | CR4_PAE));
+    __asm__ __volatile__("mov %0, %%cr3" : : "r"(KERNEL_PHYS(kernel_pdpt)) : "memory");
+#else
+    __asm__ __volatile__("mov %0, %%cr4" : : "r"(read_cr4() | CR4_PSE));
+    __asm__ __volatile__("mov %0, %%cr3" : : "r"(KERNEL_PHYS(kernel_page_dir)) : "memory");
+#endif
+    __asm__ __volatile__("mov %0, %%cr0" : : "r"(read_cr0() | CR0_PG | CR0_WP) : "memory");
+    if (global_flag) {
+        __asm__ __volatile__("mov %0, %%cr4" : : "r"(read_cr4() | CR4_PGE));
+    }
+    paging_enabled = 1;
+    scratch_base = (uintptr_t)vmm_reserve(SMP_MAX_CPUS * PMM_PAGE_SIZE);
+
+    char buffer[16];
+    itoa((int)(end >> 20), buffer, 10);
+#if defined(__x86_64__)
+    vga_print("Paginazione attiva (x86_64 2MB) - mappa diretta (MB): ", 0, 17, VGA_COLOR_WHITE);
+    vga_print(buffer, 54, 17, VGA_COLOR_CYAN);
+#elif defined(CONFIG_PAE)
+    vga_print(nx_flag ? "Paginazione attiva (PAE 2MB, NX) - mappa diretta (MB): "
+                      : "Paginazione attiva (PAE 2MB) - mappa diretta (MB): ", 0, 17, VGA_COLOR_WHITE);
+    vga_print(buffer, nx_flag ? 56 : 52, 17, VGA_COLOR_CYAN);
+#else
+    vga_print("Paginazione attiva (PSE 4MB) - mappa diretta (MB): ", 0, 17, VGA_COLOR_WHITE);
+    vga_print(buffer, 52, 17, VGA_COLOR_CYAN);
+#endif
+}
@@ -0,0 +1,123 @@
+/**
+ * @file vmm.h
+ * @brief Kernel page tables with large (PSE or PAE) pages
+ *
+ * Virtual address space layout:
+ *   0x00000000 - 0xBFFFFFFF  Direct (identity) map of RAM, large global pages
+ *   0xC0000000 - 0xDFFFFFFF  Window for large mappings (tensors, mapped files)
+ *   0xE0000000 - ...         Framebuffer, identity mapped uncached
+ *
+ * Built with -DCONFIG_PAE the kernel uses 3-level PAE tables instead:
+ * 64-bit entries, 2MB large pages, NX, and physical frames above 4GB
+ * (see highmem.h).
+ *
+ * The x86_64 build always uses that entry format under a 4-level PML4.
+ * It keeps the same low 4GB layout, runs the kernel image from the top
+ * 2GB (KERNEL_VMA) and moves the window to 4GB..64GB.
+ */
+
+#ifndef VMM_H
+#define VMM_H
+
+#include <stdint.h>
+#include "pmm.h"
+
+#if defined(__x86_64__) && !defined(CONFIG_PAE)
+#define CONFIG_PAE   /* Long mode page tables use the PAE entry format */
+#endif
+
+#ifdef CONFIG_PAE
+typedef uint64_t pte_t;
+#else
+typedef uint32_t pte_t;
+#endif
+typedef pte_t pde_t;
+typedef pte_t vmm_phys_t;     /* Physical address as a page table entry holds it */
+
+/* Page directory / page table entry bits */
+#define PTE_PRESENT   0x001
+#define PTE_WRITABLE  0x002
+#define PTE_USER      0x004
+#define PTE_PWT       0x008
+#define PTE_PCD       0x010
+#define PTE_ACCESSED  0x020
+#define PTE_DIRTY     0x040
+#define PTE_LARGE     0x080   /* PDE only: maps a large page */
+#define PTE_GLOBAL    0x100   /* Survives CR3 reloads (CR4.PGE) */
+
+#ifdef CONFIG_PAE
+#define PTE_NX               ((pte_t)1 << 63)   /* No execute (EFER.NXE) */
+#define PTE_FRAME_MASK       ((pte_t)0x000FFFFFFFFFF000ULL)
+#define PDE_LARGE_FRAME_MASK ((pte_t)0x000FFFFFFFE00000ULL)
+#define VMM_PDPT_ENTRIES     4
+#define VMM_PTE_COUNT        512
+#ifdef __x86_64__
+#define VMM_PDE_COUNT        32768  /* 64 page directories back to back: 64GB */
+#else
+#define VMM_PDE_COUNT        2048   /* Four page directories back to back */
+#endif
+#define VMM_LARGE_PAGE_SHIFT 21
+#else
+#define PTE_NX               0
+#define PTE_FRAME_MASK       ((pte_t)0xFFFFF000)
+#define PDE_LARGE_FRAME_MASK ((pte_t)0xFFC00000)
+#define VMM_PDE_COUNT        1024
+#define VMM_PTE_COUNT        1024
+#define VMM_LARGE_PAGE_SHIFT 22
+#endif
+
+#define VMM_LARGE_PAGE_SIZE  (1u << VMM_LARGE_PAGE_SHIFT)
+#define VMM_LARGE_PAGE_ORDER (VMM_LARGE_PAGE_SHIFT - PMM_PAGE_SHIFT)
+
+#define VMM_DIRECT_MAP_END   PMM_HIGH_LIMIT   /* The PMM never hands out frames above */
+#ifdef __x86_64__
+#define VMM_WINDOW_START     0x100000000ULL
+#define VMM_WINDOW_END       0x1000000000ULL
+#define KERNEL_VMA           0xFFFFFFFF80000000ULL   /* Kernel image, see linker64.ld */
+#define KERNEL_PHYS(addr)    ((uintptr_t)(addr) - KERNEL_VMA)
+#else
+#define VMM_WINDOW_START     0xC0000000
+#define VMM_WINDOW_END       0xE0000000
+#define KERNEL_PHYS(addr)    ((uintptr_t)(addr))   /* Kernel image is identity mapped */
+#endif
+#define VMM_WINDOW_SLOTS     ((VMM_WINDOW_END - VMM_WINDOW_START) >> VMM_LARGE_PAGE_SHIFT)
+
+/* Longer flushes drop the whole TLB rather than invlpg each page */
+#define VMM_FLUSH_ALL_PAGES  64
+
+/* CPU feature bits used when enabling paging */
+#define CPUID_EDX_PSE        (1 << 3)
+#define CPUID_EDX_PAE        (1 << 6)
+#define CPUID_EDX_PGE        (1 << 13)
+#define CPUID_EXT_EDX_NX     (1 << 20)
+#define CR0_PG               0x80000000
+#define CR0_WP               0x00010000
+#define CR4_PSE              0x00000010
+#define CR4_PAE              0x00000020
+#define CR4_PGE              0x00000080
+#define MSR_EFER             0xC0000080
+#define EFER_NXE             0x00000800
+
+/* Nonzero for a frame vmm_unmap_window_keep() must not free */
+typedef int (*vmm_keep_t)(vmm_phys_t frame);
+
+/* Function prototypes */
+void vmm_init();
+int vmm_enabled();
+pte_t vmm_nx_flag();
+int vmm_map_page(uintptr_t virt, vmm_phys_t phys, pte_t flags);
+int vmm_map_large(uintptr_t virt, vmm_phys_t phys, pte_t flags);
+void vmm_unmap(uintptr_t virt);
+vmm_phys_t vmm_translate(uintptr_t virt);
+void *vmm_reserve(uint32_t size);
+void vmm_release(void *addr);
+int vmm_in_window(const void *addr);
+void vmm_unmap_window(void *addr);
+void vmm_unmap_window_keep(void *addr, vmm_keep_t keep);
+void vmm_flush_local(uintptr_t virt, uint32_t pages);
+void *vmm_map_scratch(vmm_phys_t frame);
+void vmm_unmap_scratch(void *addr);
+void *vmm_alloc_tensor(uint32_t size);
+void vmm_free_tensor(void *addr);
+
+#endif
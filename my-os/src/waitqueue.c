@@ -0,0 +1,91 @@
+/**
+ * @file waitqueue.c
+ * @brief Wait queue implementation
+ */
+
+#include "waitqueue.h"
+#include "timer.h"
+
+void wait_queue_init(wait_queue_t *wq) {
+    wq->lock.locked = 0;
+    wq->head = 0;
+}
+
+/* Join the queue before checking the condition, so no wakeup is missed */
+static void wait_add(wait_queue_t *wq, wait_entry_t *entry) {
+    entry->task = task_current();
+    entry->prev = 0;
+
+    uintptr_t flags = spin_lock_irqsave(&wq->lock);
+    entry->next = wq->head;
+    if (entry->next) entry->next->prev = entry;
+    wq->head = entry;
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+static void wait_remove(wait_queue_t *wq, wait_entry_t *entry) {
+    uintptr_t flags = spin_lock_irqsave(&wq->lock);
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        wq->head = entry->next;
+    }
+    if (entry->next) entry->next->prev = entry->prev;
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+/*
+ * Wake every task waiting on 'wq'; safe from interrupt handlers.
+ * Returns how many there were.
+ */
+int wait_queue_wake(wait_queue_t *wq) {
+    int woken = 0;
+    uintptr_t flags = spin_lock_irqsave(&wq->lock);
+    for (wait_entry_t *entry = wq->head; entry; entry = entry->next) {
+        /* A waiter leaves only under the lock, so its task is still there */
+        task_wake(entry->task);
+        woken++;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
+
+/* Sleep on 'wq' until cond(arg) is true */
+void wait_event(wait_queue_t *wq, wait_cond_t cond, void *arg) {
+    if (cond(arg)) return;
+
+    wait_entry_t entry;
+    wait_add(wq, &entry);
+    while (!cond(arg)) {
+        task_block();
+    }
+    wait_remove(wq, &entry);
+}
+
+/*
+ * Sleep on 'wq' until cond(arg) is true or 'ticks' ticks have gone by.
+ * Returns the ticks left (at least 1) if the condition came true, 0 on
+ * timeout.
+ */
+uint32_t wait_event_timeout(wait_queue_t *wq, wait_cond_t cond, void *arg, uint32_t ticks) {
+    uint32_t deadline = get_tick_count() + ticks;
+    if (cond(arg)) return ticks ? ticks : 1;
+
+    wait_entry_t entry;
+    wait_add(wq, &entry);
+    int32_t left;
+    while (1) {
+        left = (int32_t)(deadline - get_tick_count());
+        if (cond(arg)) {
+            if (left < 1) left = 1;
+            break;
+        }
+        if (left <= 0) {
+            left = 0;
+            break;
+        }
+        task_block_until(deadline);
+    }
+    wait_remove(wq, &entry);
+    return (uint32_t)left;
+}
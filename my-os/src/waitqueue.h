@@ -0,0 +1,42 @@
+/**
+ * @file waitqueue.h
+ * @brief Wait queues: sleep until a condition holds, with a timeout
+ *
+ * A wait queue lists the tasks waiting for something, e.g. a buffer to
+ * fill or a device to finish. A waiter passes a condition function; it
+ * sleeps until wait_queue_wake() and then checks the condition again, so
+ * the waker only has to make the condition true first and then wake the
+ * queue, from a task or an interrupt handler. The timed wait gives up
+ * after its ticks through the scheduler's timing wheel.
+ */
+
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+#include <stdint.h>
+#include "scheduler.h"
+#include "spinlock.h"
+
+typedef int (*wait_cond_t)(void *arg);
+
+/* A waiting task, on its own stack */
+typedef struct wait_entry {
+    task_t *task;
+    struct wait_entry *next;
+    struct wait_entry *prev;
+} wait_entry_t;
+
+typedef struct {
+    spinlock_t lock;
+    wait_entry_t *head;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT  { SPINLOCK_INIT, 0 }
+
+/* Function prototypes */
+void wait_queue_init(wait_queue_t *wq);
+int wait_queue_wake(wait_queue_t *wq);
+void wait_event(wait_queue_t *wq, wait_cond_t cond, void *arg);
+uint32_t wait_event_timeout(wait_queue_t *wq, wait_cond_t cond, void *arg, uint32_t ticks);
+
+#endif